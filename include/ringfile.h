@@ -33,6 +33,16 @@ struct RINGFILE;
 //     ringfile_read(buffer, size, f);
 //   }
 //
+// Reading many records at once::
+//
+//   int print_record(const void * data, size_t size, void * context) {
+//     fwrite(data, size, 1, stdout);
+//     return 0;
+//   }
+//
+//   RINGFILE * f = ringfile_open("hello.bin", "r");
+//   ringfile_foreach(f, print_record, NULL);
+//
 
 // Create a new ringfile. `path` must not exist.
 struct RINGFILE * ringfile_create(const char * path, size_t size);
@@ -40,8 +50,26 @@ struct RINGFILE * ringfile_create(const char * path, size_t size);
 // Open the file for reading. Mode is one of 'r' (read) or 'a' (append).
 struct RINGFILE * ringfile_open(const char * path, const char * mode);
 
-// TODO(ross): not yet implemented
-// RINGFILE * ringfile_fdopen(int fd, const char * mode);
+// Open a ringfile from a file descriptor that is already open. Mode is as for
+// ringfile_open(). The descriptor is closed by ringfile_close(), or left open
+// if this fails. The stream never uses the descriptor's file offset, so a
+// descriptor shared with another process, for example after fork(), is safe
+// to use.
+struct RINGFILE * ringfile_fdopen(int fd, const char * mode);
+
+// Create a new ringfile in shared memory instead of on disk. If `name` is not
+// NULL the ring is a POSIX shared memory object (see shm_open(3)) that other
+// processes can open with ringfile_open_shm(), and that survives the
+// processes using it until it is removed with shm_unlink(). If `name` is NULL
+// the ring is anonymous (a Linux memfd) and is shared by handing the
+// descriptor from ringfile_fileno() to another process, or across fork().
+struct RINGFILE * ringfile_create_shm(const char * name, size_t size);
+
+// Open a ring created by ringfile_create_shm(). Mode is as for ringfile_open().
+struct RINGFILE * ringfile_open_shm(const char * name, const char * mode);
+
+// Return the file descriptor underlying `stream`.
+int ringfile_fileno(struct RINGFILE * stream);
 
 // Write a record to the file. 
 // Returns 0 on success. On failure, returns -1 and sets errno.
@@ -55,6 +83,28 @@ int ringfile_read(void * ptr, size_t size, struct RINGFILE * stream);
 // success or -1 on failure.
 int ringfile_next_record_size(RINGFILE * self, size_t * size);
 
+// Called by ringfile_foreach() for each record. `data` is only valid until
+// the callback returns. Return 0 to continue or non-zero to stop after this
+// record.
+typedef int (*ringfile_callback)(const void * data, size_t size,
+  void * context);
+
+// Call `callback` for each remaining record in `stream`. The file is read in
+// large chunks and each record is handed out in place, without copying.
+// Returns the number of records visited. On failure, returns -1 and sets
+// errno.
+ssize_t ringfile_foreach(struct RINGFILE * stream, ringfile_callback callback,
+  void * context);
+
+// Read up to `count` records into the `capacity` byte buffer `buffer`, back to
+// back, stopping early at a record that does not fit. `offsets` must have room
+// for `count + 1` entries: `offsets[i]` receives the position in `buffer` of
+// record i and the entry after the last record its end. Returns the number of
+// records read, which is 0 at the end of the file. On failure, returns -1 and
+// sets errno (EMSGSIZE if the next record is bigger than `capacity`).
+ssize_t ringfile_read_batch(struct RINGFILE * stream, void * buffer,
+  size_t capacity, size_t * offsets, size_t count);
+
 // Close the the specified stream and free resources associated with it. Do not
 // reference `stream` again after this call.
 void ringfile_close(struct RINGFILE * stream);
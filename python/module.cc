@@ -3,6 +3,13 @@
 // found in the LICENSE file.
 #include "module.h"
 
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The number of records the iterator reads from the file at once.
+static const size_t kReadAheadRecords = 256;
+
 PyDoc_STRVAR(class_doc,
 "A Ringfile object represents a fixed size, disk backed buffer that can be \
 used to write records in a circular fashion. When the buffer is full, \
@@ -37,7 +44,16 @@ If the file exists or cannot be created raise IOError.");
 PyDoc_STRVAR(write_doc,
 "write(record)\n\
 \n\
-Append a record to the ringfile. Raise IOError if the write fails.");
+Append a record to the ringfile. *record* may be any object that supports \
+the buffer protocol, such as a string, bytearray or memoryview. Raise \
+IOError if the write fails.");
+
+PyDoc_STRVAR(write_many_doc,
+"write_many(records)\n\
+\n\
+Append every record in the iterable *records* in a single batch, without \
+holding the global interpreter lock while writing. Raise IOError if the \
+write fails.");
 
 PyDoc_STRVAR(read_doc,
 "read()\n\
@@ -45,6 +61,52 @@ PyDoc_STRVAR(read_doc,
 Read and return a record from the ringfile. Return None if there are no more \
 records in the file. Raise IOError if the read fails.");
 
+PyDoc_STRVAR(read_many_doc,
+"read_many(count)\n\
+\n\
+Read up to *count* records in one call, without holding the global \
+interpreter lock while the file is read. Return a tuple *(data, offsets)* \
+where *data* holds the records back to back and *offsets* is a list of one \
+more offset than there are records, so that record *i* is \
+``data[offsets[i]:offsets[i + 1]]``. Raise IOError if the read fails.");
+
+PyDoc_STRVAR(read_all_doc,
+"read_all()\n\
+\n\
+Like :meth:`read_many` but read every remaining record.");
+
+PyDoc_STRVAR(views_doc,
+"views()\n\
+\n\
+Return an iterator over the remaining records that yields read only \
+``memoryview`` objects pointing straight into a shared mapping of the file, \
+so records are not copied. A view shows whatever is in the file at that \
+position, so it is only meaningful until a writer overwrites the record; \
+copy it with ``bytes()`` to keep it. Records that wrap around the end of \
+the file are copied.");
+
+PyDoc_STRVAR(follow_doc,
+"follow(timeout=None)\n\
+\n\
+Return an iterator over the remaining records that, instead of stopping at \
+the end of the file, waits for more to be written. The wait happens without \
+holding the global interpreter lock. If *timeout* is given, iteration stops \
+once no record has arrived for *timeout* seconds.");
+
+PyDoc_STRVAR(fileno_doc,
+"fileno()\n\
+\n\
+Return a file descriptor that becomes readable when records may have been \
+written, for use with select, poll or an event loop such as asyncio's \
+``add_reader()``. When it is readable, call :meth:`ready` and then read. \
+Raise IOError if the platform cannot watch files.");
+
+PyDoc_STRVAR(ready_doc,
+"ready()\n\
+\n\
+Clear the notifications pending on :meth:`fileno` and return True if there \
+is a record to read.");
+
 PyDoc_STRVAR(close_doc,
 "close()\n\
 \n\
@@ -57,8 +119,22 @@ static PyMethodDef Ringfile_methods[] = {
     create_doc},
   {"write", (PyCFunction)Ringfile_write, METH_VARARGS|METH_KEYWORDS,
     write_doc},
+  {"write_many", (PyCFunction)Ringfile_write_many,
+    METH_VARARGS|METH_KEYWORDS, write_many_doc},
   {"read", (PyCFunction)Ringfile_read, METH_NOARGS,
     read_doc},
+  {"read_many", (PyCFunction)Ringfile_read_many, METH_VARARGS|METH_KEYWORDS,
+    read_many_doc},
+  {"read_all", (PyCFunction)Ringfile_read_all, METH_NOARGS,
+    read_all_doc},
+  {"views", (PyCFunction)Ringfile_views, METH_NOARGS,
+    views_doc},
+  {"follow", (PyCFunction)Ringfile_follow, METH_VARARGS|METH_KEYWORDS,
+    follow_doc},
+  {"fileno", (PyCFunction)Ringfile_fileno, METH_NOARGS,
+    fileno_doc},
+  {"ready", (PyCFunction)Ringfile_ready, METH_NOARGS,
+    ready_doc},
   {"close", (PyCFunction)Ringfile_close, METH_NOARGS,
     close_doc},
   {NULL}  //  Sentinel
@@ -106,13 +182,112 @@ static PyTypeObject RingfileType = {
   (newfunc)Ringfile_new,     // tp_new
 };
 
+static PyBufferProcs RingfileMapping_as_buffer = {
+  0,                         // bf_getreadbuffer
+  0,                         // bf_getwritebuffer
+  0,                         // bf_getsegcount
+  0,                         // bf_getcharbuffer
+  (getbufferproc)RingfileMapping_getbuffer,  // bf_getbuffer
+  0,                         // bf_releasebuffer
+};
+
+static PyTypeObject RingfileMappingType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                         // ob_size
+  "ringfile._Mapping",       // tp_name
+  sizeof(RingfileMappingObject),  // tp_basicsize
+  0,                         // tp_itemsize
+  (destructor)RingfileMapping_dealloc,  // tp_dealloc
+  0,                         // tp_print
+  0,                         // tp_getattr
+  0,                         // tp_setattr
+  0,                         // tp_compare
+  0,                         // tp_repr
+  0,                         // tp_as_number
+  0,                         // tp_as_sequence
+  0,                         // tp_as_mapping
+  0,                         // tp_hash
+  0,                         // tp_call
+  0,                         // tp_str
+  0,                         // tp_getattro
+  0,                         // tp_setattro
+  &RingfileMapping_as_buffer,  // tp_as_buffer
+  Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_NEWBUFFER,  // tp_flags
+  "A read only mapping of a ringfile.",  // tp_doc
+};
+
+static PyTypeObject RingfileViewIteratorType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                         // ob_size
+  "ringfile._ViewIterator",  // tp_name
+  sizeof(RingfileViewIteratorObject),  // tp_basicsize
+  0,                         // tp_itemsize
+  (destructor)RingfileViewIterator_dealloc,  // tp_dealloc
+  0,                         // tp_print
+  0,                         // tp_getattr
+  0,                         // tp_setattr
+  0,                         // tp_compare
+  0,                         // tp_repr
+  0,                         // tp_as_number
+  0,                         // tp_as_sequence
+  0,                         // tp_as_mapping
+  0,                         // tp_hash
+  0,                         // tp_call
+  0,                         // tp_str
+  0,                         // tp_getattro
+  0,                         // tp_setattro
+  0,                         // tp_as_buffer
+  Py_TPFLAGS_DEFAULT,        // tp_flags
+  "An iterator over ringfile records as memory views.",  // tp_doc
+  0,                         // tp_traverse
+  0,                         // tp_clear
+  0,                         // tp_richcompare
+  0,                         // tp_weaklistoffset
+  PyObject_SelfIter,         // tp_iter
+  (iternextfunc)RingfileViewIterator_iternext,  // tp_iternext
+};
+
+static PyTypeObject RingfileFollowIteratorType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                         // ob_size
+  "ringfile._FollowIterator",  // tp_name
+  sizeof(RingfileFollowIteratorObject),  // tp_basicsize
+  0,                         // tp_itemsize
+  (destructor)RingfileFollowIterator_dealloc,  // tp_dealloc
+  0,                         // tp_print
+  0,                         // tp_getattr
+  0,                         // tp_setattr
+  0,                         // tp_compare
+  0,                         // tp_repr
+  0,                         // tp_as_number
+  0,                         // tp_as_sequence
+  0,                         // tp_as_mapping
+  0,                         // tp_hash
+  0,                         // tp_call
+  0,                         // tp_str
+  0,                         // tp_getattro
+  0,                         // tp_setattro
+  0,                         // tp_as_buffer
+  Py_TPFLAGS_DEFAULT,        // tp_flags
+  "An iterator that waits for new ringfile records.",  // tp_doc
+  0,                         // tp_traverse
+  0,                         // tp_clear
+  0,                         // tp_richcompare
+  0,                         // tp_weaklistoffset
+  PyObject_SelfIter,         // tp_iter
+  (iternextfunc)RingfileFollowIterator_iternext,  // tp_iternext
+};
+
 static PyMethodDef module_methods[] = {
     {NULL}  //  Sentinel
 };
 
 PyMODINIT_FUNC initringfile() {
   RingfileType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&RingfileType) < 0) {
+  if (PyType_Ready(&RingfileType) < 0 ||
+      PyType_Ready(&RingfileMappingType) < 0 ||
+      PyType_Ready(&RingfileViewIteratorType) < 0 ||
+      PyType_Ready(&RingfileFollowIteratorType) < 0) {
     return;
   }
 
@@ -129,11 +304,62 @@ PyMODINIT_FUNC initringfile() {
   PyModule_AddIntConstant(module, "MODE_APPEND", Ringfile::kAppend);
 }
 
+static PyObject * SetIOError(int error) {
+  PyObject * value = PyInt_FromLong(error);
+  PyErr_SetObject(PyExc_IOError, value);
+  Py_DECREF(value);
+  return NULL;
+}
+
+// How long follow() holds the object's lock while it waits (ms).
+const int kFollowWaitSlice = 100;
+
+// Holds the lock of a Ringfile object for the life of the scope. Other
+// threads may run while we wait for it.
+class ObjectLock {
+ public:
+  explicit ObjectLock(RingfileObject * self)
+    : lock_(self->lock) {
+    if (!PyThread_acquire_lock(lock_, NOWAIT_LOCK)) {
+      Py_BEGIN_ALLOW_THREADS
+      PyThread_acquire_lock(lock_, WAIT_LOCK);
+      Py_END_ALLOW_THREADS
+    }
+  }
+
+  ~ObjectLock() {
+    PyThread_release_lock(lock_);
+  }
+
+ private:
+  PyThread_type_lock lock_;
+};
+
+// Return the next record read ahead by the iterator as a string, or NULL if
+// there is none.
+static PyObject * PopReadAhead(RingfileObject * self) {
+  ReadAhead * read_ahead = self->read_ahead;
+  if (!read_ahead || read_ahead->next == read_ahead->offsets.size()) {
+    return NULL;
+  }
+  size_t start = read_ahead->offsets[read_ahead->next];
+  size_t end = ++read_ahead->next == read_ahead->offsets.size() ?
+    read_ahead->data.size() : read_ahead->offsets[read_ahead->next];
+  return PyString_FromStringAndSize(read_ahead->data.data() + start,
+    end - start);
+}
+
 static void Ringfile_dealloc(RingfileObject * self) {
   if (self->impl) {
     delete self->impl;
     self->impl = NULL;
   }
+  delete self->read_ahead;
+  self->read_ahead = NULL;
+  if (self->lock) {
+    PyThread_free_lock(self->lock);
+    self->lock = NULL;
+  }
   self->ob_type->tp_free(reinterpret_cast<PyObject *>(self));
 }
 
@@ -145,6 +371,8 @@ static PyObject * Ringfile_new(PyTypeObject * type, PyObject * args,
     return NULL;
   }
   self->impl = NULL;
+  self->read_ahead = NULL;
+  self->lock = NULL;
   return reinterpret_cast<PyObject *>(self);
 }
 
@@ -158,6 +386,13 @@ static int Ringfile_init(RingfileObject * self, PyObject * args,
     return -1;
   }
 
+  if (self->lock == NULL) {
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
   self->impl = new Ringfile();
 
   if (!self->impl->Open(path, mode)) {
@@ -181,6 +416,12 @@ static PyObject * Ringfile_create(PyObject * cls, PyObject * args,
 
   RingfileObject * self = PyObject_New(RingfileObject, &RingfileType);
   self->impl = new Ringfile();
+  self->read_ahead = NULL;
+  self->lock = PyThread_allocate_lock();
+  if (self->lock == NULL) {
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
 
   if (!self->impl->Create(path, size)) {
     PyObject * error = PyInt_FromLong(self->impl->error());
@@ -197,30 +438,90 @@ static PyObject * Ringfile_create(PyObject * cls, PyObject * args,
 static PyObject * Ringfile_write(RingfileObject * self, PyObject * args,
     PyObject * kwargs) {
   static char * kwlist[] = {"buffer", NULL};
-  PyObject * buffer = NULL;
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S", kwlist, &buffer)) {
+  Py_buffer buffer;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*", kwlist, &buffer)) {
     return NULL;
   }
-  if (!self->impl->Write(PyString_AsString(buffer), PyString_Size(buffer))) {
-    PyObject * error = PyInt_FromLong(self->impl->error());
-    PyErr_SetObject(PyExc_IOError, error);
-    Py_DECREF(error);
-    return NULL;
+
+  ObjectLock lock(self);
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = self->impl->Write(buffer.buf, buffer.len);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&buffer);
+  if (!ok) {
+    return SetIOError(self->impl->error());
   }
   Py_RETURN_NONE;
 }
 
+static PyObject * Ringfile_write_many(RingfileObject * self, PyObject * args,
+    PyObject * kwargs) {
+  static char * kwlist[] = {"records", NULL};
+  PyObject * records = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &records)) {
+    return NULL;
+  }
+  PyObject * iterator = PyObject_GetIter(records);
+  if (iterator == NULL) {
+    return NULL;
+  }
+
+  // Hold on to every buffer until the batch has been written.
+  std::vector<Py_buffer> buffers;
+  PyObject * item;
+  while ((item = PyIter_Next(iterator)) != NULL) {
+    Py_buffer buffer;
+    int rv = PyObject_GetBuffer(item, &buffer, PyBUF_SIMPLE);
+    Py_DECREF(item);
+    if (rv == -1) {
+      break;
+    }
+    buffers.push_back(buffer);
+  }
+  Py_DECREF(iterator);
+
+  PyObject * rv = NULL;
+  if (!PyErr_Occurred()) {
+    std::vector<struct iovec> iov(buffers.size() + 1);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      iov[i].iov_base = buffers[i].buf;
+      iov[i].iov_len = buffers[i].len;
+    }
+
+    ObjectLock lock(self);
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = self->impl->WriteBatch(&iov[0], buffers.size());
+    Py_END_ALLOW_THREADS
+    if (ok) {
+      Py_INCREF(Py_None);
+      rv = Py_None;
+    } else {
+      SetIOError(self->impl->error());
+    }
+  }
+
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    PyBuffer_Release(&buffers[i]);
+  }
+  return rv;
+}
+
 static PyObject * Ringfile_read(RingfileObject *self) {
+  ObjectLock lock(self);
+  PyObject * record = PopReadAhead(self);
+  if (record) {
+    return record;
+  }
+
   if (self->impl->EndOfFile()) {
     Py_RETURN_NONE;
   }
-  
+
   size_t record_size;
   if (!self->impl->NextRecordSize(&record_size)) {
-    PyObject * error = PyInt_FromLong(self->impl->error());
-    PyErr_SetObject(PyExc_IOError, error);
-    Py_DECREF(error);
-    return NULL;
+    return SetIOError(self->impl->error());
   }
 
   PyObject * buffer = PyString_FromStringAndSize(NULL, record_size);
@@ -228,24 +529,82 @@ static PyObject * Ringfile_read(RingfileObject *self) {
     return NULL;
   }
 
-  if (_PyString_Resize(&buffer, record_size) == -1) {
-    // "If the reallocation fails, the original string object at *string is
-    // deallocated".
-    return NULL;
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = self->impl->Read(PyString_AS_STRING(buffer), record_size);
+  Py_END_ALLOW_THREADS
+  if (!ok) {
+    Py_DECREF(buffer);
+    return SetIOError(self->impl->error());
   }
 
+  return buffer;
+}
 
-  if (!self->impl->Read(PyString_AS_STRING(buffer), record_size)) {
-    Py_DECREF(buffer);
+// Read up to `max_records` records (all of them if zero) and return them as
+// a (data, offsets) tuple.
+static PyObject * ReadBatch(RingfileObject * self, size_t max_records) {
+  ObjectLock lock(self);
+  std::string data;
+  std::vector<size_t> offsets;
+
+  // Records the iterator has already read come first.
+  ReadAhead * read_ahead = self->read_ahead;
+  while (read_ahead && read_ahead->next < read_ahead->offsets.size() &&
+      (max_records == 0 || offsets.size() < max_records)) {
+    size_t start = read_ahead->offsets[read_ahead->next];
+    size_t end = ++read_ahead->next == read_ahead->offsets.size() ?
+      read_ahead->data.size() : read_ahead->offsets[read_ahead->next];
+    offsets.push_back(data.size());
+    data.append(read_ahead->data, start, end - start);
+  }
 
-    PyObject * error = PyInt_FromLong(self->impl->error());
-    PyErr_SetObject(PyExc_IOError, error);
-    Py_DECREF(error);
+  if (max_records == 0 || offsets.size() < max_records) {
+    size_t remaining = max_records ? max_records - offsets.size() : 0;
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = self->impl->ReadBatch(remaining, &data, &offsets);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+      return SetIOError(self->impl->error());
+    }
+  }
 
+  PyObject * offsets_list = PyList_New(offsets.size() + 1);
+  if (offsets_list == NULL) {
     return NULL;
   }
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    PyList_SET_ITEM(offsets_list, i, PyInt_FromSize_t(offsets[i]));
+  }
+  PyList_SET_ITEM(offsets_list, offsets.size(),
+    PyInt_FromSize_t(data.size()));
 
-  return buffer;
+  PyObject * data_string = PyString_FromStringAndSize(data.data(),
+    data.size());
+  if (data_string == NULL) {
+    Py_DECREF(offsets_list);
+    return NULL;
+  }
+  return Py_BuildValue("(NN)", data_string, offsets_list);
+}
+
+static PyObject * Ringfile_read_many(RingfileObject * self, PyObject * args,
+    PyObject * kwargs) {
+  static char * kwlist[] = {"count", NULL};
+  int count;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &count)) {
+    return NULL;
+  }
+  if (count <= 0) {
+    PyErr_SetString(PyExc_ValueError, "count must be positive");
+    return NULL;
+  }
+  return ReadBatch(self, count);
+}
+
+static PyObject * Ringfile_read_all(RingfileObject * self) {
+  return ReadBatch(self, 0);
 }
 
 static PyObject * Ringfile_iter(RingfileObject * self) {
@@ -254,19 +613,239 @@ static PyObject * Ringfile_iter(RingfileObject * self) {
 }
 
 static PyObject * Ringfile_iternext(RingfileObject * self) {
-  PyObject * rv = Ringfile_read(self);
-  if (rv == NULL) {
-    return NULL;
+  ObjectLock lock(self);
+  PyObject * record = PopReadAhead(self);
+  if (record) {
+    return record;
+  }
+
+  if (!self->read_ahead) {
+    self->read_ahead = new ReadAhead();
   }
-  if (rv == Py_None) {
-    Py_DECREF(rv);
+  ReadAhead * read_ahead = self->read_ahead;
+  read_ahead->data.clear();
+  read_ahead->offsets.clear();
+  read_ahead->next = 0;
+
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = self->impl->ReadBatch(kReadAheadRecords, &read_ahead->data,
+    &read_ahead->offsets);
+  Py_END_ALLOW_THREADS
+  if (!ok) {
+    return SetIOError(self->impl->error());
+  }
+
+  record = PopReadAhead(self);
+  if (record == NULL) {
     PyErr_SetNone(PyExc_StopIteration);
+  }
+  return record;
+}
+
+static PyObject * Ringfile_views(RingfileObject * self) {
+  RingfileViewIteratorObject * iterator = PyObject_New(
+    RingfileViewIteratorObject, &RingfileViewIteratorType);
+  if (iterator == NULL) {
     return NULL;
   }
-  return rv;
+  Py_INCREF(self);
+  iterator->ringfile = self;
+  iterator->mapping = NULL;
+  return reinterpret_cast<PyObject *>(iterator);
+}
+
+static void RingfileMapping_dealloc(RingfileMappingObject * self) {
+  if (self->address) {
+    munmap(self->address, self->size);
+  }
+  PyObject_Del(self);
+}
+
+static int RingfileMapping_getbuffer(RingfileMappingObject * self,
+    Py_buffer * view, int flags) {
+  return PyBuffer_FillInfo(view, reinterpret_cast<PyObject *>(self),
+    self->address, self->size, 1, flags);
+}
+
+static void RingfileViewIterator_dealloc(RingfileViewIteratorObject * self) {
+  Py_XDECREF(self->mapping);
+  Py_DECREF(self->ringfile);
+  PyObject_Del(self);
+}
+
+static PyObject * RingfileViewIterator_iternext(
+    RingfileViewIteratorObject * self) {
+  RingfileObject * ringfile = self->ringfile;
+  ObjectLock lock(ringfile);
+
+  // Records the iterator has already read cannot be mapped, so hand out views
+  // of copies.
+  PyObject * record = PopReadAhead(ringfile);
+  if (record) {
+    PyObject * view = PyMemoryView_FromObject(record);
+    Py_DECREF(record);
+    return view;
+  }
+
+  Ringfile * impl = ringfile->impl;
+  if (impl->EndOfFile()) {
+    return NULL;
+  }
+  uint64_t offset;
+  size_t size;
+  if (!impl->SkipRecord(&offset, &size)) {
+    return SetIOError(impl->error());
+  }
+
+  // Map the file the first time through, and again if it has been resized.
+  if (!self->mapping || self->mapping->size != impl->file_size()) {
+    void * address = mmap(0, impl->file_size(), PROT_READ, MAP_SHARED,
+      impl->fd(), 0);
+    if (address == MAP_FAILED) {
+      return SetIOError(errno);
+    }
+    RingfileMappingObject * mapping = PyObject_New(RingfileMappingObject,
+      &RingfileMappingType);
+    if (mapping == NULL) {
+      munmap(address, impl->file_size());
+      return NULL;
+    }
+    mapping->address = address;
+    mapping->size = impl->file_size();
+    Py_XDECREF(self->mapping);
+    self->mapping = mapping;
+  }
+
+  const char * address = reinterpret_cast<const char *>(
+    self->mapping->address);
+  if (offset + size <= self->mapping->size) {
+    // The view takes over the reference to the mapping that
+    // PyBuffer_FillInfo() adds.
+    Py_buffer buffer;
+    if (PyBuffer_FillInfo(&buffer,
+        reinterpret_cast<PyObject *>(self->mapping),
+        const_cast<char *>(address + offset), size, 1,
+        PyBUF_CONTIG_RO) == -1) {
+      return NULL;
+    }
+    return PyMemoryView_FromBuffer(&buffer);
+  }
+
+  record = PyString_FromStringAndSize(NULL, size);
+  if (record == NULL) {
+    return NULL;
+  }
+  size_t tail = self->mapping->size - offset;
+  memcpy(PyString_AS_STRING(record), address + offset, tail);
+  memcpy(PyString_AS_STRING(record) + tail, address + impl->data_offset(),
+    size - tail);
+  PyObject * view = PyMemoryView_FromObject(record);
+  Py_DECREF(record);
+  return view;
+}
+
+static PyObject * Ringfile_follow(RingfileObject * self, PyObject * args,
+    PyObject * kwargs) {
+  static char * kwlist[] = {"timeout", NULL};
+  PyObject * timeout = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout)) {
+    return NULL;
+  }
+  int timeout_ms = -1;
+  if (timeout != Py_None) {
+    double seconds = PyFloat_AsDouble(timeout);
+    if (seconds == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    timeout_ms = seconds <= 0 ? 0 : static_cast<int>(seconds * 1000);
+  }
+
+  RingfileFollowIteratorObject * iterator = PyObject_New(
+    RingfileFollowIteratorObject, &RingfileFollowIteratorType);
+  if (iterator == NULL) {
+    return NULL;
+  }
+  Py_INCREF(self);
+  iterator->ringfile = self;
+  iterator->timeout_ms = timeout_ms;
+  return reinterpret_cast<PyObject *>(iterator);
+}
+
+static void RingfileFollowIterator_dealloc(
+    RingfileFollowIteratorObject * self) {
+  Py_DECREF(self->ringfile);
+  PyObject_Del(self);
+}
+
+static PyObject * RingfileFollowIterator_iternext(
+    RingfileFollowIteratorObject * self) {
+  while (true) {
+    PyObject * record = Ringfile_iternext(self->ringfile);
+    if (record || !PyErr_ExceptionMatches(PyExc_StopIteration)) {
+      return record;
+    }
+    PyErr_Clear();
+
+    // Wait a slice at a time, so that other threads can use the object in
+    // between rather than block behind the lock for the whole wait.
+    Ringfile * impl = self->ringfile->impl;
+    int remaining_ms = self->timeout_ms;
+    while (true) {
+      int wait_ms = remaining_ms;
+      if (wait_ms < 0 || wait_ms > kFollowWaitSlice) {
+        wait_ms = kFollowWaitSlice;
+      }
+      bool ok;
+      int error;
+      {
+        ObjectLock lock(self->ringfile);
+        Py_BEGIN_ALLOW_THREADS
+        ok = impl->WaitForData(wait_ms);
+        Py_END_ALLOW_THREADS
+        error = impl->error();
+      }
+      if (ok) {
+        break;
+      }
+      if (error != ETIMEDOUT) {
+        return SetIOError(error);
+      }
+      if (remaining_ms >= 0) {
+        remaining_ms -= wait_ms;
+        if (remaining_ms <= 0) {
+          return NULL;
+        }
+      }
+    }
+  }
+}
+
+static PyObject * Ringfile_fileno(RingfileObject * self) {
+  ObjectLock lock(self);
+  if (!self->impl->WatchForData()) {
+    return SetIOError(self->impl->error());
+  }
+  return PyInt_FromLong(self->impl->notify_fd());
+}
+
+static PyObject * Ringfile_ready(RingfileObject * self) {
+  ObjectLock lock(self);
+  if (self->read_ahead &&
+      self->read_ahead->next < self->read_ahead->offsets.size()) {
+    Py_RETURN_TRUE;
+  }
+  bool ready;
+  Py_BEGIN_ALLOW_THREADS
+  ready = self->impl->HandleNotification();
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(ready);
 }
 
 static PyObject * Ringfile_close(RingfileObject *self) {
+  ObjectLock lock(self);
+  delete self->read_ahead;
+  self->read_ahead = NULL;
   self->impl->Close();
   Py_RETURN_NONE;
 }
@@ -5,13 +5,46 @@
 #define PYTHON_MODULE_H_
 
 #include <Python.h>
+#include <pythread.h>
 #include "ringfile_internal.h"
 
+// Records read ahead of the caller by the iterator.
+struct ReadAhead {
+  ReadAhead() : next(0) { }
+
+  std::string data;
+  std::vector<size_t> offsets;
+  size_t next;
+};
+
 typedef struct {
   PyObject_HEAD
   Ringfile * impl;
+  ReadAhead * read_ahead;
+  // Serializes calls that release the global interpreter lock.
+  PyThread_type_lock lock;
 } RingfileObject;
 
+// A read only mapping of a whole ringfile. Memory views returned by
+// Ringfile.views() hold a reference to it.
+typedef struct {
+  PyObject_HEAD
+  void * address;
+  size_t size;
+} RingfileMappingObject;
+
+typedef struct {
+  PyObject_HEAD
+  RingfileObject * ringfile;
+  RingfileMappingObject * mapping;
+} RingfileViewIteratorObject;
+
+typedef struct {
+  PyObject_HEAD
+  RingfileObject * ringfile;
+  int timeout_ms;
+} RingfileFollowIteratorObject;
+
 static void Ringfile_dealloc(RingfileObject * self);
 static PyObject * Ringfile_new(PyTypeObject * type, PyObject * args,
     PyObject * kwargs);
@@ -25,5 +58,26 @@ static PyObject * Ringfile_read(RingfileObject *self);
 static PyObject * Ringfile_iter(RingfileObject *self);
 static PyObject * Ringfile_iternext(RingfileObject *self);
 static PyObject * Ringfile_close(RingfileObject *self);
+static PyObject * Ringfile_write_many(RingfileObject * self, PyObject * args,
+  PyObject * kwargs);
+static PyObject * Ringfile_read_many(RingfileObject * self, PyObject * args,
+  PyObject * kwargs);
+static PyObject * Ringfile_read_all(RingfileObject * self);
+static PyObject * Ringfile_views(RingfileObject * self);
+static PyObject * Ringfile_follow(RingfileObject * self, PyObject * args,
+  PyObject * kwargs);
+static PyObject * Ringfile_fileno(RingfileObject * self);
+static PyObject * Ringfile_ready(RingfileObject * self);
+
+static void RingfileMapping_dealloc(RingfileMappingObject * self);
+static int RingfileMapping_getbuffer(RingfileMappingObject * self,
+  Py_buffer * view, int flags);
+static void RingfileViewIterator_dealloc(RingfileViewIteratorObject * self);
+static PyObject * RingfileViewIterator_iternext(
+  RingfileViewIteratorObject * self);
+static void RingfileFollowIterator_dealloc(
+  RingfileFollowIteratorObject * self);
+static PyObject * RingfileFollowIterator_iternext(
+  RingfileFollowIteratorObject * self);
 
 #endif  // PYTHON_MODULE_H_
@@ -4,8 +4,10 @@
 # found in the LICENSE file.
 
 import atexit
+import select
 import shutil
 import tempfile
+import threading
 import unittest
 
 from ringfile import Ringfile, MODE_READ, MODE_APPEND
@@ -63,6 +65,114 @@ class RingFileTest(unittest.TestCase):
     records = list(Ringfile(path, MODE_READ))
     self.assertEqual(["Hello, World!", "Goodbye, World!"], records)
 
+  def testCanReadMany(self):
+    path = TempDir() + "/ring"
+
+    ringfile = Ringfile.create(path, 4096)
+    expected = ["record %d" % i + "x" * (i % 13) for i in range(200)]
+    for record in expected:
+      ringfile.write(record)
+    ringfile.close()
+
+    ringfile = Ringfile(path, MODE_READ)
+    records = []
+    while True:
+      data, offsets = ringfile.read_many(7)
+      if len(offsets) == 1:
+        break
+      records.extend(data[offsets[i]:offsets[i + 1]]
+        for i in range(len(offsets) - 1))
+    self.assertEqual(expected[-len(records):], records)
+
+    ringfile = Ringfile(path, MODE_READ)
+    self.assertEqual(records[0], next(iter(ringfile)))
+    data, offsets = ringfile.read_all()
+    self.assertEqual(len(records), len(offsets))
+    self.assertEqual("".join(records[1:]), data)
+    self.assertEqual(None, ringfile.read())
+
+  def testCanReadViews(self):
+    path = TempDir() + "/ring"
+
+    ringfile = Ringfile.create(path, 64)
+    ringfile.write("0123456789")
+    ringfile.write("abcdefghijklmnopqrst")
+    ringfile.write("ABCDEFGHIJKLMNO")  # wraps around the end of the file
+    ringfile.close()
+
+    ringfile = Ringfile(path, MODE_READ)
+    views = list(ringfile.views())
+    self.assertTrue(all(isinstance(view, memoryview) for view in views))
+    self.assertEqual(["abcdefghijklmnopqrst", "ABCDEFGHIJKLMNO"],
+      [view.tobytes() for view in views])
+    ringfile.close()
+    del ringfile
+    self.assertEqual("abcdefghijklmnopqrst", views[0].tobytes())
+
+  def testCanWriteBuffers(self):
+    path = TempDir() + "/ring"
+
+    ringfile = Ringfile.create(path, 1024)
+    ringfile.write(bytearray("bytearray"))
+    ringfile.write(memoryview("memoryview"))
+    ringfile.write_many(["one", bytearray("two"), memoryview("three"), ""])
+    ringfile.write_many(iter([]))
+    with self.assertRaises(TypeError):
+      ringfile.write_many(["four", 5])
+    with self.assertRaises(IOError):
+      ringfile.write_many(["x" * 2000])
+    ringfile.close()
+
+    self.assertEqual(["bytearray", "memoryview", "one", "two", "three", ""],
+      list(Ringfile(path, MODE_READ)))
+
+  def testCanWriteFromThreads(self):
+    path = TempDir() + "/ring"
+
+    ringfile = Ringfile.create(path, 1024 * 1024)
+    def Write(name):
+      for i in range(100):
+        ringfile.write_many(["%s %d %d" % (name, i, j) for j in range(10)])
+        ringfile.write("%s %d" % (name, i))
+    threads = [threading.Thread(target=Write, args=(str(i),))
+      for i in range(4)]
+    for thread in threads:
+      thread.start()
+    for thread in threads:
+      thread.join()
+    ringfile.close()
+
+    records = list(Ringfile(path, MODE_READ))
+    self.assertEqual(4 * 100 * 11, len(records))
+    for name in range(4):
+      mine = [record for record in records
+        if record.startswith("%d " % name)]
+      self.assertEqual("%d 0 0" % name, mine[0])
+      self.assertEqual("%d 99" % name, mine[-1])
+
+  def testCanFollow(self):
+    path = TempDir() + "/ring"
+
+    writer = Ringfile.create(path, 1024)
+    writer.write("first")
+    reader = Ringfile(path, MODE_READ)
+
+    timer = threading.Timer(0.05, writer.write, ("second",))
+    timer.start()
+    follow = reader.follow(timeout=5)
+    self.assertEqual("first", next(follow))
+    self.assertEqual("second", next(follow))
+    timer.join()
+
+    self.assertEqual([], list(reader.follow(timeout=0.02)))
+
+    self.assertFalse(reader.ready())
+    writer.write("third")
+    readable, _, _ = select.select([reader], [], [], 5)
+    self.assertEqual([reader], readable)
+    self.assertTrue(reader.ready())
+    self.assertEqual("third", reader.read())
+
   def testDocsExist(self):
     self.assertTrue(Ringfile.__doc__)
     for name in dir(Ringfile):
@@ -3,6 +3,7 @@
 # found in the LICENSE file.
 import os
 import shutil
+import sys
 from os.path import basename, join as pathjoin
 
 from setuptools import setup, Extension
@@ -11,7 +12,10 @@ from setuptools import setup, Extension
 srcdir = "."
 sources = [
   "module.cc",
+  "../src/crc32.cc",
+  "../src/direct_io.cc",
   "../src/ringfile.cc",
+  "../src/uring_writer.cc",
   "../src/varint.cc",
 ]
 
@@ -40,6 +44,8 @@ setup(
       srcdir + "/../src",
       srcdir + "/.",
     ],
+    # shm_open() and clock_gettime() live in librt on older C libraries
+    libraries=["rt"] if sys.platform.startswith("linux") else [],
   )],
   test_suite='ringfile_test',
 )
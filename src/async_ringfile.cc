@@ -0,0 +1,238 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "async_ringfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+AsyncRingfile::AsyncRingfile()
+  : error_(0),
+    thread_started_(false),
+    submissions_(kQueueDepth),
+    completions_(kQueueDepth),
+    outstanding_(0),
+    sleeping_(false),
+    stopping_(false) {
+  completion_fds_[0] = -1;
+  completion_fds_[1] = -1;
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&condition_, NULL);
+}
+
+AsyncRingfile::~AsyncRingfile() {
+  Close();
+  pthread_cond_destroy(&condition_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool AsyncRingfile::Create(const std::string & path, size_t size) {
+  if (!ring_.Create(path, size)) {
+    error_ = ring_.error();
+    return false;
+  }
+  return Start();
+}
+
+bool AsyncRingfile::Open(const std::string & path, Ringfile::Mode mode) {
+  if (!ring_.Open(path, mode)) {
+    error_ = ring_.error();
+    return false;
+  }
+  return Start();
+}
+
+bool AsyncRingfile::Start() {
+  if (pipe(completion_fds_) == -1) {
+    error_ = errno;
+    ring_.Close();
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(completion_fds_[i], F_SETFL,
+      fcntl(completion_fds_[i], F_GETFL) | O_NONBLOCK);
+    fcntl(completion_fds_[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  stopping_ = false;
+  int rv = pthread_create(&thread_, NULL, &AsyncRingfile::ThreadMain, this);
+  if (rv != 0) {
+    error_ = rv;
+    Close();
+    return false;
+  }
+  thread_started_ = true;
+  return true;
+}
+
+bool AsyncRingfile::AsyncWrite(const void * ptr, size_t size,
+    WriteCallback callback, void * context) {
+  Operation * operation = new Operation;
+  operation->type = Operation::kWrite;
+  operation->write_callback = callback;
+  operation->read_callback = NULL;
+  operation->context = context;
+  operation->data.assign(static_cast<const char *>(ptr), size);
+  operation->error = 0;
+  return Submit(operation);
+}
+
+bool AsyncRingfile::AsyncRead(ReadCallback callback, void * context) {
+  Operation * operation = new Operation;
+  operation->type = Operation::kRead;
+  operation->write_callback = NULL;
+  operation->read_callback = callback;
+  operation->context = context;
+  operation->error = 0;
+  return Submit(operation);
+}
+
+bool AsyncRingfile::Submit(Operation * operation) {
+  if (!thread_started_) {
+    delete operation;
+    error_ = EBADF;
+    return false;
+  }
+  if (outstanding_ >= kQueueDepth || !submissions_.Push(operation)) {
+    delete operation;
+    error_ = EAGAIN;
+    return false;
+  }
+  ++outstanding_;
+
+  // The I/O thread publishes sleeping_ before it checks the queue one last
+  // time, and we pushed before looking at sleeping_, so at least one of us
+  // sees the other.
+  if (__atomic_load_n(&sleeping_, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&mutex_);
+    pthread_cond_signal(&condition_);
+    pthread_mutex_unlock(&mutex_);
+  }
+  return true;
+}
+
+size_t AsyncRingfile::DispatchCompletions() {
+  // Empty the pipe before the queue, so that a completion pushed after we
+  // look at the queue always leaves the pipe readable.
+  if (completion_fds_[0] != -1) {
+    char buffer[64];
+    while (read(completion_fds_[0], buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
+  size_t count = 0;
+  Operation * operation;
+  while (completions_.Pop(&operation)) {
+    --outstanding_;
+    ++count;
+    if (operation->type == Operation::kWrite) {
+      if (operation->write_callback) {
+        operation->write_callback(operation->context, operation->error);
+      }
+    } else {
+      if (operation->read_callback) {
+        operation->read_callback(operation->context, operation->error,
+          operation->data.data(), operation->data.size());
+      }
+    }
+    delete operation;
+  }
+  return count;
+}
+
+bool AsyncRingfile::Drain() {
+  while (outstanding_ > 0) {
+    if (DispatchCompletions() > 0) {
+      continue;
+    }
+    struct pollfd pfd;
+    pfd.fd = completion_fds_[0];
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+      error_ = errno;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AsyncRingfile::Close() {
+  if (thread_started_) {
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_signal(&condition_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(thread_, NULL);
+    thread_started_ = false;
+
+    // The I/O thread finishes everything that was submitted before it exits.
+    DispatchCompletions();
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (completion_fds_[i] != -1) {
+      close(completion_fds_[i]);
+      completion_fds_[i] = -1;
+    }
+  }
+  return ring_.Close();
+}
+
+void * AsyncRingfile::ThreadMain(void * context) {
+  static_cast<AsyncRingfile *>(context)->Run();
+  return NULL;
+}
+
+void AsyncRingfile::Run() {
+  while (true) {
+    bool worked = false;
+    Operation * operation;
+    while (submissions_.Pop(&operation)) {
+      Perform(operation);
+      completions_.Push(operation);
+      worked = true;
+    }
+    if (worked) {
+      // Best effort: if the pipe is full the caller has not dispatched yet
+      // and will see our completions anyway.
+      char byte = 0;
+      if (write(completion_fds_[1], &byte, 1) == -1) {
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&mutex_);
+    __atomic_store_n(&sleeping_, true, __ATOMIC_SEQ_CST);
+    while (submissions_.Empty() && !stopping_) {
+      pthread_cond_wait(&condition_, &mutex_);
+    }
+    __atomic_store_n(&sleeping_, false, __ATOMIC_SEQ_CST);
+    bool stop = stopping_ && submissions_.Empty();
+    pthread_mutex_unlock(&mutex_);
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void AsyncRingfile::Perform(Operation * operation) {
+  if (operation->type == Operation::kWrite) {
+    if (!ring_.Write(operation->data.data(), operation->data.size())) {
+      operation->error = ring_.error() ? ring_.error() : EIO;
+    }
+    operation->data.clear();
+    return;
+  }
+
+  size_t size;
+  if (!ring_.NextRecordSize(&size)) {
+    operation->error = ENODATA;
+    return;
+  }
+  operation->data.resize(size);
+  if (!ring_.Read(&operation->data[0], size)) {
+    operation->error = ring_.error() ? ring_.error() : EIO;
+    operation->data.clear();
+  }
+}
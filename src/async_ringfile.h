@@ -0,0 +1,200 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef ASYNC_RINGFILE_H_
+#define ASYNC_RINGFILE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "ringfile_internal.h"
+#include "spsc_queue.h"
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#include <coroutine>
+#define RINGFILE_HAVE_COROUTINES 1
+#endif
+
+// AsyncRingfile lets an event loop write to and read from a Ringfile without
+// blocking on disk. Operations are handed to a dedicated I/O thread through a
+// lock-free single producer, single consumer queue, and their results come
+// back through a second queue. Completion callbacks run on the caller's
+// thread, from inside DispatchCompletions(), never on the I/O thread.
+//
+// completion_fd() becomes readable whenever completions are waiting, so it
+// can be added to the loop's poll set:
+//
+//   AsyncRingfile ring;
+//   ring.Open(path, Ringfile::kAppend);
+//   ring.AsyncWrite(message, size, &OnWritten, context);
+//   ...
+//   // when ring.completion_fd() is readable:
+//   ring.DispatchCompletions();
+//
+// All methods must be called from the same thread.
+class AsyncRingfile {
+ public:
+  AsyncRingfile();
+  ~AsyncRingfile();
+
+  // `error` is zero on success and an errno value otherwise.
+  typedef void (*WriteCallback)(void * context, int error);
+
+  // On success `error` is zero and `data` and `size` describe the record,
+  // which is only valid until the callback returns. At the end of the ring
+  // `error` is ENODATA.
+  typedef void (*ReadCallback)(void * context, int error, const void * data,
+    size_t size);
+
+  // The most operations that can be outstanding at once.
+  static const size_t kQueueDepth = 1024;
+
+  // Create or open the ring on the calling thread and start the I/O thread.
+  bool Create(const std::string & path, size_t size);
+  bool Open(const std::string & path, Ringfile::Mode mode);
+
+  // Queue a write of a copy of `size` bytes at `ptr`. Fails with EAGAIN if
+  // kQueueDepth operations are already outstanding.
+  bool AsyncWrite(const void * ptr, size_t size, WriteCallback callback,
+    void * context);
+
+  // Queue a read of the next record.
+  bool AsyncRead(ReadCallback callback, void * context);
+
+  // Run the callbacks of every completed operation and return how many ran.
+  size_t DispatchCompletions();
+
+  // Wait for every outstanding operation and run its callback.
+  bool Drain();
+
+  // Finish every outstanding operation, stop the I/O thread and close the
+  // ring.
+  bool Close();
+
+  int completion_fd() const { return completion_fds_[0]; }
+  size_t outstanding() const { return outstanding_; }
+  int error() { return error_; }
+
+#ifdef RINGFILE_HAVE_COROUTINES
+  // Awaitables for C++20 coroutines. The coroutine is resumed from inside
+  // DispatchCompletions().
+  //
+  //   int error = co_await ring.AwaitWrite(message, size);
+  //   std::string record;
+  //   error = co_await ring.AwaitRead(&record);
+  class WriteAwaitable {
+   public:
+    WriteAwaitable(AsyncRingfile * ring, const void * ptr, size_t size)
+      : ring_(ring), ptr_(ptr), size_(size), error_(0) { }
+
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      handle_ = handle;
+      if (!ring_->AsyncWrite(ptr_, size_, &WriteAwaitable::Complete, this)) {
+        error_ = ring_->error();
+        return false;
+      }
+      return true;
+    }
+    int await_resume() const { return error_; }
+
+   private:
+    static void Complete(void * context, int error) {
+      WriteAwaitable * self = static_cast<WriteAwaitable *>(context);
+      self->error_ = error;
+      self->handle_.resume();
+    }
+
+    AsyncRingfile * ring_;
+    const void * ptr_;
+    size_t size_;
+    int error_;
+    std::coroutine_handle<> handle_;
+  };
+
+  class ReadAwaitable {
+   public:
+    ReadAwaitable(AsyncRingfile * ring, std::string * record)
+      : ring_(ring), record_(record), error_(0) { }
+
+    bool await_ready() const { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      handle_ = handle;
+      if (!ring_->AsyncRead(&ReadAwaitable::Complete, this)) {
+        error_ = ring_->error();
+        return false;
+      }
+      return true;
+    }
+    int await_resume() const { return error_; }
+
+   private:
+    static void Complete(void * context, int error, const void * data,
+        size_t size) {
+      ReadAwaitable * self = static_cast<ReadAwaitable *>(context);
+      self->error_ = error;
+      if (!error) {
+        self->record_->assign(static_cast<const char *>(data), size);
+      }
+      self->handle_.resume();
+    }
+
+    AsyncRingfile * ring_;
+    std::string * record_;
+    int error_;
+    std::coroutine_handle<> handle_;
+  };
+
+  WriteAwaitable AwaitWrite(const void * ptr, size_t size) {
+    return WriteAwaitable(this, ptr, size);
+  }
+  ReadAwaitable AwaitRead(std::string * record) {
+    return ReadAwaitable(this, record);
+  }
+#endif  // RINGFILE_HAVE_COROUTINES
+
+ private:
+  AsyncRingfile(const AsyncRingfile &);
+  void operator=(const AsyncRingfile &);
+
+  struct Operation {
+    enum Type { kWrite, kRead } type;
+    WriteCallback write_callback;
+    ReadCallback read_callback;
+    void * context;
+    // The record to write, or the record that was read.
+    std::string data;
+    int error;
+  };
+
+  bool Start();
+  bool Submit(Operation * operation);
+
+  static void * ThreadMain(void * context);
+  void Run();
+  void Perform(Operation * operation);
+
+  Ringfile ring_;
+  int error_;
+  int completion_fds_[2];
+  bool thread_started_;
+  pthread_t thread_;
+
+  // Operations travel from the caller to the I/O thread through submissions_
+  // and back through completions_. Both queues hold kQueueDepth entries and
+  // at most kQueueDepth operations are outstanding, so neither can overflow.
+  SpscQueue<Operation *> submissions_;
+  SpscQueue<Operation *> completions_;
+  size_t outstanding_;
+
+  // The I/O thread sleeps on condition_ when there is nothing to do. It sets
+  // sleeping_ first so that callers only take the mutex to wake it up.
+  pthread_mutex_t mutex_;
+  pthread_cond_t condition_;
+  bool sleeping_;
+  bool stopping_;
+};
+
+#endif  // ASYNC_RINGFILE_H_
@@ -0,0 +1,153 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "async_ringfile.h"
+#include "test_util.h"
+
+namespace {
+
+struct Results {
+  pthread_t thread;
+  std::vector<int> errors;
+  std::vector<std::string> records;
+};
+
+void OnWrite(void * context, int error) {
+  Results * results = static_cast<Results *>(context);
+  EXPECT_TRUE(pthread_equal(results->thread, pthread_self()));
+  results->errors.push_back(error);
+}
+
+void OnRead(void * context, int error, const void * data, size_t size) {
+  Results * results = static_cast<Results *>(context);
+  EXPECT_TRUE(pthread_equal(results->thread, pthread_self()));
+  results->errors.push_back(error);
+  if (!error) {
+    results->records.push_back(
+      std::string(static_cast<const char *>(data), size));
+  }
+}
+
+}  // anonymous namespace
+
+TEST(AsyncRingfileTest, CannotOpenBogusPath) {
+  AsyncRingfile ring;
+  ASSERT_FALSE(ring.Open(TempDir() + "/does not exist", Ringfile::kRead));
+  ASSERT_EQ(ENOENT, ring.error());
+  ASSERT_FALSE(ring.AsyncRead(&OnRead, NULL));
+  ASSERT_EQ(EBADF, ring.error());
+}
+
+TEST(AsyncRingfileTest, CanWriteAndReadAsynchronously) {
+  std::string path = TempDir() + "/ring";
+
+  Results results;
+  results.thread = pthread_self();
+  {
+    AsyncRingfile ring;
+    ASSERT_TRUE(ring.Create(path, 64 * 1024));
+    for (int i = 0; i < 100; ++i) {
+      char message[16];
+      snprintf(message, sizeof(message), "message %d", i);
+      ASSERT_TRUE(ring.AsyncWrite(message, strlen(message), &OnWrite,
+        &results));
+    }
+    ASSERT_TRUE(ring.Drain());
+    EXPECT_EQ(0U, ring.outstanding());
+    ASSERT_EQ(100U, results.errors.size());
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_EQ(0, results.errors[i]);
+    }
+    ASSERT_TRUE(ring.Close());
+  }
+
+  results.errors.clear();
+  {
+    AsyncRingfile ring;
+    ASSERT_TRUE(ring.Open(path, Ringfile::kRead));
+    for (int i = 0; i < 101; ++i) {
+      ASSERT_TRUE(ring.AsyncRead(&OnRead, &results));
+    }
+    ASSERT_TRUE(ring.Drain());
+  }
+
+  ASSERT_EQ(101U, results.errors.size());
+  ASSERT_EQ(100U, results.records.size());
+  for (int i = 0; i < 100; ++i) {
+    char message[16];
+    snprintf(message, sizeof(message), "message %d", i);
+    EXPECT_EQ(message, results.records[i]);
+  }
+  EXPECT_EQ(ENODATA, results.errors[100]);
+}
+
+TEST(AsyncRingfileTest, CloseRunsOutstandingCallbacks) {
+  std::string path = TempDir() + "/ring";
+
+  Results results;
+  results.thread = pthread_self();
+  AsyncRingfile ring;
+  ASSERT_TRUE(ring.Create(path, 1024));
+  ASSERT_TRUE(ring.AsyncWrite("hello", 5, &OnWrite, &results));
+  ASSERT_TRUE(ring.Close());
+  ASSERT_EQ(1U, results.errors.size());
+  EXPECT_EQ(0, results.errors[0]);
+  EXPECT_EQ(0U, ring.outstanding());
+}
+
+#ifdef RINGFILE_HAVE_COROUTINES
+namespace {
+
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return Task(); }
+    std::suspend_never initial_suspend() { return std::suspend_never(); }
+    std::suspend_never final_suspend() noexcept {
+      return std::suspend_never();
+    }
+    void return_void() { }
+    void unhandled_exception() { }
+  };
+};
+
+Task WriteThenRead(AsyncRingfile * ring, std::vector<std::string> * records) {
+  int error = co_await ring->AwaitWrite("alpha", 5);
+  EXPECT_EQ(0, error);
+  error = co_await ring->AwaitWrite("beta", 4);
+  EXPECT_EQ(0, error);
+
+  std::string record;
+  while (true) {
+    error = co_await ring->AwaitRead(&record);
+    if (error) {
+      break;
+    }
+    records->push_back(record);
+  }
+  EXPECT_EQ(ENODATA, error);
+}
+
+}  // anonymous namespace
+
+TEST(AsyncRingfileTest, CanAwaitWritesAndReads) {
+  std::string path = TempDir() + "/ring";
+  AsyncRingfile ring;
+  ASSERT_TRUE(ring.Create(path, 1024));
+
+  std::vector<std::string> records;
+  WriteThenRead(&ring, &records);
+  ASSERT_TRUE(ring.Drain());
+
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("alpha", records[0]);
+  EXPECT_EQ("beta", records[1]);
+}
+#endif  // RINGFILE_HAVE_COROUTINES
@@ -0,0 +1,95 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "cli_util.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool ParseSize(const char * str, long * size) {
+  errno = 0;
+  char * units;
+  *size = strtol(str, &units, 10);
+  if (errno != 0 || *size <= 0) {
+    return false;
+  }
+
+  if (*units == 0 || strcmp(units, "b") == 0 || strcmp(units, "B") == 0) {
+    // size in bytes, nop
+  } else if (strcmp(units, "k") == 0 || strcmp(units, "K") == 0) {
+    *size *= 1024;  // size in kbytes
+  } else if (strcmp(units, "m") == 0 || strcmp(units, "M") == 0) {
+    *size *= 1024 * 1024;  // size in mb
+  } else if (strcmp(units, "g") == 0 || strcmp(units, "G") == 0) {
+    *size *= 1024 * 1024 * 1024;  // size in gb
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int BindDatagramSocket(const std::string & address) {
+  if (address.compare(0, 4, "udp:") == 0) {
+    errno = 0;
+    char * end;
+    long port = strtol(address.c_str() + 4, &end, 10);
+    if (errno != 0 || *end != 0 || port <= 0 || port > 65535) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+      return -1;
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+        sizeof(addr)) == -1) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+    return fd;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (address.empty() || address.size() >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(addr.sun_path, address.c_str(), address.size());
+
+  // A socket left behind by an earlier run would make bind() fail, but
+  // don't remove anything that isn't a socket.
+  struct stat stat_buffer;
+  if (stat(address.c_str(), &stat_buffer) == 0 &&
+      S_ISSOCK(stat_buffer.st_mode)) {
+    unlink(address.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+      sizeof(addr)) == -1) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,20 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef CLI_UTIL_H_
+#define CLI_UTIL_H_
+
+#include <string>
+
+// Helpers shared by the modes of the ringfile command.
+
+// Parse a size argument such as "400m" into bytes. Returns false if `str` is
+// not a positive number with an optional b, k, m or g suffix.
+bool ParseSize(const char * str, long * size);
+
+// Bind a datagram socket to `address`, either the path of a unix socket or
+// udp:PORT for a port on the loopback interface. Returns -1 with errno set
+// on failure.
+int BindDatagramSocket(const std::string & address);
+
+#endif  // CLI_UTIL_H_
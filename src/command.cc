@@ -8,8 +8,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <fstream>
+#include <vector>
+
+#include "cli_util.h"
+#include "daemon.h"
+#include "flood_filter.h"
+#include "ring_set.h"
 #include "ringfile_internal.h"
+#include "segmented_ringfile.h"
 
 Command::Command()
   : stdin(&std::cin),
@@ -17,9 +31,207 @@ Command::Command()
     stderr(&std::cerr),
     mode(kModeUnspecified),
     verbose(0),
-    size(-1) {
+    size(-1),
+    segment_size(-1),
+    new_size(-1),
+    cursor_count(-1),
+    queue(false),
+    prealloc(false),
+    lock(false),
+    collapse(false),
+    rate(0),
+    burst(0),
+    listen_fd(-1) {
+}
+
+namespace {
+
+// Copy every record in `ring` to `out`, one record per line. `ring` is any of
+// the ring types that provide NextRecordSize() and Read().
+template<class Ring>
+bool CopyRecords(Ring * ring, const std::string & path, std::ostream * out,
+    std::ostream * err) {
+  std::string record;
+  while (true) {
+    size_t size;
+    if (!ring->NextRecordSize(&size)) {
+      break;
+    }
+
+    record.resize(size);
+    if (!ring->Read(const_cast<char *>(record.c_str()), record.size())) {
+      *err << path << ": " << strerror(ring->error()) << "\n";
+      return false;
+    }
+    *out << record << std::endl;
+  }
+  return true;
+}
+
+template<class Ring>
+void PrintStat(Ring * ring, const std::string & path, std::ostream * out) {
+  *out << "File: " << path << "\n";
+  *out << "Size: " << ring->bytes_max() << " bytes\n";
+  *out << "Used: " << ring->bytes_used() << " bytes\n";
+  *out << "Free: " << ring->bytes_available() << " bytes\n";
+}
+
+double MonotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+template<class Ring>
+bool WriteRecords(Ring * ring, const std::string & path,
+    const std::vector<std::string> & records, std::ostream * err) {
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (!ring->Write(records[i].c_str(), records[i].size())) {
+      *err << path << ": writing: " << strerror(ring->error()) << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Append each line read from `in` to `ring` as a record, passing them
+// through `filter` first unless it is NULL.
+template<class Ring>
+bool AppendLines(Ring * ring, const std::string & path, std::istream * in,
+    FloodFilter * filter, std::ostream * err) {
+  std::string line;
+  std::vector<std::string> records;
+  while (std::getline(*in, line)) {
+    if (!filter) {
+      if (!ring->Write(line.c_str(), line.size())) {
+        *err << path << ": writing: " << strerror(ring->error()) << "\n";
+        return false;
+      }
+      continue;
+    }
+
+    records.clear();
+    filter->Filter(line, filter->rate_limited() ? MonotonicSeconds() : 0,
+      &records);
+    if (!WriteRecords(ring, path, records, err)) {
+      return false;
+    }
+  }
+
+  if (filter) {
+    records.clear();
+    filter->Finish(&records);
+    return WriteRecords(ring, path, records, err);
+  }
+  return true;
 }
 
+// How many datagrams --listen takes from the socket per system call, and the
+// largest one it keeps.
+const unsigned int kDatagramBatch = 64;
+const size_t kMaxDatagramSize = 64 * 1024;
+
+// Append each datagram received on `fd` to `ring` as a record, with one
+// WriteBatch() for everything a single receive returns. Datagrams too large
+// to keep whole are dropped and counted in `truncated`. Returns true once
+// the socket has been shut down.
+bool AppendDatagrams(Ringfile * ring, const std::string & path, int fd,
+    uint64_t * truncated, std::ostream * err) {
+  std::vector<char> buffer(kDatagramBatch * kMaxDatagramSize);
+  struct iovec buffers[kDatagramBatch];
+  struct iovec records[kDatagramBatch];
+  for (unsigned int i = 0; i < kDatagramBatch; ++i) {
+    buffers[i].iov_base = &buffer[i * kMaxDatagramSize];
+    buffers[i].iov_len = kMaxDatagramSize;
+  }
+
+  while (true) {
+    size_t count = 0;
+    bool shut_down = false;
+#ifdef __linux__
+    struct mmsghdr messages[kDatagramBatch];
+    memset(messages, 0, sizeof(messages));
+    for (unsigned int i = 0; i < kDatagramBatch; ++i) {
+      messages[i].msg_hdr.msg_iov = &buffers[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Block for the first datagram, then take whatever else is queued.
+    int received = recvmmsg(fd, messages, kDatagramBatch, MSG_WAITFORONE,
+      NULL);
+    if (received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *err << path << ": receiving: " << strerror(errno) << "\n";
+      return false;
+    }
+    for (int i = 0; i < received; ++i) {
+      // Empty datagrams have nothing worth keeping. Once the socket has
+      // been shut down an empty read is also how it reports the end, so
+      // stop at the first one.
+      if (messages[i].msg_len == 0) {
+        struct pollfd poll_fd;
+        poll_fd.fd = fd;
+        poll_fd.events = POLLRDHUP;
+        poll_fd.revents = 0;
+        if (poll(&poll_fd, 1, 0) == 1 && (poll_fd.revents & POLLRDHUP)) {
+          shut_down = true;
+          break;
+        }
+        continue;
+      }
+      if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        ++*truncated;
+        continue;
+      }
+      records[count].iov_base = buffers[i].iov_base;
+      records[count].iov_len = messages[i].msg_len;
+      ++count;
+    }
+#else
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &buffers[0];
+    message.msg_iovlen = 1;
+    ssize_t received = recvmsg(fd, &message, 0);
+    if (received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *err << path << ": receiving: " << strerror(errno) << "\n";
+      return false;
+    }
+    shut_down = received == 0;
+    if (message.msg_flags & MSG_TRUNC) {
+      ++*truncated;
+    } else if (received > 0) {
+      records[0].iov_base = buffers[0].iov_base;
+      records[0].iov_len = received;
+      count = 1;
+    }
+#endif
+
+    if (count && !ring->WriteBatch(records, count)) {
+      *err << path << ": writing: " << strerror(ring->error()) << "\n";
+      return false;
+    }
+    if (shut_down) {
+      return true;
+    }
+  }
+}
+
+// The daemon that SIGINT and SIGTERM stop.
+Daemon * running_daemon = NULL;
+
+void StopDaemon(int) {
+  if (running_daemon) {
+    running_daemon->Stop();
+  }
+}
+
+}  // anonymous namespace
+
 bool Command::Parse(int argc, char ** argv) {
   optind = 1;  // reset global state
   int option_index = 0;
@@ -32,6 +244,18 @@ bool Command::Parse(int argc, char ** argv) {
       {"size", required_argument, 0, 's'},
       {"stat", no_argument, 0, 'S'},
       {"append", no_argument, 0, 'a'},
+      {"segment-size", required_argument, 0, kOptionSegmentSize},
+      {"resize", required_argument, 0, kOptionResize},
+      {"cursor", required_argument, 0, kOptionCursor},
+      {"cursors", required_argument, 0, kOptionCursors},
+      {"queue", no_argument, 0, kOptionQueue},
+      {"prealloc", no_argument, 0, kOptionPrealloc},
+      {"lock", no_argument, 0, kOptionLock},
+      {"listen", required_argument, 0, kOptionListen},
+      {"daemon", required_argument, 0, kOptionDaemon},
+      {"collapse", no_argument, 0, kOptionCollapse},
+      {"rate", required_argument, 0, kOptionRate},
+      {"burst", required_argument, 0, kOptionBurst},
       {0, 0, 0, 0}
     };
 
@@ -51,7 +275,21 @@ bool Command::Parse(int argc, char ** argv) {
       continue;
     }
 
-    if (option == kModeStat || option == kModeRead || option == kModeAppend) {
+    if (option == kOptionResize) {
+      if (!ParseSize(optarg, &new_size)) {
+        *stderr << program << ": invalid size\n";
+        return false;
+      }
+      option = kModeResize;
+    }
+
+    if (option == kOptionDaemon) {
+      config = optarg;
+      option = kModeDaemon;
+    }
+
+    if (option == kModeStat || option == kModeRead || option == kModeAppend ||
+        option == kModeResize || option == kModeDaemon) {
       if (mode != kModeUnspecified) {
         *stderr << program << ": cannot specify more than one mode "
           "option\n";
@@ -62,37 +300,111 @@ bool Command::Parse(int argc, char ** argv) {
     }
 
     if (option == 's') {
-      errno = 0;
-      char * units;
-      size = strtol(optarg, &units, 10);
-      if (errno != 0 || size <= 0) {
+      if (!ParseSize(optarg, &size)) {
         *stderr << program << ": invalid size\n";
         return false;
       }
+      continue;
+    }
 
-      if (*units == 0 || strcmp(units, "b") == 0 || strcmp(units, "B") == 0) {
-        // size in bytes, nop
-      } else if (strcmp(units, "k") == 0 || strcmp(units, "K") == 0) {
-        size *= 1024;  // size in kbytes
-      } else if (strcmp(units, "m") == 0 || strcmp(units, "M") == 0) {
-        size *= 1024 * 1024;  // size in mb
-      } else if (strcmp(units, "g") == 0 || strcmp(units, "G") == 0) {
-        size *= 1024 * 1024 * 1024;  // size in gb
-      } else {
-        *stderr << program << ": invalid size\n";
+    if (option == kOptionSegmentSize) {
+      if (!ParseSize(optarg, &segment_size)) {
+        *stderr << program << ": invalid segment size\n";
         return false;
       }
       continue;
     }
 
+    if (option == kOptionCursor) {
+      cursor = optarg;
+      continue;
+    }
+
+    if (option == kOptionCursors) {
+      errno = 0;
+      char * end;
+      cursor_count = strtol(optarg, &end, 10);
+      if (errno != 0 || *end != 0 || cursor_count <= 0) {
+        *stderr << program << ": invalid cursor count\n";
+        return false;
+      }
+      continue;
+    }
+
+    if (option == kOptionQueue) {
+      queue = true;
+      continue;
+    }
+
+    if (option == kOptionPrealloc) {
+      prealloc = true;
+      continue;
+    }
+
+    if (option == kOptionLock) {
+      lock = true;
+      continue;
+    }
+
+    if (option == kOptionListen) {
+      listen = optarg;
+      continue;
+    }
+
+    if (option == kOptionCollapse) {
+      collapse = true;
+      continue;
+    }
+
+    if (option == kOptionRate || option == kOptionBurst) {
+      errno = 0;
+      char * end;
+      double value = strtod(optarg, &end);
+      if (errno != 0 || *end != 0 || !(value > 0)) {
+        *stderr << program << ": invalid "
+          << (option == kOptionRate ? "rate" : "burst") << "\n";
+        return false;
+      }
+      if (option == kOptionRate) {
+        rate = value;
+      } else {
+        burst = value;
+      }
+      continue;
+    }
+
     *stderr << program << ": invalid option\n";
     return false;
   }
 
+  // Listening only makes sense when appending, and each datagram is a
+  // record rather than a line to filter.
+  if (!listen.empty()) {
+    if (mode != kModeUnspecified && mode != kModeAppend) {
+      *stderr << program << ": --listen can only be used with --append\n";
+      return false;
+    }
+    if (collapse || rate > 0) {
+      *stderr << program
+        << ": --collapse and --rate cannot be used with --listen\n";
+      return false;
+    }
+    mode = kModeAppend;
+  }
+
   if (mode == kModeUnspecified) {
     mode = kModeRead;
   }
 
+  // The daemon takes its rings from the configuration.
+  if (mode == kModeDaemon) {
+    if (optind < argc) {
+      *stderr << program << ": too many file arguments\n";
+      return false;
+    }
+    return true;
+  }
+
   // get the file path
   if (optind + 1 > argc) {
     *stderr << program << ": missing file argument\n";
@@ -107,30 +419,95 @@ bool Command::Parse(int argc, char ** argv) {
 }
 
 bool Command::Read() {
+  if (!cursor.empty() && (RingSet::IsRingSet(path) ||
+      SegmentedRingfile::IsSegmentedRingfile(path))) {
+    *stderr << path << ": cursors are only supported by single rings\n";
+    return false;
+  }
+
+  if (RingSet::IsRingSet(path)) {
+    RingSet ring_set;
+    if (!ring_set.Open(path, Ringfile::kRead)) {
+      *stderr << path << ": " << strerror(ring_set.error()) << "\n";
+      return false;
+    }
+    return CopyRecords(&ring_set, path, stdout, stderr);
+  }
+
+  if (SegmentedRingfile::IsSegmentedRingfile(path)) {
+    SegmentedRingfile ring_file;
+    if (!ring_file.Open(path, Ringfile::kRead)) {
+      *stderr << path << ": " << strerror(ring_file.error()) << "\n";
+      return false;
+    }
+    return CopyRecords(&ring_file, path, stdout, stderr);
+  }
+
   Ringfile ring_file;
   if (!ring_file.Open(path, Ringfile::kRead)) {
     *stderr << path << ": " << strerror(ring_file.error()) << "\n";
     return false;
   }
+  if (cursor.empty()) {
+    return CopyRecords(&ring_file, path, stdout, stderr);
+  }
 
-  while (true) {
-    size_t size;
-    if (!ring_file.NextRecordSize(&size)) {
-      break;
+  // Resume from the cursor, and move it past everything we printed.
+  if (!ring_file.OpenCursor(cursor)) {
+    *stderr << path << ": cannot open cursor " << cursor << ": "
+      << strerror(ring_file.error()) << "\n";
+    return false;
+  }
+  if (ring_file.bytes_lost()) {
+    *stderr << path << ": cursor " << cursor << ": "
+      << ring_file.bytes_lost() << " bytes of records were lost\n";
+  }
+  if (!CopyRecords(&ring_file, path, stdout, stderr)) {
+    return false;
+  }
+  if (!ring_file.Ack()) {
+    *stderr << path << ": cannot update cursor " << cursor << ": "
+      << strerror(ring_file.error()) << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool Command::WriteSegmented() {
+  SegmentedRingfile ring_file;
+
+  if (!ring_file.Open(path, Ringfile::kAppend)) {
+    if (ring_file.error() != ENOENT) {
+      *stderr << path << ": cannot open: " << strerror(ring_file.error())
+        << "\n";
+      return false;
+    }
+    if (size == -1) {
+      *stderr << path << ": does not exist and --size was not specified\n";
+      return false;
     }
 
-    std::string record;
-    record.resize(size);
-    if (!ring_file.Read(const_cast<char *>(record.c_str()), record.size())) {
-      *stderr << path << ": " << strerror(ring_file.error()) << "\n";
+    size_t segment_bytes = segment_size == -1 ? 0 : segment_size;
+    if (!ring_file.Create(path, size, segment_bytes)) {
+      *stderr << path << ": cannot create: " << strerror(ring_file.error())
+        << "\n";
       return false;
     }
-    *stdout << record << std::endl;
   }
-  return true;
+  FloodFilter filter(collapse, rate, burst);
+  return AppendLines(&ring_file, path, stdin,
+    collapse || rate > 0 ? &filter : NULL, stderr);
 }
 
 bool Command::Write() {
+  if (SegmentedRingfile::IsSegmentedRingfile(path) || segment_size != -1) {
+    if (!listen.empty()) {
+      *stderr << path << ": --listen is only supported by single rings\n";
+      return false;
+    }
+    return WriteSegmented();
+  }
+
   Ringfile ring_file;
 
   if (!ring_file.Open(path, Ringfile::kAppend)) {
@@ -144,39 +521,151 @@ bool Command::Write() {
       return false;
     }
 
-    if (!ring_file.Create(path, size)) {
+    Ringfile::Options options;
+    if (cursor_count != -1) {
+      options.cursor_count = cursor_count;
+    }
+    options.queue = queue;
+    options.prealloc = prealloc;
+    if (!ring_file.Create(path, size, options)) {
       *stderr << path << ": cannot create: " << strerror(ring_file.error())
         << "\n";
       return false;
     }
   }
 
-  // Treat each line as a record
-  std::string line;
-  while (std::getline(*stdin, line)) {
-    if (!ring_file.Write(line.c_str(), line.size())) {
-      *stderr << path << ": writing: " << strerror(ring_file.error()) << "\n";
-      return false;
+  // Take every page fault now rather than on the first lap.
+  if ((prealloc || lock) && !ring_file.Prefault(lock)) {
+    *stderr << path << ": cannot " << (lock ? "lock" : "prefault") << ": "
+      << strerror(ring_file.error()) << "\n";
+    return false;
+  }
+
+  if (!listen.empty()) {
+    int fd = listen_fd;
+    if (fd == -1) {
+      fd = BindDatagramSocket(listen);
+      if (fd == -1) {
+        *stderr << listen << ": cannot listen: " << strerror(errno) << "\n";
+        return false;
+      }
     }
+    uint64_t truncated = 0;
+    bool ok = AppendDatagrams(&ring_file, path, fd, &truncated, stderr);
+    if (fd != listen_fd) {
+      close(fd);
+      if (listen.compare(0, 4, "udp:") != 0) {
+        unlink(listen.c_str());
+      }
+    }
+    if (truncated) {
+      *stderr << path << ": dropped " << truncated
+        << " datagrams larger than " << kMaxDatagramSize << " bytes\n";
+    }
+    return ok;
   }
 
+  // Treat each line as a record
+  FloodFilter filter(collapse, rate, burst);
+  if (!AppendLines(&ring_file, path, stdin,
+      collapse || rate > 0 ? &filter : NULL, stderr)) {
+    return false;
+  }
+  if (verbose && (filter.repeated_count() || filter.dropped_count())) {
+    *stderr << path << ": collapsed " << filter.repeated_count()
+      << " repeated lines and dropped " << filter.dropped_count()
+      << " over the rate limit\n";
+  }
   return true;
 }
 
 bool Command::Stat() {
+  if (RingSet::IsRingSet(path)) {
+    RingSet ring_set;
+    if (!ring_set.Open(path, Ringfile::kRead)) {
+      *stderr << path << ": " << strerror(ring_set.error()) << "\n";
+      return false;
+    }
+    PrintStat(&ring_set, path, stdout);
+    *stdout << "Shards: " << ring_set.shard_count() << "\n";
+    return true;
+  }
+
+  if (SegmentedRingfile::IsSegmentedRingfile(path)) {
+    SegmentedRingfile ring_file;
+    if (!ring_file.Open(path, Ringfile::kRead)) {
+      *stderr << path << ": " << strerror(ring_file.error()) << "\n";
+      return false;
+    }
+    PrintStat(&ring_file, path, stdout);
+    *stdout << "Segments: " << ring_file.segment_count() << " x "
+      << ring_file.segment_size() << " bytes\n";
+    return true;
+  }
+
   Ringfile ring_file;
   if (!ring_file.Open(path, Ringfile::kRead)) {
     *stderr << path << ": " << strerror(ring_file.error()) << "\n";
     return false;
   }
+  PrintStat(&ring_file, path, stdout);
+  return true;
+}
 
-  *stdout << "File: " << path << "\n";
-  *stdout << "Size: " << ring_file.bytes_max() << " bytes\n";
-  *stdout << "Used: " << ring_file.bytes_used() << " bytes\n";
-  *stdout << "Free: " << ring_file.bytes_available() << " bytes\n";
+bool Command::Resize() {
+  Ringfile ring_file;
+  if (!ring_file.Open(path, Ringfile::kAppend)) {
+    *stderr << path << ": cannot open: " << strerror(ring_file.error())
+      << "\n";
+    return false;
+  }
+  if (!ring_file.Resize(new_size)) {
+    if (ring_file.error() == EWOULDBLOCK) {
+      *stderr << path << ": cannot resize while another process is "
+        "appending\n";
+    } else {
+      *stderr << path << ": cannot resize: " << strerror(ring_file.error())
+        << "\n";
+    }
+    return false;
+  }
   return true;
 }
 
+bool Command::RunDaemon() {
+  std::ifstream config_stream(config.c_str());
+  if (!config_stream) {
+    *stderr << config << ": cannot open: " << strerror(errno) << "\n";
+    return false;
+  }
+
+  Daemon daemon;
+  if (!daemon.Load(&config_stream)) {
+    *stderr << config << ": " << daemon.error_message() << "\n";
+    return false;
+  }
+
+  running_daemon = &daemon;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &StopDaemon;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  bool ok = daemon.Run();
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  running_daemon = NULL;
+
+  if (!ok) {
+    *stderr << config << ": " << daemon.error_message() << "\n";
+  }
+  if (daemon.dropped_count()) {
+    *stderr << config << ": " << daemon.dropped_count()
+      << " records could not be appended\n";
+  }
+  return ok;
+}
+
 int Command::Main(int argc, char ** argv) {
   if (!Parse(argc, argv)) {
     return 1;
@@ -193,6 +682,12 @@ int Command::Main(int argc, char ** argv) {
     case kModeStat:
       ok = Stat();
       break;
+    case kModeResize:
+      ok = Resize();
+      break;
+    case kModeDaemon:
+      ok = RunDaemon();
+      break;
   }
   return ok ? 0 : 1;
 }
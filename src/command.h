@@ -14,7 +14,25 @@ class Command {
     kModeUnspecified = 0,
     kModeRead='r',
     kModeStat='S',
-    kModeAppend='a'
+    kModeAppend='a',
+    kModeResize='R',
+    kModeDaemon='D'
+  };
+
+  // Values for long options that have no short form.
+  enum {
+    kOptionSegmentSize = 256,
+    kOptionResize,
+    kOptionCursor,
+    kOptionCursors,
+    kOptionQueue,
+    kOptionPrealloc,
+    kOptionLock,
+    kOptionListen,
+    kOptionDaemon,
+    kOptionCollapse,
+    kOptionRate,
+    kOptionBurst
   };
 
   Command();
@@ -23,7 +41,10 @@ class Command {
   bool Parse(int argc, char ** argv);
   bool Read();
   bool Write();
+  bool WriteSegmented();
   bool Stat();
+  bool Resize();
+  bool RunDaemon();
 
   std::istream * stdin;
   std::ostream * stdout;
@@ -31,8 +52,31 @@ class Command {
   int mode;
   int verbose;
   long size;
+  long segment_size;
+  long new_size;
+  long cursor_count;
+  bool queue;
+  bool prealloc;
+  bool lock;
+  std::string cursor;
   std::string path;
   std::string program;
+
+  // Flood control for lines appended from stdin: collapse repeated lines,
+  // and admit at most `rate` lines per second in bursts of up to `burst`.
+  bool collapse;
+  double rate;
+  double burst;
+
+  // With --listen, append each datagram received on this socket as a
+  // record rather than reading lines from stdin. When -1 it is bound to the
+  // `listen` address: a unix socket path, or udp:PORT on the loopback
+  // interface.
+  std::string listen;
+  int listen_fd;
+
+  // With --daemon, the configuration of the inputs and rings to serve.
+  std::string config;
 };
 
 
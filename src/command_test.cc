@@ -4,9 +4,17 @@
 #include "command.h"
 
 #include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <fstream>
 #include <sstream>
+#include <string>
+#include <vector>
 
+#include "ring_set.h"
+#include "ringfile_internal.h"
 #include "test_util.h"
 
 template<class Type, ptrdiff_t n>
@@ -207,3 +215,317 @@ TEST(CommandTest, CanAppendReadAndWrite) {
     EXPECT_EQ("Goodbye, World!\n", stdout.str());
   }
 }
+
+TEST(CommandTest, CanReadRingSet) {
+  std::string path = TempDir() + "/set";
+
+  {
+    RingSet ring_set;
+    ASSERT_TRUE(ring_set.Create(path, 2, 1024));
+    ASSERT_TRUE(ring_set.Write(1, "Hello, World!", 13));
+    ASSERT_TRUE(ring_set.Write(0, "Goodbye, World!", 15));
+  }
+
+  {
+    char * argv[] = {"frob", NULL};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("Hello, World!\nGoodbye, World!\n", stdout.str());
+  }
+}
+
+TEST(CommandTest, CanAppendAndReadSegmented) {
+  std::string path = TempDir() + "/ring";
+
+  {
+    char * argv[] = {"frob", NULL, "--append", "--size", "4k",
+      "--segment-size", "1k"};
+    argv[1] = const_cast<char *>(path.c_str());
+
+    std::stringstream stdin;
+    stdin.str("Hello, World!\nGoodbye, World!\n");
+
+    Command command;
+    command.stdin = &stdin;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+  }
+
+  {
+    char * argv[] = {"frob", NULL};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("Hello, World!\nGoodbye, World!\n", stdout.str());
+  }
+}
+
+TEST(CommandTest, CanResize) {
+  std::string path = TempDir() + "/ring";
+
+  {
+    char * argv[] = {"frob", NULL, "--append", "--size", "50"};
+    argv[1] = const_cast<char *>(path.c_str());
+
+    std::stringstream stdin;
+    stdin.str("Hello, World!");
+
+    Command command;
+    command.stdin = &stdin;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+  }
+
+  {
+    char * argv[] = {"frob", NULL, "--resize", "1k"};
+    argv[1] = const_cast<char *>(path.c_str());
+
+    Command command;
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ(Command::kModeResize, command.mode);
+    EXPECT_EQ(1024, command.new_size);
+  }
+
+  {
+    char * argv[] = {"frob", NULL, "--stat"};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+
+    std::string expected_output = "File: ";
+    expected_output += path;
+    expected_output += "\nSize: 1000 bytes\nUsed: 14 bytes\n"
+      "Free: 986 bytes\n";
+    EXPECT_EQ(expected_output, stdout.str());
+  }
+}
+
+TEST(CommandTest, CanReadFromCursor) {
+  std::string path = TempDir() + "/ring";
+
+  {
+    char * argv[] = {"frob", NULL, "--append", "--size", "1k",
+      "--cursors", "4"};
+    argv[1] = const_cast<char *>(path.c_str());
+
+    std::stringstream stdin;
+    stdin.str("Hello, World!\n");
+
+    Command command;
+    command.stdin = &stdin;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ(4, command.cursor_count);
+  }
+
+  {
+    char * argv[] = {"frob", NULL, "--cursor=shipper"};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("Hello, World!\n", stdout.str());
+  }
+
+  {
+    char * argv[] = {"frob", NULL, "--append"};
+    argv[1] = const_cast<char *>(path.c_str());
+
+    std::stringstream stdin;
+    stdin.str("Goodbye, World!\n");
+
+    Command command;
+    command.stdin = &stdin;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+  }
+
+  {
+    char * argv[] = {"frob", NULL, "--cursor=shipper"};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("Goodbye, World!\n", stdout.str());
+  }
+}
+
+TEST(CommandTest, CanPreallocate) {
+  std::string path = TempDir() + "/ring";
+  char * argv[] = {"frob", NULL, "--append", "--size", "64k", "--prealloc"};
+  argv[1] = const_cast<char *>(path.c_str());
+
+  std::stringstream stdin;
+  stdin.str("Hello, World!\n");
+
+  Command command;
+  command.stdin = &stdin;
+
+  EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+  EXPECT_TRUE(command.prealloc);
+  EXPECT_FALSE(command.lock);
+
+  struct stat stat_buffer;
+  ASSERT_EQ(0, stat(path.c_str(), &stat_buffer));
+  EXPECT_LE(64 * 1024, stat_buffer.st_blocks * 512);
+}
+
+TEST(CommandTest, CanAppendDatagrams) {
+  std::string path = TempDir() + "/ring";
+  char * argv[] = {"frob", NULL, "--size", "64k", "--listen", "unused"};
+  argv[1] = const_cast<char *>(path.c_str());
+
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+  const char * messages[] = {"first", "multi\nline", "last"};
+  for (int i = 0; i < arraysize(messages); ++i) {
+    ASSERT_EQ(static_cast<ssize_t>(strlen(messages[i])),
+      send(fds[1], messages[i], strlen(messages[i]), 0));
+    if (i == 0) {
+      // Too large to keep whole, so it is left out rather than cut short.
+      std::string large(70000, 'x');
+      ASSERT_EQ(static_cast<ssize_t>(large.size()),
+        send(fds[1], large.data(), large.size(), 0));
+    }
+  }
+  // Once the queued datagrams are appended the command sees the end.
+  ASSERT_EQ(0, shutdown(fds[0], SHUT_RD));
+
+  {
+    std::stringstream stderr;
+    Command command;
+    command.stderr = &stderr;
+    command.listen_fd = fds[0];
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ(Command::kModeAppend, command.mode);
+    EXPECT_EQ("unused", command.listen);
+    EXPECT_EQ(path + ": dropped 1 datagrams larger than 65536 bytes\n",
+      stderr.str());
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  Ringfile ring;
+  ASSERT_TRUE(ring.Open(path, Ringfile::kRead));
+  std::vector<std::string> records;
+  size_t size;
+  while (ring.NextRecordSize(&size)) {
+    std::string record(size, 0);
+    ASSERT_TRUE(ring.Read(const_cast<char *>(record.data()), size));
+    records.push_back(record);
+  }
+  ASSERT_EQ(3U, records.size());
+  EXPECT_EQ("first", records[0]);
+  EXPECT_EQ("multi\nline", records[1]);
+  EXPECT_EQ("last", records[2]);
+}
+
+TEST(CommandTest, ListenRequiresAppendMode) {
+  char * argv[] = {"frob", "--stat", "--listen", "/tmp/sock", "some_path"};
+  std::stringstream stderr;
+
+  Command command;
+  command.stderr = &stderr;
+
+  EXPECT_EQ(false, command.Parse(arraysize(argv), argv));
+  EXPECT_EQ("frob: --listen can only be used with --append\n", stderr.str());
+}
+
+TEST(CommandTest, ListenDoesNotFilter) {
+  char * argv[] = {"frob", "--listen", "/tmp/sock", "--rate", "10",
+    "some_path"};
+  std::stringstream stderr;
+
+  Command command;
+  command.stderr = &stderr;
+
+  EXPECT_EQ(false, command.Parse(arraysize(argv), argv));
+  EXPECT_EQ("frob: --collapse and --rate cannot be used with --listen\n",
+    stderr.str());
+}
+
+TEST(CommandTest, CanCollapseRepeatedLines) {
+  std::string path = TempDir() + "/ring";
+  char * argv[] = {"frob", NULL, "--append", "--size", "64k", "--collapse"};
+  argv[1] = const_cast<char *>(path.c_str());
+
+  {
+    std::stringstream stdin;
+    stdin.str("start\nerror\nerror\nerror\nend\n");
+
+    Command command;
+    command.stdin = &stdin;
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+  }
+
+  {
+    char * argv[] = {"frob", NULL};
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("start\nerror\nlast message repeated 2 times\nend\n",
+      stdout.str());
+  }
+}
+
+TEST(CommandTest, CanRunDaemon) {
+  std::string dir = TempDir();
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ(3, write(fds[1], "a\nb", 3));
+  close(fds[1]);
+
+  // The daemon returns once its only input, the pipe, reaches its end.
+  std::string config = dir + "/config";
+  {
+    std::ofstream config_stream(config.c_str());
+    config_stream << "fd " << fds[0] << " " << dir << "/ring 64k\n";
+  }
+
+  {
+    char * argv[] = {"frob", NULL};
+    std::string daemon_argument = "--daemon=" + config;
+    argv[1] = const_cast<char *>(daemon_argument.c_str());
+    std::stringstream stderr;
+
+    Command command;
+    command.stderr = &stderr;
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ(Command::kModeDaemon, command.mode);
+    EXPECT_EQ("", stderr.str());
+  }
+
+  {
+    char * argv[] = {"frob", NULL};
+    std::string path = dir + "/ring";
+    argv[1] = const_cast<char *>(path.c_str());
+    std::stringstream stdout;
+
+    Command command;
+    command.stdout = &stdout;
+    EXPECT_EQ(0, command.Main(arraysize(argv), argv));
+    EXPECT_EQ("a\nb\n", stdout.str());
+  }
+}
@@ -0,0 +1,14 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Extend the CRC-32 (as used by zlib and ethernet) `crc` of some data with
+// `size` more bytes. The CRC of no data is 0.
+uint32_t Crc32(uint32_t crc, const void * data, size_t size);
+
+#endif  // CRC32_H_
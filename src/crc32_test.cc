@@ -0,0 +1,15 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include <gtest/gtest.h>
+
+#include "crc32.h"
+
+TEST(Crc32Test, MatchesCheckValue) {
+  EXPECT_EQ(0U, Crc32(0, "", 0));
+  EXPECT_EQ(0xcbf43926U, Crc32(0, "123456789", 9));
+}
+
+TEST(Crc32Test, CanBeExtended) {
+  EXPECT_EQ(Crc32(0, "123456789", 9), Crc32(Crc32(0, "1234", 4), "56789", 5));
+}
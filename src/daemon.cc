@@ -0,0 +1,573 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <sstream>
+
+#include "cli_util.h"
+#include "ringfile_internal.h"
+
+namespace {
+
+// How much the loop reads from an input at a time, and how many datagrams it
+// takes per system call.
+const size_t kReadSize = 64 * 1024;
+const unsigned int kDatagramBatch = 64;
+
+// How many reads one input gets per wakeup before the others get a turn.
+const int kMaxReadsPerWakeup = 16;
+
+// How many batches may wait for a worker before the loop waits for it.
+const size_t kMaxQueuedBatches = 64;
+
+const size_t kDefaultWorkerCount = 2;
+
+bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+}  // anonymous namespace
+
+struct Daemon::Ring {
+  Ringfile ring;
+  // No record as big as this fits in the ring.
+  size_t max_record_size;
+  size_t worker;
+  // Records that could not be appended, updated by the worker.
+  size_t dropped;
+};
+
+struct Daemon::Input {
+  std::string name;
+  int fd;
+  bool datagrams;
+  Ring * ring;
+  // The start of a line whose end has not been read yet.
+  std::string partial_line;
+  // Set while skipping the rest of a line that was too long to keep.
+  bool discarding_line;
+};
+
+struct Daemon::Worker {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  // Signalled when a batch is queued or the worker should stop.
+  pthread_cond_t queued;
+  // Signalled when the worker takes a batch off a full queue.
+  pthread_cond_t space;
+  std::deque<Batch *> batches;
+  bool stopping;
+};
+
+Daemon::Daemon()
+  : worker_count_(kDefaultWorkerCount),
+    epoll_fd_(-1),
+    error_(0) {
+  stop_fds_[0] = -1;
+  stop_fds_[1] = -1;
+}
+
+Daemon::~Daemon() {
+  Close();
+}
+
+bool Daemon::Fail(int error, const std::string & message) {
+  error_ = error;
+  error_message_ = message;
+  return false;
+}
+
+bool Daemon::Load(std::istream * config) {
+#ifdef __linux__
+  if (epoll_fd_ == -1) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1) {
+      return Fail(errno, std::string("epoll: ") + strerror(errno));
+    }
+    if (pipe(stop_fds_) == -1) {
+      return Fail(errno, std::string("pipe: ") + strerror(errno));
+    }
+    SetNonBlocking(stop_fds_[0]);
+    SetNonBlocking(stop_fds_[1]);
+
+    // The stop pipe is the one event with no input.
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fds_[0], &event) == -1) {
+      return Fail(errno, std::string("epoll: ") + strerror(errno));
+    }
+  }
+#else
+  return Fail(ENOSYS, "daemon mode needs epoll");
+#endif
+
+  std::string line;
+  for (int line_number = 1; std::getline(*config, line); ++line_number) {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+    std::istringstream words(line);
+    std::string kind;
+    if (!(words >> kind)) {
+      continue;
+    }
+
+    std::ostringstream where;
+    where << "line " << line_number << ": ";
+
+    if (kind == "workers") {
+      long count;
+      std::string extra;
+      if (!(words >> count) || count < 0 || words >> extra) {
+        return Fail(EINVAL, where.str() + "expected workers COUNT");
+      }
+      worker_count_ = count;
+      continue;
+    }
+
+    std::string source, path, size_string, extra;
+    if (!(words >> source >> path)) {
+      return Fail(EINVAL, where.str() + "expected " + kind +
+        " SOURCE RING [SIZE]");
+    }
+    long size = -1;
+    if (words >> size_string && !ParseSize(size_string.c_str(), &size)) {
+      return Fail(EINVAL, where.str() + "invalid size");
+    }
+    if (words >> extra) {
+      return Fail(EINVAL, where.str() + "too many arguments");
+    }
+    if (!AddInput(kind, source, path, size)) {
+      error_message_ = where.str() + error_message_;
+      return false;
+    }
+  }
+  return true;
+}
+
+Daemon::Ring * Daemon::OpenRing(const std::string & path, long size) {
+  std::map<std::string, Ring *>::iterator it = rings_.find(path);
+  if (it != rings_.end()) {
+    return it->second;
+  }
+
+  Ring * ring = new Ring;
+  ring->worker = rings_.size();
+  ring->dropped = 0;
+  if (!ring->ring.Open(path, Ringfile::kAppend)) {
+    if (ring->ring.error() != ENOENT) {
+      Fail(ring->ring.error(), path + ": cannot open: " +
+        strerror(ring->ring.error()));
+      delete ring;
+      return NULL;
+    }
+    if (size == -1) {
+      Fail(ENOENT, path + ": does not exist and no size was given");
+      delete ring;
+      return NULL;
+    }
+    if (!ring->ring.Create(path, size)) {
+      Fail(ring->ring.error(), path + ": cannot create: " +
+        strerror(ring->ring.error()));
+      delete ring;
+      return NULL;
+    }
+  }
+  ring->max_record_size = ring->ring.bytes_max();
+  rings_[path] = ring;
+  return ring;
+}
+
+bool Daemon::AddInput(const std::string & kind, const std::string & source,
+    const std::string & path, long size) {
+  Input * input = new Input;
+  input->name = source;
+  input->fd = -1;
+  input->datagrams = false;
+  input->discarding_line = false;
+
+  if (kind == "fifo") {
+    if (mkfifo(source.c_str(), 0600) == -1 && errno != EEXIST) {
+      delete input;
+      return Fail(errno, source + ": cannot create: " + strerror(errno));
+    }
+    // Holding the write end open too means the fifo never reaches its end
+    // when the last writer goes away, and we keep reading the next one.
+    input->fd = open(source.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  } else if (kind == "unix") {
+    input->fd = BindDatagramSocket(source);
+    input->datagrams = true;
+  } else if (kind == "fd") {
+    errno = 0;
+    char * end;
+    long fd = strtol(source.c_str(), &end, 10);
+    if (errno != 0 || *end != 0 || fd < 0 || fcntl(fd, F_GETFD) == -1) {
+      delete input;
+      return Fail(EBADF, source + ": not an open file descriptor");
+    }
+    input->fd = fd;
+    int type;
+    socklen_t type_size = sizeof(type);
+    input->datagrams = getsockopt(input->fd, SOL_SOCKET, SO_TYPE, &type,
+      &type_size) == 0 && type == SOCK_DGRAM;
+  } else {
+    delete input;
+    return Fail(EINVAL, "unknown input " + kind);
+  }
+  if (input->fd == -1) {
+    int error = errno;
+    delete input;
+    return Fail(error, source + ": cannot open: " + strerror(error));
+  }
+  inputs_.push_back(input);
+
+  if (!SetNonBlocking(input->fd)) {
+    return Fail(errno, source + ": " + strerror(errno));
+  }
+  input->ring = OpenRing(path, size);
+  if (!input->ring) {
+    return false;
+  }
+
+#ifdef __linux__
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = input;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, input->fd, &event) == -1) {
+    return Fail(errno, source + ": cannot poll: " + strerror(errno));
+  }
+#endif
+  return true;
+}
+
+bool Daemon::Run() {
+#ifdef __linux__
+  if (epoll_fd_ == -1) {
+    return Fail(EBADF, "no configuration loaded");
+  }
+  if (!StartWorkers()) {
+    return false;
+  }
+
+  size_t open_inputs = inputs_.size();
+  bool stopping = false;
+  bool ok = true;
+  while (!stopping && open_inputs) {
+    struct epoll_event events[64];
+    int count = epoll_wait(epoll_fd_, events, 64, -1);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ok = Fail(errno, std::string("epoll: ") + strerror(errno));
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      Input * input = static_cast<Input *>(events[i].data.ptr);
+      if (!input) {
+        stopping = true;
+        continue;
+      }
+      if (input->fd != -1 && ReadInput(input) == kEnded) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, input->fd, NULL);
+        close(input->fd);
+        input->fd = -1;
+        --open_inputs;
+      }
+    }
+  }
+
+  // Take whatever was written before we were stopped.
+  if (stopping) {
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      while (inputs_[i]->fd != -1 && ReadInput(inputs_[i]) == kMore) {
+      }
+    }
+    char byte;
+    while (read(stop_fds_[0], &byte, 1) == 1) {
+    }
+  }
+
+  StopWorkers();
+  return ok;
+#else
+  return Fail(ENOSYS, "daemon mode needs epoll");
+#endif
+}
+
+void Daemon::Stop() {
+  if (stop_fds_[1] != -1) {
+    ssize_t ignored = write(stop_fds_[1], "", 1);
+    (void) ignored;
+  }
+}
+
+Daemon::ReadResult Daemon::ReadInput(Input * input) {
+  Batch * batch = new Batch;
+  batch->ring = input->ring;
+  ReadResult result = input->datagrams ?
+    ReadDatagrams(input, batch) : ReadLines(input, batch);
+  if (batch->sizes.empty()) {
+    delete batch;
+  } else {
+    Append(batch);
+  }
+  return result;
+}
+
+Daemon::ReadResult Daemon::ReadDatagrams(Input * input, Batch * batch) {
+#ifdef __linux__
+  buffer_.resize(kDatagramBatch * kReadSize);
+  struct iovec buffers[kDatagramBatch];
+  struct mmsghdr messages[kDatagramBatch];
+  memset(messages, 0, sizeof(messages));
+  for (unsigned int i = 0; i < kDatagramBatch; ++i) {
+    buffers[i].iov_base = &buffer_[i * kReadSize];
+    buffers[i].iov_len = kReadSize;
+    messages[i].msg_hdr.msg_iov = &buffers[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  for (int reads = 0; reads < kMaxReadsPerWakeup; ++reads) {
+    int received = recvmmsg(input->fd, messages, kDatagramBatch,
+      MSG_DONTWAIT, NULL);
+    if (received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? kDrained : kEnded;
+    }
+    for (int i = 0; i < received; ++i) {
+      // A datagram too large for the buffer was cut short, so it is dropped
+      // rather than kept as a record that was never sent.
+      if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        __atomic_add_fetch(&input->ring->dropped, 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      // Empty datagrams have nothing worth keeping.
+      if (messages[i].msg_len) {
+        batch->data.append(static_cast<char *>(buffers[i].iov_base),
+          messages[i].msg_len);
+        batch->sizes.push_back(messages[i].msg_len);
+      }
+    }
+    if (received < static_cast<int>(kDatagramBatch)) {
+      return kDrained;
+    }
+  }
+  return kMore;
+#else
+  return kEnded;
+#endif
+}
+
+Daemon::ReadResult Daemon::ReadLines(Input * input, Batch * batch) {
+  buffer_.resize(kDatagramBatch * kReadSize);
+  for (int reads = 0; reads < kMaxReadsPerWakeup; ++reads) {
+    ssize_t size = read(input->fd, &buffer_[0], buffer_.size());
+    if (size == -1 && errno == EINTR) {
+      continue;
+    }
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return kDrained;
+    }
+    if (size <= 0) {
+      // A last line with no newline is still a record.
+      if (!input->partial_line.empty()) {
+        batch->data.append(input->partial_line);
+        batch->sizes.push_back(input->partial_line.size());
+        input->partial_line.clear();
+      }
+      return kEnded;
+    }
+
+    const char * data = &buffer_[0];
+    const char * end = data + size;
+    while (data < end) {
+      const char * newline = static_cast<const char *>(
+        memchr(data, '\n', end - data));
+      if (!newline) {
+        if (!input->discarding_line) {
+          input->partial_line.append(data, end);
+        }
+        // A line too long for its ring could never be appended, so drop it
+        // rather than hold on to it until the newline comes.
+        if (input->partial_line.size() >= input->ring->max_record_size) {
+          input->partial_line.clear();
+          input->discarding_line = true;
+          __atomic_add_fetch(&input->ring->dropped, 1, __ATOMIC_RELAXED);
+        }
+        break;
+      }
+      if (input->discarding_line) {
+        input->discarding_line = false;
+        data = newline + 1;
+        continue;
+      }
+      batch->data.append(input->partial_line);
+      batch->data.append(data, newline);
+      batch->sizes.push_back(input->partial_line.size() + (newline - data));
+      input->partial_line.clear();
+      data = newline + 1;
+    }
+  }
+  return kMore;
+}
+
+void Daemon::Append(Batch * batch) {
+  if (workers_.empty()) {
+    WriteBatch(batch);
+    delete batch;
+    return;
+  }
+
+  Worker * worker = workers_[batch->ring->worker % workers_.size()];
+  pthread_mutex_lock(&worker->mutex);
+  while (worker->batches.size() >= kMaxQueuedBatches) {
+    pthread_cond_wait(&worker->space, &worker->mutex);
+  }
+  worker->batches.push_back(batch);
+  pthread_cond_signal(&worker->queued);
+  pthread_mutex_unlock(&worker->mutex);
+}
+
+void Daemon::WriteBatch(Batch * batch) {
+  std::vector<struct iovec> records(batch->sizes.size());
+  size_t offset = 0;
+  for (size_t i = 0; i < records.size(); ++i) {
+    records[i].iov_base = &batch->data[offset];
+    records[i].iov_len = batch->sizes[i];
+    offset += batch->sizes[i];
+  }
+
+  // Drop a record that cannot be appended, such as one too big for the
+  // ring, and carry on with the ones after it.
+  for (size_t done = 0; done < records.size(); ) {
+    size_t written;
+    if (batch->ring->ring.WriteBatch(&records[done], records.size() - done,
+        &written)) {
+      break;
+    }
+    done += written + 1;
+    __atomic_add_fetch(&batch->ring->dropped, 1, __ATOMIC_RELAXED);
+  }
+}
+
+bool Daemon::StartWorkers() {
+  // More workers than rings would have nothing to do.
+  size_t count = worker_count_ < rings_.size() ? worker_count_ : rings_.size();
+  while (workers_.size() < count) {
+    Worker * worker = new Worker;
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->queued, NULL);
+    pthread_cond_init(&worker->space, NULL);
+    worker->stopping = false;
+    int error = pthread_create(&worker->thread, NULL, &RunWorker, worker);
+    if (error) {
+      pthread_cond_destroy(&worker->space);
+      pthread_cond_destroy(&worker->queued);
+      pthread_mutex_destroy(&worker->mutex);
+      delete worker;
+      StopWorkers();
+      return Fail(error, std::string("cannot start worker: ") +
+        strerror(error));
+    }
+    workers_.push_back(worker);
+  }
+  return true;
+}
+
+void Daemon::StopWorkers() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Worker * worker = workers_[i];
+    pthread_mutex_lock(&worker->mutex);
+    worker->stopping = true;
+    pthread_cond_signal(&worker->queued);
+    pthread_mutex_unlock(&worker->mutex);
+    pthread_join(worker->thread, NULL);
+    pthread_cond_destroy(&worker->space);
+    pthread_cond_destroy(&worker->queued);
+    pthread_mutex_destroy(&worker->mutex);
+    delete worker;
+  }
+  workers_.clear();
+}
+
+void * Daemon::RunWorker(void * context) {
+  Worker * worker = static_cast<Worker *>(context);
+  pthread_mutex_lock(&worker->mutex);
+  while (true) {
+    if (worker->batches.empty()) {
+      if (worker->stopping) {
+        break;
+      }
+      pthread_cond_wait(&worker->queued, &worker->mutex);
+      continue;
+    }
+    Batch * batch = worker->batches.front();
+    worker->batches.pop_front();
+    pthread_cond_signal(&worker->space);
+    pthread_mutex_unlock(&worker->mutex);
+
+    WriteBatch(batch);
+    delete batch;
+
+    pthread_mutex_lock(&worker->mutex);
+  }
+  pthread_mutex_unlock(&worker->mutex);
+  return NULL;
+}
+
+size_t Daemon::dropped_count() const {
+  size_t count = 0;
+  for (std::map<std::string, Ring *>::const_iterator it = rings_.begin();
+      it != rings_.end(); ++it) {
+    count += __atomic_load_n(&it->second->dropped, __ATOMIC_RELAXED);
+  }
+  return count;
+}
+
+void Daemon::Close() {
+  StopWorkers();
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    if (inputs_[i]->fd != -1) {
+      close(inputs_[i]->fd);
+    }
+    delete inputs_[i];
+  }
+  inputs_.clear();
+  for (std::map<std::string, Ring *>::iterator it = rings_.begin();
+      it != rings_.end(); ++it) {
+    delete it->second;
+  }
+  rings_.clear();
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (stop_fds_[i] != -1) {
+      close(stop_fds_[i]);
+      stop_fds_[i] = -1;
+    }
+  }
+}
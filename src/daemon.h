@@ -0,0 +1,118 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+class Ringfile;
+
+// Daemon appends from many inputs to their rings from a single process. Each
+// line of the configuration names an input and the ring it feeds:
+//
+//   # comment
+//   workers 2
+//   fifo /run/log/app1 /var/log/app1.ring 64m
+//   unix /run/log/app2.sock /var/log/app2.ring 64m
+//   fd 3 /var/log/app3.ring
+//
+// A fifo is created if it does not exist and is read a line per record. A
+// unix socket is bound like `ringfile --listen` and records each datagram.
+// An fd is inherited from the parent and is read as datagrams if it is a
+// datagram socket and as lines otherwise. The size is only needed for rings
+// that do not exist yet, and several inputs may share one ring.
+//
+// One epoll loop reads whatever each ready input has in one go, and hands
+// the records to one of `workers` threads to append with WriteBatch(). Each
+// ring always goes to the same worker, so its records stay in order while a
+// slow ring only holds up the rings that share its worker. With `workers 0`
+// the loop appends the records itself.
+class Daemon {
+ public:
+  Daemon();
+  ~Daemon();
+
+  // Read the configuration and open every input and ring.
+  bool Load(std::istream * config);
+
+  // Run until Stop() is called or every input has reached its end.
+  bool Run();
+
+  // Make Run() return once everything read so far has been appended. Safe to
+  // call from another thread or a signal handler.
+  void Stop();
+
+  void Close();
+
+  int error() const { return error_; }
+
+  // Describes what went wrong when Load() or Run() fails.
+  const std::string & error_message() const { return error_message_; }
+
+  size_t input_count() const { return inputs_.size(); }
+  size_t ring_count() const { return rings_.size(); }
+
+  // Records that could not be appended, such as ones too big for their ring.
+  size_t dropped_count() const;
+
+ private:
+  Daemon(const Daemon &);
+  void operator=(const Daemon &);
+
+  struct Ring;
+  struct Input;
+  struct Worker;
+
+  // Records read in one go, laid out back to back in `data`.
+  struct Batch {
+    Ring * ring;
+    std::string data;
+    std::vector<size_t> sizes;
+  };
+
+  bool Fail(int error, const std::string & message);
+  bool AddInput(const std::string & kind, const std::string & source,
+    const std::string & path, long size);
+  Ring * OpenRing(const std::string & path, long size);
+
+  // What ReadInput() found.
+  enum ReadResult {
+    kEnded,     // the input has reached its end
+    kDrained,   // everything the input had was read
+    kMore       // the input may have more, left for the next wakeup
+  };
+  ReadResult ReadInput(Input * input);
+  ReadResult ReadDatagrams(Input * input, Batch * batch);
+  ReadResult ReadLines(Input * input, Batch * batch);
+  void Append(Batch * batch);
+
+  bool StartWorkers();
+  void StopWorkers();
+  static void * RunWorker(void * context);
+  static void WriteBatch(Batch * batch);
+
+  std::vector<Input *> inputs_;
+  std::map<std::string, Ring *> rings_;
+  std::vector<Worker *> workers_;
+  size_t worker_count_;
+
+  int epoll_fd_;
+  // Written by Stop() to wake the loop.
+  int stop_fds_[2];
+
+  // Shared by every input, as only the loop reads.
+  std::vector<char> buffer_;
+
+  int error_;
+  std::string error_message_;
+};
+
+#endif  // DAEMON_H_
@@ -0,0 +1,189 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ringfile_internal.h"
+#include "test_util.h"
+
+namespace {
+
+void * RunDaemon(void * context) {
+  Daemon * daemon = static_cast<Daemon *>(context);
+  EXPECT_TRUE(daemon->Run());
+  return NULL;
+}
+
+std::vector<std::string> ReadRecords(const std::string & path) {
+  std::vector<std::string> records;
+  Ringfile ring;
+  EXPECT_TRUE(ring.Open(path, Ringfile::kRead));
+  size_t size;
+  while (ring.NextRecordSize(&size)) {
+    std::string record(size, 0);
+    EXPECT_TRUE(ring.Read(const_cast<char *>(record.data()), size));
+    records.push_back(record);
+  }
+  return records;
+}
+
+void WriteString(int fd, const std::string & data) {
+  ASSERT_EQ(static_cast<ssize_t>(data.size()),
+    write(fd, data.data(), data.size()));
+}
+
+void ServeManyInputs(int worker_count) {
+  std::string dir = TempDir();
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  int socket_fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, socket_fds));
+
+  std::ostringstream config;
+  config << "# inputs\n"
+    << "workers " << worker_count << "\n"
+    << "fifo " << dir << "/fifo " << dir << "/lines.ring 64k\n"
+    << "fd " << pipe_fds[0] << " " << dir << "/lines.ring\n"
+    << "fd " << socket_fds[0] << " " << dir << "/datagrams.ring 64k  # x\n";
+  std::istringstream config_stream(config.str());
+
+  Daemon daemon;
+  ASSERT_TRUE(daemon.Load(&config_stream)) << daemon.error_message();
+  EXPECT_EQ(3U, daemon.input_count());
+  EXPECT_EQ(2U, daemon.ring_count());
+
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, &RunDaemon, &daemon));
+
+  int fifo_fd = open((dir + "/fifo").c_str(), O_WRONLY);
+  ASSERT_NE(-1, fifo_fd);
+  WriteString(fifo_fd, "one\ntw");
+  WriteString(fifo_fd, "o\nthree\n");
+  close(fifo_fd);
+
+  WriteString(socket_fds[1], "multi\nline");
+  WriteString(socket_fds[1], "datagram");
+
+  // The pipe ends without a newline, which is still a record.
+  WriteString(pipe_fds[1], "piped");
+  close(pipe_fds[1]);
+
+  daemon.Stop();
+  ASSERT_EQ(0, pthread_join(thread, NULL));
+  EXPECT_EQ(0U, daemon.dropped_count());
+  daemon.Close();
+  close(socket_fds[1]);
+
+  std::vector<std::string> lines = ReadRecords(dir + "/lines.ring");
+  ASSERT_EQ(4U, lines.size());
+  std::vector<std::string> fifo_lines;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (lines[i] != "piped") {
+      fifo_lines.push_back(lines[i]);
+    }
+  }
+  ASSERT_EQ(3U, fifo_lines.size());
+  EXPECT_EQ("one", fifo_lines[0]);
+  EXPECT_EQ("two", fifo_lines[1]);
+  EXPECT_EQ("three", fifo_lines[2]);
+
+  std::vector<std::string> datagrams = ReadRecords(dir + "/datagrams.ring");
+  ASSERT_EQ(2U, datagrams.size());
+  EXPECT_EQ("multi\nline", datagrams[0]);
+  EXPECT_EQ("datagram", datagrams[1]);
+}
+
+}  // anonymous namespace
+
+TEST(DaemonTest, CanServeManyInputs) {
+  ServeManyInputs(2);
+}
+
+TEST(DaemonTest, CanAppendWithoutWorkers) {
+  ServeManyInputs(0);
+}
+
+TEST(DaemonTest, RejectsBadConfiguration) {
+  Daemon daemon;
+  std::istringstream config("fifo only_one_argument\n");
+  EXPECT_FALSE(daemon.Load(&config));
+  EXPECT_EQ(EINVAL, daemon.error());
+  EXPECT_EQ("line 1: expected fifo SOURCE RING [SIZE]",
+    daemon.error_message());
+
+  std::istringstream missing("fd 1000 " + TempDir() + "/ring\n");
+  EXPECT_FALSE(daemon.Load(&missing));
+  EXPECT_EQ(EBADF, daemon.error());
+}
+
+TEST(DaemonTest, DropsRecordsThatDoNotFit) {
+  std::string path = TempDir() + "/ring";
+  {
+    Ringfile::Options options;
+    options.block_size = 256;
+    Ringfile ring;
+    ASSERT_TRUE(ring.Create(path, 2000, options));
+  }
+
+  // A record too big for a block between two that fit, then a line too long
+  // for the whole ring that never ends.
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  WriteString(fds[1], "a\n" + std::string(300, 'x') + "\nb\n" +
+    std::string(3000, 'y'));
+  close(fds[1]);
+
+  std::ostringstream config;
+  config << "workers 0\nfd " << fds[0] << " " << path << "\n";
+  std::istringstream config_stream(config.str());
+  Daemon daemon;
+  ASSERT_TRUE(daemon.Load(&config_stream)) << daemon.error_message();
+  ASSERT_TRUE(daemon.Run());
+  EXPECT_EQ(2U, daemon.dropped_count());
+  daemon.Close();
+
+  std::vector<std::string> records = ReadRecords(path);
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("a", records[0]);
+  EXPECT_EQ("b", records[1]);
+}
+
+TEST(DaemonTest, DropsTruncatedDatagrams) {
+  std::string path = TempDir() + "/ring";
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+
+  std::ostringstream config;
+  config << "fd " << fds[0] << " " << path << " 64k\n";
+  std::istringstream config_stream(config.str());
+  Daemon daemon;
+  ASSERT_TRUE(daemon.Load(&config_stream)) << daemon.error_message();
+
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, &RunDaemon, &daemon));
+  WriteString(fds[1], "a");
+  WriteString(fds[1], std::string(70000, 'x'));
+  WriteString(fds[1], "b");
+  daemon.Stop();
+  ASSERT_EQ(0, pthread_join(thread, NULL));
+  EXPECT_EQ(1U, daemon.dropped_count());
+  daemon.Close();
+  close(fds[1]);
+
+  std::vector<std::string> records = ReadRecords(path);
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("a", records[0]);
+  EXPECT_EQ("b", records[1]);
+}
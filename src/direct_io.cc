@@ -0,0 +1,168 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "direct_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+uint64_t AlignDown(uint64_t offset) {
+  return offset - offset % DirectIO::kAlignment;
+}
+
+uint64_t AlignUp(uint64_t offset) {
+  return AlignDown(offset + DirectIO::kAlignment - 1);
+}
+
+// pwrite() all of `size` bytes, returning an errno value or 0.
+int WriteFully(int fd, const char * data, size_t size, uint64_t offset) {
+  while (size) {
+    ssize_t rv = pwrite(fd, data, size, offset);
+    if (rv == -1 && errno == EINTR) {
+      continue;
+    }
+    if (rv <= 0) {
+      return rv == -1 ? errno : EIO;
+    }
+    data += rv;
+    size -= rv;
+    offset += rv;
+  }
+  return 0;
+}
+
+}  // anonymous namespace
+
+DirectIO::DirectIO()
+  : fd_(-1),
+    buffered_fd_(-1),
+    error_(0),
+    block_size_(0),
+    write_block_(NULL),
+    write_base_(0),
+    stage_begin_(0),
+    stage_end_(0),
+    read_block_(NULL),
+    read_base_(0),
+    read_begin_(0),
+    read_valid_(0),
+    read_end_(0) {
+}
+
+DirectIO::~DirectIO() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  free(write_block_);
+  free(read_block_);
+}
+
+bool DirectIO::Init(int fd, bool writable, size_t block_size) {
+  // Open the file again rather than setting O_DIRECT on `fd`, which may be
+  // shared with code that does unaligned I/O.
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  fd_ = open(path, (writable ? O_RDWR : O_RDONLY) | O_DIRECT);
+  if (fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+  buffered_fd_ = fd;
+
+  block_size_ = AlignUp(std::max(block_size, kAlignment));
+  void * block;
+  if ((error_ = posix_memalign(&block, kAlignment, block_size_)) != 0) {
+    return false;
+  }
+  read_block_ = static_cast<char *>(block);
+  if (writable) {
+    if ((error_ = posix_memalign(&block, kAlignment, block_size_)) != 0) {
+      return false;
+    }
+    write_block_ = static_cast<char *>(block);
+  }
+  return true;
+}
+
+size_t DirectIO::Stage(uint64_t offset, const void * data, size_t size) {
+  if (!staged()) {
+    write_base_ = AlignDown(offset);
+    stage_begin_ = stage_end_ = offset;
+  }
+  size = std::min<uint64_t>(size, write_base_ + block_size_ - stage_end_);
+  memcpy(write_block_ + (stage_end_ - write_base_), data, size);
+  stage_end_ += size;
+  return size;
+}
+
+bool DirectIO::Flush() {
+  if (!staged()) {
+    return true;
+  }
+
+  // Only whole pages can be written directly. The partial pages at either
+  // end go through the page cache, where the kernel merges them with the
+  // rest of the page.
+  uint64_t head_end = std::min(AlignUp(stage_begin_), stage_end_);
+  uint64_t tail_begin = std::max(head_end, AlignDown(stage_end_));
+  const char * base = write_block_ - write_base_;
+  if ((error_ = WriteFully(buffered_fd_, base + stage_begin_,
+      head_end - stage_begin_, stage_begin_)) != 0 ||
+      (error_ = WriteFully(fd_, base + head_end, tail_begin - head_end,
+      head_end)) != 0 ||
+      (error_ = WriteFully(buffered_fd_, base + tail_begin,
+      stage_end_ - tail_begin, tail_begin)) != 0) {
+    return false;
+  }
+  stage_begin_ = stage_end_ = 0;
+  return true;
+}
+
+bool DirectIO::Fill(uint64_t offset, uint64_t valid_end) {
+  read_base_ = AlignDown(offset);
+  ssize_t rv;
+  do {
+    rv = pread(fd_, read_block_, block_size_, read_base_);
+  } while (rv == -1 && errno == EINTR);
+  if (rv == -1 || read_base_ + rv <= offset) {
+    Invalidate();
+    error_ = rv == -1 ? errno : EIO;
+    return false;
+  }
+  read_begin_ = offset;
+  read_valid_ = valid_end;
+  read_end_ = read_base_ + rv;
+  return true;
+}
+
+bool DirectIO::Read(uint64_t offset, void * data, size_t size,
+    uint64_t valid_end) {
+  if (offset < read_begin_ || offset >= read_valid_ || offset >= read_end_) {
+    if (!Fill(offset, valid_end)) {
+      return false;
+    }
+  }
+
+  // Bytes that belong to the same read are taken from the block even past
+  // read_valid_, as the caller may read a little beyond what it needs.
+  char * out = static_cast<char *>(data);
+  while (size) {
+    if (offset >= read_end_ && !Fill(offset, valid_end)) {
+      return false;
+    }
+    size_t chunk = std::min<uint64_t>(size, read_end_ - offset);
+    memcpy(out, read_block_ + (offset - read_base_), chunk);
+    out += chunk;
+    offset += chunk;
+    size -= chunk;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef DIRECT_IO_H_
+#define DIRECT_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DirectIO moves data between a file and memory with O_DIRECT, so that big
+// rings do not push everything else out of the page cache. O_DIRECT needs
+// the file offset, length and memory address of every transfer to be
+// aligned, so it works through aligned blocks of memory:
+//
+//  - Writers Stage() bytes at increasing file offsets in a write block and
+//    Flush() them with one large aligned write. The unaligned pieces at
+//    either end, at most a page each, are written through the page cache.
+//  - Reads go through a read block, which is refilled with one large aligned
+//    read whenever a read falls outside it and so doubles as readahead.
+//
+// All offsets are file offsets. Init() fails with EINVAL on file systems
+// that do not support O_DIRECT.
+class DirectIO {
+ public:
+  // Transfers are aligned to this many bytes, which suits both 512 byte and
+  // 4k sector devices.
+  static const size_t kAlignment = 4096;
+
+  DirectIO();
+  ~DirectIO();
+
+  // Open `fd` again with O_DIRECT, read only if `writable` is false, and
+  // allocate blocks of `block_size` bytes (rounded up to kAlignment).
+  bool Init(int fd, bool writable, size_t block_size);
+
+  // Copy up to `size` bytes that belong at file offset `offset` into the
+  // write block, returning how many fit. `offset` must follow on from the
+  // bytes staged before it, unless nothing is staged.
+  size_t Stage(uint64_t offset, const void * data, size_t size);
+
+  // Write the staged bytes to the file.
+  bool Flush();
+
+  bool staged() const { return stage_begin_ != stage_end_; }
+  bool full() const { return stage_end_ == write_base_ + block_size_; }
+
+  // Copy `size` bytes at file offset `offset` to `data`. When the read block
+  // has to be refilled, `valid_end` is the file offset up to which the file
+  // is known not to change while the block holds it; later reads past it
+  // refill the block again.
+  bool Read(uint64_t offset, void * data, size_t size, uint64_t valid_end);
+
+  // Forget what was read, because the file has changed.
+  void Invalidate() { read_begin_ = read_valid_ = read_end_ = 0; }
+
+  int error() const { return error_; }
+
+ private:
+  bool Fill(uint64_t offset, uint64_t valid_end);
+
+  // The O_DIRECT descriptor, and the one it was opened from.
+  int fd_;
+  int buffered_fd_;
+  int error_;
+  size_t block_size_;
+
+  // Bytes staged for writing are write_block_[stage_begin_ - write_base_] up
+  // to write_block_[stage_end_ - write_base_], where write_base_ is
+  // stage_begin_ rounded down to kAlignment.
+  char * write_block_;
+  uint64_t write_base_;
+  uint64_t stage_begin_;
+  uint64_t stage_end_;
+
+  // Bytes read from the file are read_block_[read_begin_ - read_base_] up to
+  // read_block_[read_end_ - read_base_]. Reads starting from read_valid_
+  // onwards refill the block.
+  char * read_block_;
+  uint64_t read_base_;
+  uint64_t read_begin_;
+  uint64_t read_valid_;
+  uint64_t read_end_;
+};
+
+#endif  // DIRECT_IO_H_
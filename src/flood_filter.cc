@@ -0,0 +1,80 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "flood_filter.h"
+
+#include <algorithm>
+#include <sstream>
+
+FloodFilter::FloodFilter(bool collapse, double rate, double burst)
+  : collapse_(collapse),
+    rate_(rate),
+    // A bucket must hold at least one line for any to get through.
+    burst_(std::max(burst > 0 ? burst : rate, 1.0)),
+    have_last_line_(false),
+    repeats_(0),
+    tokens_(burst_),
+    last_refill_(0),
+    dropped_(0),
+    repeated_count_(0),
+    dropped_count_(0) {
+}
+
+void FloodFilter::Filter(const std::string & line, double now,
+    std::vector<std::string> * records) {
+  if (collapse_) {
+    if (have_last_line_ && line == last_line_) {
+      ++repeats_;
+      ++repeated_count_;
+      return;
+    }
+    FlushRepeats(records);
+  }
+
+  if (rate_ > 0) {
+    if (now > last_refill_) {
+      tokens_ += (now - last_refill_) * rate_;
+      if (tokens_ > burst_) {
+        tokens_ = burst_;
+      }
+      last_refill_ = now;
+    }
+    if (tokens_ < 1) {
+      // Only collapse lines into one that was recorded.
+      have_last_line_ = false;
+      ++dropped_;
+      ++dropped_count_;
+      return;
+    }
+    tokens_ -= 1;
+    FlushDropped(records);
+  }
+  records->push_back(line);
+  if (collapse_) {
+    last_line_ = line;
+    have_last_line_ = true;
+  }
+}
+
+void FloodFilter::Finish(std::vector<std::string> * records) {
+  FlushRepeats(records);
+  FlushDropped(records);
+}
+
+void FloodFilter::FlushRepeats(std::vector<std::string> * records) {
+  if (repeats_) {
+    std::ostringstream message;
+    message << "last message repeated " << repeats_ << " times";
+    records->push_back(message.str());
+    repeats_ = 0;
+  }
+}
+
+void FloodFilter::FlushDropped(std::vector<std::string> * records) {
+  if (dropped_) {
+    std::ostringstream message;
+    message << "dropped " << dropped_ << " lines over the rate limit";
+    records->push_back(message.str());
+    dropped_ = 0;
+  }
+}
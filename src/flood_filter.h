@@ -0,0 +1,63 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef FLOOD_FILTER_H_
+#define FLOOD_FILTER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// FloodFilter keeps a service that floods its log from evicting the rest of
+// the ring's history. With `collapse`, a line identical to the one before it
+// is counted rather than recorded, and a "last message repeated N times"
+// record follows once a different line arrives. With a `rate`, a token
+// bucket admits that many lines per second on average and up to `burst` at
+// once; lines beyond that are counted, and a record saying how many were
+// dropped goes before the next line that is admitted.
+//
+// It holds only the last line and a few counters, and a line that differs
+// from the one before and finds a token costs one comparison.
+class FloodFilter {
+ public:
+  // A `rate` of zero admits every line. A `burst` of zero means `rate`.
+  FloodFilter(bool collapse, double rate, double burst);
+
+  // Decide what to record for `line`, read `now` seconds from any fixed
+  // point. The records to write are appended to `records`.
+  void Filter(const std::string & line, double now,
+    std::vector<std::string> * records);
+
+  // Append the records for anything still held back.
+  void Finish(std::vector<std::string> * records);
+
+  bool rate_limited() const { return rate_ > 0; }
+
+  // How many lines were collapsed or dropped.
+  uint64_t repeated_count() const { return repeated_count_; }
+  uint64_t dropped_count() const { return dropped_count_; }
+
+ private:
+  void FlushRepeats(std::vector<std::string> * records);
+  void FlushDropped(std::vector<std::string> * records);
+
+  bool collapse_;
+  double rate_;
+  double burst_;
+
+  std::string last_line_;
+  bool have_last_line_;
+  // Repeats of last_line_ not yet reported.
+  uint64_t repeats_;
+
+  double tokens_;
+  double last_refill_;
+  // Lines dropped since the last report.
+  uint64_t dropped_;
+
+  uint64_t repeated_count_;
+  uint64_t dropped_count_;
+};
+
+#endif  // FLOOD_FILTER_H_
@@ -0,0 +1,70 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "flood_filter.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(FloodFilterTest, CollapsesRepeatedLines) {
+  FloodFilter filter(true, 0, 0);
+  std::vector<std::string> records;
+  filter.Filter("a", 0, &records);
+  filter.Filter("b", 0, &records);
+  filter.Filter("b", 0, &records);
+  filter.Filter("b", 0, &records);
+  filter.Filter("a", 0, &records);
+  filter.Filter("a", 0, &records);
+  filter.Finish(&records);
+
+  ASSERT_EQ(5U, records.size());
+  EXPECT_EQ("a", records[0]);
+  EXPECT_EQ("b", records[1]);
+  EXPECT_EQ("last message repeated 2 times", records[2]);
+  EXPECT_EQ("a", records[3]);
+  EXPECT_EQ("last message repeated 1 times", records[4]);
+  EXPECT_EQ(3U, filter.repeated_count());
+  EXPECT_EQ(0U, filter.dropped_count());
+}
+
+TEST(FloodFilterTest, LimitsTheRate) {
+  // Two lines a second, in bursts of up to three.
+  FloodFilter filter(false, 2, 3);
+  std::vector<std::string> records;
+  for (int i = 0; i < 10; ++i) {
+    filter.Filter("flood", 100, &records);
+  }
+  EXPECT_EQ(3U, records.size());
+  EXPECT_EQ(7U, filter.dropped_count());
+
+  // Half a second later there is a token for one more line.
+  records.clear();
+  filter.Filter("later", 100.5, &records);
+  filter.Filter("dropped", 100.5, &records);
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("dropped 7 lines over the rate limit", records[0]);
+  EXPECT_EQ("later", records[1]);
+
+  records.clear();
+  filter.Finish(&records);
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ("dropped 1 lines over the rate limit", records[0]);
+}
+
+TEST(FloodFilterTest, RepeatsDoNotUseTokens) {
+  FloodFilter filter(true, 1, 1);
+  std::vector<std::string> records;
+  for (int i = 0; i < 100; ++i) {
+    filter.Filter("same", 0, &records);
+  }
+  filter.Filter("different", 1, &records);
+  filter.Finish(&records);
+
+  ASSERT_EQ(3U, records.size());
+  EXPECT_EQ("same", records[0]);
+  EXPECT_EQ("last message repeated 99 times", records[1]);
+  EXPECT_EQ("different", records[2]);
+  EXPECT_EQ(0U, filter.dropped_count());
+}
@@ -25,13 +25,26 @@ RINGFILE * ringfile_create(const char * path, size_t size) {
   return self;
 }
 
-RINGFILE * ringfile_open(const char * path, const char * mode_str) {
-  Ringfile::Mode mode;
+namespace {
+
+// Parse a mode string for ringfile_open() and friends.
+bool ParseMode(const char * mode_str, Ringfile::Mode * mode) {
   if (strcmp(mode_str, "r") == 0) {
-    mode = Ringfile::kRead;
+    *mode = Ringfile::kRead;
   } else if (strcmp(mode_str, "a") == 0) {
-    mode = Ringfile::kAppend;
+    *mode = Ringfile::kAppend;
   } else {
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+RINGFILE * ringfile_open(const char * path, const char * mode_str) {
+  Ringfile::Mode mode;
+  if (!ParseMode(mode_str, &mode)) {
     return NULL;
   }
 
@@ -44,6 +57,50 @@ RINGFILE * ringfile_open(const char * path, const char * mode_str) {
   return self;
 }
 
+RINGFILE * ringfile_fdopen(int fd, const char * mode_str) {
+  Ringfile::Mode mode;
+  if (!ParseMode(mode_str, &mode)) {
+    return NULL;
+  }
+
+  RINGFILE * self = new RINGFILE();
+  if (!self->impl_.OpenFd(fd, mode, true)) {
+    errno = self->impl_.error();
+    delete self;
+    return NULL;
+  }
+  return self;
+}
+
+RINGFILE * ringfile_create_shm(const char * name, size_t size) {
+  RINGFILE * self = new RINGFILE();
+  if (!self->impl_.CreateShm(name, size)) {
+    errno = self->impl_.error();
+    delete self;
+    return NULL;
+  }
+  return self;
+}
+
+RINGFILE * ringfile_open_shm(const char * name, const char * mode_str) {
+  Ringfile::Mode mode;
+  if (!ParseMode(mode_str, &mode)) {
+    return NULL;
+  }
+
+  RINGFILE * self = new RINGFILE();
+  if (!self->impl_.OpenShm(name, mode)) {
+    errno = self->impl_.error();
+    delete self;
+    return NULL;
+  }
+  return self;
+}
+
+int ringfile_fileno(RINGFILE * self) {
+  return self->impl_.fd();
+}
+
 int ringfile_write(const void * ptr, size_t size, RINGFILE * self) {
   if (!self->impl_.Write(ptr, size)) {
     errno = self->impl_.error();
@@ -68,6 +125,26 @@ int ringfile_next_record_size(RINGFILE * self, size_t * size) {
   return 0;
 }
 
+ssize_t ringfile_foreach(RINGFILE * self, ringfile_callback callback,
+    void * context) {
+  size_t count;
+  if (!self->impl_.ForEach(callback, context, &count)) {
+    errno = self->impl_.error();
+    return -1;
+  }
+  return count;
+}
+
+ssize_t ringfile_read_batch(RINGFILE * self, void * buffer, size_t capacity,
+    size_t * offsets, size_t count) {
+  size_t records;
+  if (!self->impl_.ReadBatch(count, buffer, capacity, offsets, &records)) {
+    errno = self->impl_.error();
+    return -1;
+  }
+  return records;
+}
+
 void ringfile_close(RINGFILE * self) {
   delete self;
 }
@@ -2,11 +2,30 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include <errno.h>
+#include <fcntl.h>
 #include <gtest/gtest.h>
 
 #include <ringfile.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
 #include "test_util.h"
 
+namespace {
+
+int CollectRecord(const void * data, size_t size, void * context) {
+  std::vector<std::string> * records =
+    static_cast<std::vector<std::string> *>(context);
+  records->push_back(std::string(static_cast<const char *>(data), size));
+  return records->size() == 3;
+}
+
+}  // anonymous namespace
+
 TEST(PublicInterfaceTest, CannotOpenBogusPath) {
   std::string path = TempDir() + "/does not exist/ring";
   EXPECT_EQ(NULL, ringfile_create(path.c_str(), 1000));
@@ -66,3 +85,100 @@ TEST(PublicInterfaceTest, CanReadAndWriteBasics) {
   }
 }
 
+
+TEST(PublicInterfaceTest, CanReadManyRecords) {
+  std::string path = TempDir() + "/ring";
+
+  RINGFILE * writer = ringfile_create(path.c_str(), 1024);
+  ASSERT_TRUE(NULL != writer);
+  for (int i = 0; i < 10; ++i) {
+    char message[16];
+    snprintf(message, sizeof(message), "message %d", i);
+    ASSERT_EQ(0, ringfile_write(message, strlen(message), writer));
+  }
+  ringfile_close(writer);
+
+  RINGFILE * ringfile = ringfile_open(path.c_str(), "r");
+  ASSERT_TRUE(NULL != ringfile);
+
+  // The callback stops after the third record
+  std::vector<std::string> records;
+  EXPECT_EQ(3, ringfile_foreach(ringfile, &CollectRecord, &records));
+  ASSERT_EQ(3U, records.size());
+  EXPECT_EQ("message 0", records[0]);
+  EXPECT_EQ("message 2", records[2]);
+
+  // Only two records fit in the buffer
+  char buffer[20];
+  size_t offsets[5];
+  EXPECT_EQ(2, ringfile_read_batch(ringfile, buffer, sizeof(buffer), offsets,
+    4));
+  EXPECT_EQ("message 3message 4", std::string(buffer, offsets[2]));
+  EXPECT_EQ(9U, offsets[1]);
+
+  EXPECT_EQ(-1, ringfile_read_batch(ringfile, buffer, 5, offsets, 4));
+  EXPECT_EQ(EMSGSIZE, errno);
+
+  char big_buffer[100];
+  EXPECT_EQ(4, ringfile_read_batch(ringfile, big_buffer, sizeof(big_buffer),
+    offsets, 4));
+  EXPECT_EQ("message 8", std::string(big_buffer + offsets[3],
+    offsets[4] - offsets[3]));
+
+  records.clear();
+  EXPECT_EQ(1, ringfile_foreach(ringfile, &CollectRecord, &records));
+  EXPECT_EQ("message 9", records[0]);
+  EXPECT_EQ(0, ringfile_read_batch(ringfile, big_buffer, sizeof(big_buffer),
+    offsets, 4));
+
+  ringfile_close(ringfile);
+}
+
+TEST(PublicInterfaceTest, CanOpenFileDescriptors) {
+  std::string path = TempDir() + "/ring";
+  RINGFILE * writer = ringfile_create(path.c_str(), 1024);
+  ASSERT_TRUE(NULL != writer);
+  ASSERT_EQ(0, ringfile_write("Hello, World!", 13, writer));
+  ringfile_close(writer);
+
+  EXPECT_EQ(NULL, ringfile_fdopen(-1, "r"));
+  EXPECT_EQ(EBADF, errno);
+
+  int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_NE(-1, fd);
+  EXPECT_EQ(NULL, ringfile_fdopen(fd, "x"));
+  EXPECT_EQ(EINVAL, errno);
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  EXPECT_EQ(NULL, ringfile_fdopen(pipe_fds[0], "r"));
+  EXPECT_NE(-1, fcntl(pipe_fds[0], F_GETFD));  // still ours
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+
+  RINGFILE * ringfile = ringfile_fdopen(fd, "r");
+  ASSERT_TRUE(NULL != ringfile);
+  EXPECT_EQ(fd, ringfile_fileno(ringfile));
+  char buffer[100];
+  EXPECT_EQ(0, ringfile_read(buffer, sizeof(buffer), ringfile));
+  EXPECT_EQ("Hello, World!", std::string(buffer, 13));
+  ringfile_close(ringfile);
+}
+
+TEST(PublicInterfaceTest, CanCreateSharedMemoryRing) {
+  char name[64];
+  snprintf(name, sizeof(name), "/ringfile-public-test-%d", getpid());
+
+  RINGFILE * writer = ringfile_create_shm(name, 4096);
+  ASSERT_TRUE(NULL != writer) << strerror(errno);
+  ASSERT_EQ(0, ringfile_write("shared", 6, writer));
+
+  RINGFILE * reader = ringfile_open_shm(name, "r");
+  ASSERT_TRUE(NULL != reader);
+  char buffer[100];
+  EXPECT_EQ(0, ringfile_read(buffer, sizeof(buffer), reader));
+  EXPECT_EQ("shared", std::string(buffer, 6));
+
+  ringfile_close(reader);
+  ringfile_close(writer);
+  EXPECT_EQ(0, shm_unlink(name));
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef RECORD_FRAMING_H_
+#define RECORD_FRAMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "varint.h"
+
+// The size Decode() reports for a skip marker.
+static const size_t kSkipMarker = SIZE_MAX;
+
+// The largest alignment ContiguousFraming supports, and so the longest a
+// prefix can be including the padding after it.
+static const size_t kMaxAlignment = 64;
+static const size_t kMaxPrefixSize = Varint::kMaxSize + kMaxAlignment - 1;
+
+// Framing policies describe how records are laid out in the data area of a
+// ring. The record paths of Ringfile are templates over the policy, so the
+// layout is chosen once per call rather than tested again for every record,
+// and each layout gets its own copy of the loops with nothing in them that
+// it does not need. A policy provides:
+//
+//   kStoresLength  true if the length of a record is stored in the file, in
+//                  which case Decode() must be given the bytes at its start
+//   kContiguous    true if records never wrap around the end of the data
+//                  area, in which case Decode() sets the size to kSkipMarker
+//                  for the marker that pads out the end of the data area
+//   Encode(offset, size, buffer, &prefix_size)
+//                  write the prefix of a `size` byte record that starts at
+//                  data area offset `offset` to `buffer` (kMaxPrefixSize
+//                  bytes); false if the record cannot be stored at all
+//   Decode(offset, buffer, &size)
+//                  read the prefix of the record at `offset`, returning its
+//                  length
+
+// Each record is prefixed with its length as a varint.
+struct VarintFraming {
+  static const bool kStoresLength = true;
+  static const bool kContiguous = false;
+
+  bool Encode(uint64_t /*offset*/, size_t size, uint8_t * buffer,
+      int * prefix_size) const {
+    Varint size_varint(size);
+    *prefix_size = size_varint.ByteSize();
+    size_varint.Write(buffer);
+    return true;
+  }
+
+  int Decode(uint64_t /*offset*/, const void * buffer, size_t * size) const {
+    Varint size_varint;
+    int prefix_size = size_varint.Read(buffer);
+    *size = size_varint.value();
+    return prefix_size;
+  }
+};
+
+// Every record is the same size, so there is no prefix at all.
+struct FixedFraming {
+  static const bool kStoresLength = false;
+  static const bool kContiguous = false;
+
+  explicit FixedFraming(size_t record_size) : record_size(record_size) { }
+
+  bool Encode(uint64_t /*offset*/, size_t size, uint8_t * /*buffer*/,
+      int * prefix_size) const {
+    *prefix_size = 0;
+    return size == record_size;
+  }
+
+  int Decode(uint64_t /*offset*/, const void * /*buffer*/,
+      size_t * size) const {
+    *size = record_size;
+    return 0;
+  }
+
+  size_t record_size;
+};
+
+// Like VarintFraming, but a record that would wrap around the end of the
+// data area starts at offset 0 instead, and a single zero byte marks the
+// rest of the data area as unused. Lengths are stored plus one so that no
+// prefix starts with a zero byte. With an `alignment` above 1 (a power of
+// two up to kMaxAlignment), zero bytes follow the length up to the next
+// multiple of it, so that the record itself is aligned.
+struct ContiguousFraming {
+  static const bool kStoresLength = true;
+  static const bool kContiguous = true;
+
+  explicit ContiguousFraming(size_t alignment = 1) : alignment(alignment) { }
+
+  bool Encode(uint64_t offset, size_t size, uint8_t * buffer,
+      int * prefix_size) const {
+    Varint size_varint(static_cast<uint64_t>(size) + 1);
+    int length_size = size_varint.ByteSize();
+    size_varint.Write(buffer);
+    int padding = Padding(offset + length_size);
+    memset(buffer + length_size, 0, padding);
+    *prefix_size = length_size + padding;
+    return true;
+  }
+
+  int Decode(uint64_t offset, const void * buffer, size_t * size) const {
+    Varint size_varint;
+    int length_size = size_varint.Read(buffer);
+    if (size_varint.value() == 0) {
+      *size = kSkipMarker;
+      return length_size;
+    }
+    *size = size_varint.value() - 1;
+    return length_size + Padding(offset + length_size);
+  }
+
+  // The bytes from `offset` up to the next multiple of the alignment.
+  int Padding(uint64_t offset) const {
+    return static_cast<int>((0 - offset) & (alignment - 1));
+  }
+
+  size_t alignment;
+};
+
+#endif  // RECORD_FRAMING_H_
@@ -0,0 +1,313 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "ring_set.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+RingSet::RingSet()
+  : error_(0),
+    manifest_fd_(-1),
+    manifest_(NULL),
+    manifest_size_(0),
+    pending_(NULL) {
+}
+
+RingSet::~RingSet() {
+  Close();
+}
+
+std::string RingSet::ManifestPath(const std::string & path) {
+  return path + "/manifest";
+}
+
+std::string RingSet::ShardPath(const std::string & path, int shard) {
+  char name[32];
+  snprintf(name, sizeof(name), "/shard-%03d", shard);
+  return path + name;
+}
+
+bool RingSet::IsRingSet(const std::string & path) {
+  struct stat stat_buffer;
+  if (stat(path.c_str(), &stat_buffer) == -1 ||
+      !S_ISDIR(stat_buffer.st_mode)) {
+    return false;
+  }
+  return stat(ManifestPath(path).c_str(), &stat_buffer) == 0;
+}
+
+size_t RingSet::ManifestSize(uint32_t shard_count) {
+  return sizeof(RingSetManifest) + shard_count * sizeof(uint64_t);
+}
+
+bool RingSet::MapManifest(size_t size, Ringfile::Mode mode) {
+  manifest_ = reinterpret_cast<RingSetManifest *>(mmap(0, size,
+    mode == Ringfile::kRead ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED,
+    manifest_fd_, 0));
+  if (manifest_ == MAP_FAILED) {
+    manifest_ = NULL;
+    error_ = errno;
+    return false;
+  }
+  manifest_size_ = size;
+  pending_ = reinterpret_cast<uint64_t *>(manifest_ + 1);
+  return true;
+}
+
+bool RingSet::Create(const std::string & path, int shard_count,
+    size_t shard_size) {
+  if (shard_count <= 0) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  if (mkdir(path.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)
+      == -1) {
+    error_ = errno;
+    return false;
+  }
+
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+  manifest_fd_ = open(ManifestPath(path).c_str(), O_RDWR|O_CREAT|O_EXCL, mode);
+  if (manifest_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (ftruncate(manifest_fd_, ManifestSize(shard_count)) == -1) {
+    error_ = errno;
+    Close();
+    return false;
+  }
+  if (!MapManifest(ManifestSize(shard_count), Ringfile::kAppend)) {
+    Close();
+    return false;
+  }
+
+  for (int shard = 0; shard < shard_count; ++shard) {
+    Ringfile * ringfile = new Ringfile();
+    shards_.push_back(ringfile);
+    if (!ringfile->Create(ShardPath(path, shard), shard_size)) {
+      error_ = ringfile->error();
+      Close();
+      return false;
+    }
+    pending_[shard] = kNoWrite;
+  }
+
+  // The magic number is written last so that a partially created set is
+  // never mistaken for a valid one.
+  manifest_->shard_count = shard_count;
+  manifest_->next_sequence = 0;
+  manifest_->magic = kMagic;
+  return true;
+}
+
+bool RingSet::Open(const std::string & path, Ringfile::Mode mode) {
+  manifest_fd_ = open(ManifestPath(path).c_str(),
+    mode == Ringfile::kRead ? O_RDONLY : O_RDWR);
+  if (manifest_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+
+  struct stat stat_buffer;
+  if (fstat(manifest_fd_, &stat_buffer) == -1) {
+    error_ = errno;
+    Close();
+    return false;
+  }
+  if (stat_buffer.st_size < static_cast<off_t>(sizeof(*manifest_))) {
+    error_ = EINVAL;
+    Close();
+    return false;
+  }
+
+  if (!MapManifest(stat_buffer.st_size, mode)) {
+    Close();
+    return false;
+  }
+  if (manifest_->magic != kMagic || manifest_->shard_count == 0) {
+    error_ = EINVAL;  // invalid magic number
+    Close();
+    return false;
+  }
+  if (manifest_size_ < ManifestSize(manifest_->shard_count)) {
+    error_ = EINVAL;  // truncated manifest
+    Close();
+    return false;
+  }
+
+  for (uint32_t shard = 0; shard < manifest_->shard_count; ++shard) {
+    Ringfile * ringfile = new Ringfile();
+    shards_.push_back(ringfile);
+    if (!ringfile->Open(ShardPath(path, shard), mode)) {
+      error_ = ringfile->error();
+      Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RingSet::Write(int shard, const void * ptr, size_t size) {
+  if (shard < 0 || shard >= shard_count()) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  // The sequence counter is the only state shared between writers. It lives
+  // in the shared mapping of the manifest so that it is also global across
+  // processes. The write is marked in progress before the sequence number is
+  // taken, with a number no greater than the one it will get, so that a
+  // reader that sees no write in progress knows any number it has seen taken
+  // is published.
+  __atomic_store_n(&pending_[shard],
+    __atomic_load_n(&manifest_->next_sequence, __ATOMIC_SEQ_CST),
+    __ATOMIC_SEQ_CST);
+  uint64_t sequence = __sync_fetch_and_add(&manifest_->next_sequence, 1);
+  __atomic_store_n(&pending_[shard], sequence, __ATOMIC_SEQ_CST);
+
+  Ringfile * ringfile = shards_[shard];
+  bool ok = ringfile->StreamingWriteStart(kSequenceSize + size) &&
+    ringfile->StreamingWrite(&sequence, kSequenceSize) &&
+    ringfile->StreamingWrite(ptr, size) &&
+    ringfile->StreamingWriteFinish();
+  __atomic_store_n(&pending_[shard], kNoWrite, __ATOMIC_SEQ_CST);
+  if (!ok) {
+    error_ = ringfile->error();
+    return false;
+  }
+  return true;
+}
+
+bool RingSet::FillHead(int shard) {
+  Ringfile * ringfile = shards_[shard];
+  size_t size;
+  if (!ringfile->NextRecordSize(&size)) {
+    return true;  // no more records in this shard (for now)
+  }
+  if (size < kSequenceSize) {
+    error_ = EINVAL;  // corrupt record
+    return false;
+  }
+
+  Head & head = heads_[shard];
+  head.record.resize(size);
+  if (!ringfile->Read(const_cast<char *>(head.record.data()), size)) {
+    error_ = ringfile->error();
+    return false;
+  }
+  memcpy(&head.sequence, head.record.data(), kSequenceSize);
+  head.loaded = true;
+
+  heap_.push_back(shard);
+  std::push_heap(heap_.begin(), heap_.end(), HeadGreater(&heads_));
+  return true;
+}
+
+bool RingSet::EndOfFile() {
+  heads_.resize(shards_.size());
+
+  // Note what was taken and what is still being written before looking at
+  // the shards. A sequence number taken before this whose write is not in
+  // progress is published, so the poll below finds it.
+  uint64_t next_sequence = __atomic_load_n(&manifest_->next_sequence,
+    __ATOMIC_SEQ_CST);
+  uint64_t oldest_pending = kNoWrite;
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    oldest_pending = std::min(oldest_pending,
+      __atomic_load_n(&pending_[shard], __ATOMIC_SEQ_CST));
+  }
+
+  // Poll the shards that were drained by a previous read for new records.
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!heads_[shard].loaded && !FillHead(shard)) {
+      return true;
+    }
+  }
+  if (heap_.empty()) {
+    return true;
+  }
+
+  // Hold back a record that a write still in progress, or one started
+  // after the counter was read, might come before.
+  uint64_t sequence = heads_[heap_.front()].sequence;
+  return sequence >= next_sequence || sequence > oldest_pending;
+}
+
+bool RingSet::NextRecordSize(size_t * size) {
+  if (EndOfFile()) {
+    return false;
+  }
+  *size = heads_[heap_.front()].record.size() - kSequenceSize;
+  return true;
+}
+
+bool RingSet::Read(void * ptr, size_t size) {
+  if (EndOfFile()) {
+    return false;
+  }
+
+  int shard = heap_.front();
+  const std::string & record = heads_[shard].record;
+  if (record.size() - kSequenceSize > size) {
+    error_ = ENOBUFS;
+    return false;
+  }
+  memcpy(ptr, record.data() + kSequenceSize, record.size() - kSequenceSize);
+
+  std::pop_heap(heap_.begin(), heap_.end(), HeadGreater(&heads_));
+  heap_.pop_back();
+  heads_[shard].loaded = false;
+  return FillHead(shard);
+}
+
+bool RingSet::Close() {
+  for (std::vector<Ringfile *>::iterator shard = shards_.begin();
+      shard != shards_.end(); ++shard) {
+    delete *shard;
+  }
+  shards_.clear();
+  heads_.clear();
+  heap_.clear();
+
+  if (manifest_) {
+    munmap(manifest_, manifest_size_);
+    manifest_ = NULL;
+    pending_ = NULL;
+  }
+  if (manifest_fd_ != -1) {
+    close(manifest_fd_);
+    manifest_fd_ = -1;
+  }
+  return true;
+}
+
+size_t RingSet::bytes_max() const {
+  size_t total = 0;
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    total += shards_[shard]->bytes_max();
+  }
+  return total;
+}
+
+size_t RingSet::bytes_used() const {
+  size_t total = 0;
+  for (size_t shard = 0; shard < shards_.size(); ++shard) {
+    total += shards_[shard]->bytes_used();
+  }
+  return total;
+}
+
+size_t RingSet::bytes_available() const {
+  return bytes_max() - bytes_used();
+}
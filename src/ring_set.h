@@ -0,0 +1,119 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef RING_SET_H_
+#define RING_SET_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "ringfile_internal.h"
+
+#pragma pack(push, 1)
+struct RingSetManifest {
+  uint32_t magic;
+  uint32_t shard_count;
+  uint64_t next_sequence;
+  // Followed by a uint64_t per shard holding the sequence number of the
+  // write in progress on that shard, or RingSet::kNoWrite.
+};
+#pragma pack(pop)
+
+// A RingSet is a directory containing a manifest and a number of shard
+// ringfiles. Each shard is intended to be written by a single thread (or CPU)
+// so that appends never contend with each other. Every record is prefixed
+// with a global sequence number taken from the manifest, which allows a
+// reader to merge the shards back into the order in which they were written.
+//
+// A writer takes its sequence number before its record is published, so a
+// later sequence number can reach one shard before an earlier one reaches
+// another. Each writer notes the sequence number of its write in progress in
+// the manifest, and a reader holds back any record that such a write could
+// still come before. A writer that dies in the middle of a write stalls
+// readers at that point.
+//
+// Directory layout:
+//
+//   path/manifest    RingSetManifest
+//   path/shard-000   a regular ringfile
+//   path/shard-001   ...
+//
+class RingSet {
+ public:
+  RingSet();
+  ~RingSet();
+
+  static const uint32_t kMagic = 'TESR';
+  static const size_t kSequenceSize = sizeof(uint64_t);
+  static const uint64_t kNoWrite = ~static_cast<uint64_t>(0);
+
+  // Returns true if `path` looks like a ring set directory.
+  static bool IsRingSet(const std::string & path);
+
+  // Create a new ring set of `shard_count` shards, each of `shard_size` bytes.
+  // `path` must not exist.
+  bool Create(const std::string & path, int shard_count, size_t shard_size);
+  bool Open(const std::string & path, Ringfile::Mode mode);
+
+  // Append a record to `shard`. A shard must only be written by one thread at
+  // a time, but distinct shards may be written concurrently.
+  bool Write(int shard, const void * ptr, size_t size);
+
+  // Functions that read the merged stream of records from all the shards in
+  // sequence order.
+  bool Read(void * ptr, size_t size);
+  bool NextRecordSize(size_t * size);
+  bool EndOfFile();
+
+  bool Close();
+
+  int error() { return error_; }
+  int shard_count() const { return shards_.size(); }
+  size_t bytes_max() const;
+  size_t bytes_used() const;
+  size_t bytes_available() const;
+
+ private:
+  static std::string ManifestPath(const std::string & path);
+  static std::string ShardPath(const std::string & path, int shard);
+  static size_t ManifestSize(uint32_t shard_count);
+
+  bool MapManifest(size_t size, Ringfile::Mode mode);
+
+  // Read the next record of `shard` into heads_[shard] and add it to the
+  // merge heap. Does nothing if the shard has no more records.
+  bool FillHead(int shard);
+
+  struct Head {
+    Head() : loaded(false) {}
+
+    bool loaded;
+    uint64_t sequence;
+    std::string record;
+  };
+
+  // Ordering for the merge heap, which holds shard indexes with the smallest
+  // pending sequence number on top.
+  struct HeadGreater {
+    explicit HeadGreater(const std::vector<Head> * heads) : heads_(heads) {}
+    bool operator()(int a, int b) const {
+      return (*heads_)[a].sequence > (*heads_)[b].sequence;
+    }
+    const std::vector<Head> * heads_;
+  };
+
+  int error_;
+  int manifest_fd_;
+  RingSetManifest * manifest_;
+  size_t manifest_size_;
+  // The sequence numbers of the writes in progress, after the manifest.
+  uint64_t * pending_;
+  std::vector<Ringfile *> shards_;
+  std::vector<Head> heads_;
+  std::vector<int> heap_;
+};
+
+#endif  // RING_SET_H_
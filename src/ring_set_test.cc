@@ -0,0 +1,180 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include <errno.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ring_set.h"
+#include "test_util.h"
+
+TEST(RingSetTest, CannotOpenBogusPath) {
+  std::string path = TempDir() + "/does not exist/set";
+  RingSet ring_set;
+  ASSERT_FALSE(ring_set.Create(path, 4, 1024));
+  ASSERT_EQ(ENOENT, ring_set.error());
+  ASSERT_FALSE(RingSet::IsRingSet(path));
+
+  path = TempDir();
+  ASSERT_FALSE(RingSet::IsRingSet(path));
+  ASSERT_FALSE(ring_set.Open(path, Ringfile::kRead));
+}
+
+TEST(RingSetTest, MergesShardsInWriteOrder) {
+  std::string path = TempDir() + "/set";
+
+  {
+    RingSet ring_set;
+    ASSERT_TRUE(ring_set.Create(path, 3, 1024));
+    ASSERT_TRUE(RingSet::IsRingSet(path));
+    EXPECT_EQ(3, ring_set.shard_count());
+
+    int shards[] = {2, 0, 0, 1, 2, 1};
+    for (int i = 0; i < 6; ++i) {
+      char message[16];
+      snprintf(message, sizeof(message), "message %d", i);
+      ASSERT_TRUE(ring_set.Write(shards[i], message, strlen(message)));
+    }
+    ASSERT_FALSE(ring_set.Write(3, "x", 1));
+  }
+
+  {
+    RingSet ring_set;
+    ASSERT_TRUE(ring_set.Open(path, Ringfile::kRead));
+    for (int i = 0; i < 6; ++i) {
+      size_t size;
+      ASSERT_TRUE(ring_set.NextRecordSize(&size));
+
+      std::string buffer;
+      buffer.resize(size);
+      ASSERT_TRUE(ring_set.Read(const_cast<char *>(buffer.c_str()), size));
+
+      char message[16];
+      snprintf(message, sizeof(message), "message %d", i);
+      EXPECT_EQ(message, buffer);
+    }
+    EXPECT_TRUE(ring_set.EndOfFile());
+  }
+}
+
+namespace {
+
+std::string ReadRecord(RingSet * ring_set) {
+  size_t size;
+  if (!ring_set->NextRecordSize(&size)) {
+    return "";
+  }
+  std::string buffer;
+  buffer.resize(size);
+  if (!ring_set->Read(const_cast<char *>(buffer.c_str()), size)) {
+    return "";
+  }
+  return buffer;
+}
+
+}  // anonymous namespace
+
+TEST(RingSetTest, HoldsBackRecordsBehindWritesInProgress) {
+  std::string path = TempDir() + "/set";
+
+  RingSet writer;
+  ASSERT_TRUE(writer.Create(path, 2, 1024));
+  int fd = open((path + "/manifest").c_str(), O_RDWR);
+  ASSERT_NE(-1, fd);
+  size_t size = sizeof(RingSetManifest) + 2 * sizeof(uint64_t);
+  void * map = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  ASSERT_NE(MAP_FAILED, map);
+  RingSetManifest * manifest = reinterpret_cast<RingSetManifest *>(map);
+  uint64_t * pending = reinterpret_cast<uint64_t *>(manifest + 1);
+
+  // Shard 1 takes the second sequence number and has not finished writing
+  // when shard 0 writes the third.
+  ASSERT_TRUE(writer.Write(0, "first", 5));
+  pending[1] = manifest->next_sequence++;
+  ASSERT_TRUE(writer.Write(0, "third", 5));
+
+  RingSet reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ("first", ReadRecord(&reader));
+  EXPECT_TRUE(reader.EndOfFile());
+
+  // The write never finished, so there is nothing to wait for.
+  pending[1] = RingSet::kNoWrite;
+  EXPECT_FALSE(reader.EndOfFile());
+  EXPECT_EQ("third", ReadRecord(&reader));
+  EXPECT_TRUE(reader.EndOfFile());
+
+  munmap(map, size);
+  close(fd);
+}
+
+namespace {
+
+struct WriterArgs {
+  RingSet * ring_set;
+  int shard;
+  int count;
+};
+
+void * WriterThread(void * arg) {
+  WriterArgs * args = reinterpret_cast<WriterArgs *>(arg);
+  for (int i = 0; i < args->count; ++i) {
+    char message[32];
+    snprintf(message, sizeof(message), "%d:%d", args->shard, i);
+    if (!args->ring_set->Write(args->shard, message, strlen(message))) {
+      return arg;
+    }
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST(RingSetTest, ConcurrentWritersMergeInOrder) {
+  std::string path = TempDir() + "/set";
+  const int kShards = 4;
+  const int kRecords = 500;
+
+  RingSet writer;
+  ASSERT_TRUE(writer.Create(path, kShards, 64 * 1024));
+
+  pthread_t threads[kShards];
+  WriterArgs args[kShards];
+  for (int shard = 0; shard < kShards; ++shard) {
+    args[shard].ring_set = &writer;
+    args[shard].shard = shard;
+    args[shard].count = kRecords;
+    ASSERT_EQ(0, pthread_create(&threads[shard], NULL, &WriterThread,
+      &args[shard]));
+  }
+  for (int shard = 0; shard < kShards; ++shard) {
+    void * rv;
+    pthread_join(threads[shard], &rv);
+    EXPECT_EQ(NULL, rv);
+  }
+
+  // Records from each shard come out in their original order, and every
+  // record is present exactly once.
+  RingSet reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  int next[kShards] = {0};
+  int total = 0;
+  while (!reader.EndOfFile()) {
+    size_t size;
+    ASSERT_TRUE(reader.NextRecordSize(&size));
+    std::string buffer;
+    buffer.resize(size);
+    ASSERT_TRUE(reader.Read(const_cast<char *>(buffer.c_str()), size));
+
+    int shard, i;
+    ASSERT_EQ(2, sscanf(buffer.c_str(), "%d:%d", &shard, &i));
+    EXPECT_EQ(next[shard], i);
+    next[shard] = i + 1;
+    ++total;
+  }
+  EXPECT_EQ(kShards * kRecords, total);
+}
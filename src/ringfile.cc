@@ -6,18 +6,167 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#endif
+
+#include <algorithm>
+
+#include "crc32.h"
+#include "direct_io.h"
+#include "record_framing.h"
+#include "uring_writer.h"
 #include "varint.h"
 
+// The state shared between a writer and its reclaimer thread.
+struct Reclaimer {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+  size_t headroom;
+  // Set by the writer when the headroom runs low.
+  bool requested;
+  bool stopping;
+  // The last error the thread ran into, kept apart from the writer's until
+  // the writer picks it up.
+  int error;
+};
+
+namespace {
+
+// Holds the mutex of a reclaimer, if there is one, for as long as it is in
+// scope.
+class ReclaimerLock {
+ public:
+  explicit ReclaimerLock(Reclaimer * reclaimer) : reclaimer_(reclaimer) {
+    if (reclaimer_) {
+      pthread_mutex_lock(&reclaimer_->mutex);
+    }
+  }
+  ~ReclaimerLock() {
+    if (reclaimer_) {
+      pthread_mutex_unlock(&reclaimer_->mutex);
+    }
+  }
+
+ private:
+  Reclaimer * reclaimer_;
+};
+
+// The most ReadBatch() reads from the file at once.
+const size_t kReadBatchChunkSize = 256 * 1024;
+
+// Writers publish the end offset just after the write that wakes up readers,
+// so a reader that wakes up too early polls for it this many times, this many
+// microseconds apart.
+const int kPublishPolls = 100;
+const int kPublishPollInterval = 100;
+
+// MFD_CLOEXEC, for C libraries that do not declare memfd_create().
+const unsigned kMemfdCloexec = 0x0001U;
+
+// WaitForData() checks the header at least this often (ms). Without inotify
+// that is all it does, and with it this catches the end offset being
+// published through the mapping, which inotify never reports.
+const int kWaitPollInterval = 10;
+
+// How Cursor::state is split between the generation and the position.
+const int kCursorGenerationShift = 56;
+const uint64_t kCursorPositionMask = (1ULL << kCursorGenerationShift) - 1;
+
+// Set in CursorTable::ack_sequence by a writer that is waiting for consumers.
+const uint32_t kAckWaiting = 0x80000000U;
+
+uint64_t MonotonicMilliseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+}
+
+// Microseconds since the epoch, for block timestamps.
+uint64_t TimestampMicroseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// Sleep until `*word` is woken with FutexWake(), if it still holds `value`,
+// for at most `timeout_ms` milliseconds (forever if negative). The word may
+// be in a mapping shared with other processes.
+void FutexWait(uint32_t * word, uint32_t value, int timeout_ms) {
+#if defined(__linux__) && defined(SYS_futex)
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, word, FUTEX_WAIT, value,
+    timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+#else
+  if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == value) {
+    usleep(kWaitPollInterval * 1000);
+  }
+#endif
+}
+
+void FutexWake(uint32_t * word) {
+#if defined(__linux__) && defined(SYS_futex)
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+}  // anonymous namespace
+
 Ringfile::Ringfile()
   : fd_(-1),
     fd_is_owned_(false),
+    fd_locked_(false),
+    error_(0),
     header_(NULL),
+    data_offset_(sizeof(Header)),
+    extension_offset_(sizeof(Header)),
+    start_offset_(NULL),
+    end_offset_(NULL),
+    record_size_(0),
+    block_size_(0),
+    contiguous_(false),
+    alignment_(1),
+    block_offset_(0),
+    block_started_(false),
+    read_block_offset_(UINT64_MAX),
+    read_block_end_(0),
+    mode_(kRead),
+    cursor_table_(NULL),
+    cursor_(NULL),
+    cursor_map_(NULL),
+    ack_table_(NULL),
+    bytes_lost_(0),
+    write_timeout_ms_(-1),
+    read_offset_(0),
+    read_position_(0),
+    resize_flags_(0),
+    notify_fd_(-1),
+    uring_(NULL),
+    uring_write_offset_(0),
+    direct_(NULL),
+    direct_write_offset_(0),
+    direct_record_end_(0),
+    prefault_map_(NULL),
+    prefault_size_(0),
+    prefault_locked_(false),
+    reclaimer_(NULL),
     streaming_read_offset_(0),
     streaming_write_offset_(0) {
 }
@@ -26,93 +175,443 @@ Ringfile::~Ringfile() {
   Close();
 }
 
-bool Ringfile::Create(const std::string & path, size_t size) {
+bool Ringfile::Create(const std::string & path, size_t size,
+    const Options & options) {
   mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-  fd_ = open(path.c_str(), O_RDWR|O_CREAT|O_EXCL, mode);
-  if (fd_ == -1) {
+  int fd = open(path.c_str(), O_RDWR|O_CREAT|O_EXCL, mode);
+  if (fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (!CreateFd(fd, size, true, options)) {
+    close(fd);
+    return false;
+  }
+  return true;
+}
+
+bool Ringfile::CreateFd(int fd, size_t size, bool take_ownership,
+    const Options & options) {
+  if (options.header_version != 1 && options.header_version != 2) {
+    error_ = EINVAL;
+    return false;
+  }
+  bool v2 = options.header_version == 2;
+  size_t extension_offset = v2 ? sizeof(HeaderV2) : sizeof(Header);
+  size_t data_offset = extension_offset;
+  if (v2 || options.record_size || options.block_size ||
+      options.cursor_count || options.alignment) {
+    data_offset += sizeof(HeaderExtension);
+    if (options.cursor_count) {
+      data_offset += sizeof(CursorTable) +
+        options.cursor_count * sizeof(Cursor);
+    }
+    if (v2) {
+      data_offset = (data_offset + kHeaderV2Size - 1) / kHeaderV2Size *
+        kHeaderV2Size;
+    }
+    if (size < data_offset + options.record_size + 1) {
+      error_ = EINVAL;  // not even one record fits
+      return false;
+    }
+  }
+  if (options.block_size) {
+    if (options.record_size || options.block_size > UINT32_MAX ||
+        options.block_size <= sizeof(BlockHeader) + 1 ||
+        size < data_offset + 2 * options.block_size) {
+      error_ = EINVAL;  // blocks need room for two of them and a record
+      return false;
+    }
+    // Grow the header so that the data area is a whole number of blocks.
+    data_offset = size -
+      (size - data_offset) / options.block_size * options.block_size;
+  }
+  if ((options.contiguous || options.alignment) &&
+      (options.record_size || options.block_size)) {
+    error_ = EINVAL;  // fixed size records and blocks never wrap anyway
+    return false;
+  }
+  if (options.alignment) {
+    if (options.alignment > kMaxAlignment ||
+        (options.alignment & (options.alignment - 1)) != 0 ||
+        size % options.alignment != 0) {
+      error_ = EINVAL;
+      return false;
+    }
+    data_offset += (0 - data_offset) & (options.alignment - 1);
+    if (size < data_offset + options.alignment) {
+      error_ = EINVAL;
+      return false;
+    }
+  }
+  if (options.queue && !options.cursor_count) {
+    error_ = EINVAL;  // a queue needs cursors to wait for
+    return false;
+  }
+
+  // The descriptor only becomes ours once we succeed.
+  fd_ = fd;
+  fd_is_owned_ = false;
+
+  // Appenders hold a shared lock so that Resize() can tell when it is safe to
+  // move data around.
+  if (flock(fd_, LOCK_SH) == -1) {
     error_ = errno;
+    Close();
     return false;
   }
-  fd_is_owned_ = true;
+  fd_locked_ = true;
 
   if (ftruncate(fd_, size) == -1) {
     error_ = errno;
+    Close();
     return false;
   }
+  if (options.prealloc) {
+    int result = posix_fallocate(fd_, 0, size);
+    if (result != 0) {
+      error_ = result;
+      Close();
+      return false;
+    }
+  }
   size_ = size;
 
-  header_ = reinterpret_cast<Header *>(mmap(0, sizeof(*header_),
-    mode == kRead ? 0 : PROT_WRITE, MAP_SHARED, fd_, 0));
-  if (!header_) {
+  header_ = reinterpret_cast<Header *>(mmap(0, data_offset,
+    PROT_READ|PROT_WRITE, MAP_SHARED, fd_, 0));
+  if (header_ == MAP_FAILED) {
+    header_ = NULL;
     error_ = errno;
+    Close();
     return false;
   }
+  data_offset_ = data_offset;
+  extension_offset_ = extension_offset;
 
+  memset(header_, 0, data_offset);
   header_->magic = kMagic;
-  header_->flags = 0;
-  header_->start_offset = 0;
-  header_->end_offset = 0;
-
+  if (v2) {
+    HeaderV2 * header = reinterpret_cast<HeaderV2 *>(header_);
+    header->magic = kMagicV2;
+    header->version = 2;
+    header->extension_offset = extension_offset;
+  }
+  MapOffsets();
+  if (data_offset > sizeof(Header)) {
+    HeaderExtension * extension = reinterpret_cast<HeaderExtension *>(
+      reinterpret_cast<char *>(header_) + extension_offset);
+    extension->data_offset = data_offset;
+    extension->record_size = options.record_size;
+    header_->flags = kFlagExtended;
+    if (options.record_size) {
+      header_->flags |= kFlagFixedRecords;
+    }
+    if (options.block_size) {
+      extension->record_size = options.block_size;
+      header_->flags |= kFlagBlocks;
+    }
+    if (options.cursor_count) {
+      cursor_table_ = reinterpret_cast<CursorTable *>(extension + 1);
+      cursor_table_->cursor_count = options.cursor_count;
+      header_->flags |= kFlagCursors;
+      if (options.queue) {
+        header_->flags |= kFlagQueue;
+      }
+    }
+  }
+  if (options.alignment) {
+    HeaderExtension * extension = reinterpret_cast<HeaderExtension *>(
+      reinterpret_cast<char *>(header_) + extension_offset);
+    extension->record_size = options.alignment;
+    header_->flags |= kFlagAligned;
+  }
+  if (options.contiguous || options.alignment) {
+    header_->flags |= kFlagContiguous;
+  }
+  record_size_ = options.record_size;
+  block_size_ = options.block_size;
+  contiguous_ = options.contiguous || options.alignment;
+  alignment_ = options.alignment ? options.alignment : 1;
+  mode_ = kAppend;
+  read_offset_ = 0;
+  read_position_ = 0;
+
+  fd_is_owned_ = take_ownership;
   return true;
 }
 
 bool Ringfile::Open(const std::string & path, Ringfile::Mode mode) {
+  int fd = -1;
   if (mode == kRead) {
-    fd_ = open(path.c_str(), O_RDONLY);
+    fd = open(path.c_str(), O_RDONLY);
   } else if (mode == kAppend) {
-    fd_ = open(path.c_str(), O_RDWR);
+    fd = open(path.c_str(), O_RDWR);
   }
 
-  if (fd_ == -1) {
+  if (fd == -1) {
     error_ = errno;
     return false;
   }
-  fd_is_owned_ = true;
+  if (!OpenFd(fd, mode, true)) {
+    close(fd);
+    return false;
+  }
+  return true;
+}
 
-  {
-    struct stat stat_buffer;
-    if (fstat(fd_, &stat_buffer) == -1) {
+bool Ringfile::OpenFd(int fd, Ringfile::Mode mode, bool take_ownership) {
+  // The descriptor only becomes ours once we succeed.
+  fd_ = fd;
+  fd_is_owned_ = false;
+
+  if (mode == kAppend) {
+    if (flock(fd_, LOCK_SH) == -1) {
       error_ = errno;
+      Close();
       return false;
     }
-    size_ = stat_buffer.st_size;
+    fd_locked_ = true;
   }
 
   header_ = reinterpret_cast<Header *>(mmap(0, sizeof(*header_),
     mode == kRead ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED, fd_, 0));
-  if (!header_) {
+  if (header_ == MAP_FAILED) {
+    header_ = NULL;
     error_ = errno;
     Close();
     return false;
   }
 
-  if (header_->magic != kMagic) {
+  if (header_->magic == kMagicV2) {
+    // Later versions of the header would have a different magic number.
+    HeaderV2 * header = reinterpret_cast<HeaderV2 *>(header_);
+    extension_offset_ = header->extension_offset;
+    if (header->version != 2 || !(header_->flags & kFlagExtended) ||
+        extension_offset_ < sizeof(HeaderV2)) {
+      Close();
+      error_ = EINVAL;  // corrupt header
+      return false;
+    }
+  } else if (header_->magic != kMagic) {
     Close();
     error_ = EINVAL;  // invalid magic number
     return false;
   }
 
-  read_offset_ = header_->start_offset;
+  if (header_->flags & kFlagExtended) {
+    HeaderExtension extension;
+    if (pread(fd_, &extension, sizeof(extension), extension_offset_) !=
+        static_cast<ssize_t>(sizeof(extension)) ||
+        extension.data_offset < extension_offset_ + sizeof(extension)) {
+      Close();
+      error_ = EINVAL;  // truncated or corrupt header
+      return false;
+    }
+
+    // Map the rest of the header.
+    munmap(header_, sizeof(Header));
+    header_ = reinterpret_cast<Header *>(mmap(0, extension.data_offset,
+      mode == kRead ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED, fd_, 0));
+    if (header_ == MAP_FAILED) {
+      header_ = NULL;
+      error_ = errno;
+      Close();
+      return false;
+    }
+    data_offset_ = extension.data_offset;
+    if (header_->flags & kFlagFixedRecords) {
+      record_size_ = extension.record_size;
+    }
+    if (header_->flags & kFlagBlocks) {
+      block_size_ = extension.record_size;
+    }
+    if (header_->flags & kFlagAligned) {
+      alignment_ = extension.record_size;
+      if (alignment_ == 0 || alignment_ > kMaxAlignment ||
+          (alignment_ & (alignment_ - 1)) != 0 ||
+          data_offset_ % alignment_ != 0) {
+        Close();
+        error_ = EINVAL;  // not an alignment we can honour
+        return false;
+      }
+    }
+    if (header_->flags & kFlagCursors) {
+      size_t table_offset = extension_offset_ + sizeof(HeaderExtension);
+      cursor_table_ = reinterpret_cast<CursorTable *>(
+        reinterpret_cast<char *>(header_) + table_offset);
+      if (data_offset_ < table_offset + sizeof(CursorTable) ||
+          data_offset_ < table_offset + sizeof(CursorTable) +
+            cursor_table_->cursor_count * sizeof(Cursor)) {
+        Close();
+        error_ = EINVAL;  // the cursor table does not fit in the header
+        return false;
+      }
+    }
+  }
+  MapOffsets();
+  contiguous_ = (header_->flags & kFlagContiguous) != 0;
+  mode_ = mode;
+
+  // Read the size of the file in a way that cannot be confused by a resize
+  // happening at the same time.
+  while (true) {
+    WaitForResize();
+    resize_flags_ = __atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE) &
+      kResizeMask;
+
+    struct stat stat_buffer;
+    if (fstat(fd_, &stat_buffer) == -1) {
+      error_ = errno;
+      Close();
+      return false;
+    }
+    size_ = stat_buffer.st_size;
+
+    if ((__atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE) & kResizeMask) ==
+        resize_flags_) {
+      break;
+    }
+  }
+
+  if (block_size_ && (block_size_ <= sizeof(BlockHeader) + 1 ||
+      bytes_max() % block_size_ != 0)) {
+    Close();
+    error_ = EINVAL;  // the data area is not made of blocks
+    return false;
+  }
+  if (block_size_ && mode == kAppend && !LoadBlock()) {
+    int error = error_;
+    Close();
+    error_ = error;
+    return false;
+  }
+
+  read_offset_ = *start_offset_;
+  ResetReadPosition();
+  fd_is_owned_ = take_ownership;
   return true;
 }
 
-bool Ringfile::SeekToOffset(uint64_t offset) {
-  assert(offset < bytes_max()); // DO NOT COMMIT
-  offset %= bytes_max();
-  if (lseek(fd_, sizeof(Header) + offset, SEEK_SET) == -1) {
+bool Ringfile::CreateShm(const char * name, size_t size,
+    const Options & options) {
+  int fd;
+  if (name) {
+    fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL,
+      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  } else {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = syscall(SYS_memfd_create, "ringfile", kMemfdCloexec);
+#else
+    fd = -1;
+    errno = ENOSYS;
+#endif
+  }
+  if (fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (!CreateFd(fd, size, true, options)) {
+    close(fd);
+    if (name) {
+      shm_unlink(name);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool Ringfile::OpenShm(const char * name, Ringfile::Mode mode) {
+  int fd = shm_open(name, mode == kRead ? O_RDONLY : O_RDWR, 0);
+  if (fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (!OpenFd(fd, mode, true)) {
+    close(fd);
+    return false;
+  }
+  return true;
+}
+
+void Ringfile::MapOffsets() {
+  if (header_->magic == kMagicV2) {
+    HeaderV2 * header = reinterpret_cast<HeaderV2 *>(header_);
+    start_offset_ = &header->start_offset;
+    end_offset_ = &header->end_offset;
+  } else {
+    start_offset_ = &header_->start_offset;
+    end_offset_ = &header_->end_offset;
+  }
+}
+
+int Ringfile::header_version() const {
+  return header_ && header_->magic == kMagicV2 ? 2 : 1;
+}
+
+void Ringfile::WaitForResize() {
+  while (__atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE) & kFlagResizing) {
+    usleep(1000);
+  }
+}
+
+bool Ringfile::CheckResize() {
+  uint32_t flags = __atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE);
+  if ((flags & kResizeMask) == resize_flags_) {
+    return true;
+  }
+
+  WaitForResize();
+  flags = __atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE);
+
+  struct stat stat_buffer;
+  if (fstat(fd_, &stat_buffer) == -1) {
     error_ = errno;
     return false;
   }
+  size_t old_bytes_max = bytes_max();
+  size_ = stat_buffer.st_size;
+
+  // After a single grow the only data that moved is the part that had wrapped
+  // around to the start of the file, which was shifted up to follow the old
+  // end of the file. In every other case start over from the oldest record.
+  uint32_t generations = ((flags & kResizeMask) - resize_flags_) &
+    kResizeGenerationMask;
+  uint64_t start_offset = *start_offset_;
+  if (generations == kResizeGenerationUnit && bytes_max() > old_bytes_max) {
+    if (contiguous_) {
+      // In a contiguous file it is the records from the start offset to the
+      // old end of the file that moved up to the new end instead.
+      uint64_t shift = bytes_max() - old_bytes_max;
+      if (read_offset_ > *end_offset_ &&
+          read_offset_ + shift >= start_offset) {
+        read_offset_ += shift;
+      }
+    } else if (read_offset_ < start_offset) {
+      read_offset_ = (old_bytes_max + read_offset_) % bytes_max();
+    }
+  } else {
+    read_offset_ = start_offset;
+  }
+
+  resize_flags_ = flags & kResizeMask;
+  ResetReadPosition();
+  read_block_offset_ = UINT64_MAX;
+  if (direct_) {
+    direct_->Invalidate();
+  }
+  if (prefault_map_ && prefault_size_ != size_) {
+    Prefault(prefault_locked_);
+  }
   return true;
 }
 
-bool Ringfile::WrappingRead(uint64_t offset, void * ptr, size_t size) {
+bool Ringfile::WrappingRead(uint64_t offset, void * ptr, size_t size,
+    int * error) {
   offset %= bytes_max();
-  uint64_t end_offset = (offset + size) % bytes_max();
 
   uint64_t end_bytes;
   uint64_t start_bytes;
-  if (offset < end_offset) {
+  if (offset + size <= bytes_max()) {
     // simple case: the whole write is at the end
     end_bytes = size;
     start_bytes = 0;
@@ -122,34 +621,51 @@ bool Ringfile::WrappingRead(uint64_t offset, void * ptr, size_t size) {
     start_bytes = size - end_bytes;
   }
 
-  if (end_bytes) {
-    if (!SeekToOffset(offset)) {
-      return false;
-    }
-    if (read(fd_, ptr, end_bytes) != end_bytes) {
-      return false;
-    }
+  if (end_bytes && !ReadData(offset, ptr, end_bytes, error)) {
+    return false;
+  }
+  if (start_bytes && !ReadData(0, reinterpret_cast<char *>(ptr) + end_bytes,
+      start_bytes, error)) {
+    return false;
   }
+  return true;
+}
 
-  if (start_bytes) {
-    if (!SeekToOffset(0)) {
-      return false;
-    }
-    if (read(fd_, reinterpret_cast<char *>(ptr) + end_bytes,
-        start_bytes) != start_bytes) {
+bool Ringfile::ReadData(uint64_t offset, void * ptr, size_t size,
+    int * error) {
+  if (!error) {
+    error = &error_;
+  }
+  if (direct_) {
+    // The block may go on past the last published record into bytes that
+    // are about to be written, so it is only trusted up to the end offset.
+    uint64_t end_offset = __atomic_load_n(end_offset_,
+      __ATOMIC_ACQUIRE);
+    uint64_t valid_end = end_offset >= offset ? end_offset : bytes_max();
+    if (!direct_->Read(data_offset_ + offset, ptr, size,
+        data_offset_ + valid_end)) {
+      *error = direct_->error();
       return false;
     }
+    return true;
+  }
+
+  // Positioned reads leave the file offset alone, so a descriptor shared
+  // with another process (say across fork()) is safe to use.
+  ssize_t rv = pread(fd_, ptr, size, data_offset_ + offset);
+  if (rv != static_cast<ssize_t>(size)) {
+    *error = rv == -1 ? errno : EIO;
+    return false;
   }
   return true;
 }
 
 bool Ringfile::WrappingWrite(uint64_t offset, const void * ptr, size_t size) {
   offset %= bytes_max();
-  uint64_t end_offset = (offset + size) % bytes_max();
 
   uint64_t end_bytes;
   uint64_t start_bytes;
-  if (offset < end_offset) {
+  if (offset + size <= bytes_max()) {
     // simple case: the whole write is at the end
     end_bytes = size;
     start_bytes = 0;
@@ -160,20 +676,18 @@ bool Ringfile::WrappingWrite(uint64_t offset, const void * ptr, size_t size) {
   }
 
   if (end_bytes) {
-    if (!SeekToOffset(offset)) {
-      return false;
-    }
-    if (write(fd_, ptr, end_bytes) != end_bytes) {
+    ssize_t rv = pwrite(fd_, ptr, end_bytes, data_offset_ + offset);
+    if (rv != static_cast<ssize_t>(end_bytes)) {
+      error_ = rv == -1 ? errno : EIO;
       return false;
     }
   }
 
   if (start_bytes) {
-    if (!SeekToOffset(0)) {
-      return false;
-    }
-    if (write(fd_, reinterpret_cast<const char *>(ptr) + end_bytes,
-        start_bytes) != start_bytes) {
+    ssize_t rv = pwrite(fd_, reinterpret_cast<const char *>(ptr) + end_bytes,
+      start_bytes, data_offset_);
+    if (rv != static_cast<ssize_t>(start_bytes)) {
+      error_ = rv == -1 ? errno : EIO;
       return false;
     }
   }
@@ -181,173 +695,2017 @@ bool Ringfile::WrappingWrite(uint64_t offset, const void * ptr, size_t size) {
   return true;
 }
 
-bool Ringfile::PopRecord() {
-  if (header_->start_offset == header_->end_offset) {
-    // Empty
-    return false;
-  }
-
-  // Read the first record header
+template<class Framing>
+bool Ringfile::ReadPrefix(const Framing & framing, uint64_t offset,
+    int * prefix_size, size_t * size, int * error) {
   uint8_t header_buffer[Varint::kMaxSize];
-  if (!WrappingRead(header_->start_offset, header_buffer, Varint::kMaxSize)) {
+  if (Framing::kStoresLength &&
+      !WrappingRead(offset, header_buffer, Varint::kMaxSize, error)) {
     return false;
   }
-  Varint size_varint;
-  int header_size = size_varint.Read(&header_buffer);
-
-  // Advance the start pointer to the end of the record.
-  header_->start_offset += header_size + size_varint.value();
-  header_->start_offset %= bytes_max();
-
-  // Reset an empty list (optional)
-  //if (header_->start_offset == header_->end_offset) {
-  //  header_->start_offset = 0;
-  //  header_->end_offset = 0;
-  //}
-
+  *prefix_size = framing.Decode(offset, header_buffer, size);
   return true;
 }
 
-bool Ringfile::EndOfFile() {
-  return read_offset_ == header_->end_offset;
-}
-
-bool Ringfile::NextRecordSize(size_t * size) {
-  if (!header_ || fd_ == -1) {
-    return false;
+bool Ringfile::PopRecord(int * error) {
+  if (block_size_) {
+    return PopBlock(error);
   }
-  if (read_offset_ == header_->end_offset) {
-    return false;
+  if (record_size_) {
+    return PopRecord(FixedFraming(record_size_), error);
   }
-
-  uint8_t header_buffer[Varint::kMaxSize];
-  if (!WrappingRead(read_offset_, header_buffer, Varint::kMaxSize)) {
-    return false;
+  if (contiguous_) {
+    return PopRecord(ContiguousFraming(alignment_), error);
   }
-
-  Varint size_varint;
-  int header_size = size_varint.Read(header_buffer);
-  *size = size_varint.value();
-  return true;
+  return PopRecord(VarintFraming(), error);
 }
 
-bool Ringfile::Read(void * buffer, size_t buffer_size) {
-  if (!header_ || fd_ == -1) {
+template<class Framing>
+bool Ringfile::PopRecord(const Framing & framing, int * error) {
+  if (*start_offset_ == *end_offset_) {
+    // Empty
     return false;
   }
 
-  uint8_t header_buffer[Varint::kMaxSize];
-  if (!WrappingRead(read_offset_, header_buffer, Varint::kMaxSize)) {
+  // In a queue the oldest record stays until every consumer has read it.
+  // There is no reclaimer for a queue, so this is always the writer.
+  if ((header_->flags & kFlagQueue) &&
+      !WaitForConsumers(cursor_table_->start_position)) {
     return false;
   }
 
-  Varint size_varint;
-  int header_size = size_varint.Read(header_buffer);
-
-  if (size_varint.value() > buffer_size) {
+  // Read the first record header
+  int header_size;
+  size_t size;
+  if (!ReadPrefix(framing, *start_offset_, &header_size, &size, error)) {
     return false;
   }
 
-  if (!WrappingRead(read_offset_ + header_size, buffer, size_varint.value())) {
-    return false;
+  // A skip marker takes up the rest of the data area.
+  if (Framing::kContiguous && size == kSkipMarker) {
+    header_size = bytes_max() - *start_offset_;
+    size = 0;
   }
-  read_offset_ += header_size + size_varint.value();
-  read_offset_ %= bytes_max();
-  return true;
-}
-
-bool Ringfile::Write(const void * ptr, size_t size) {
-  // Build the header
-  uint8_t header_buffer[Varint::kMaxSize];
-  Varint size_varint(size);
-  int header_size = size_varint.ByteSize();
-  size_varint.Write(&header_buffer);
 
-  // Refuse a record that is too big for the buffer
-  if (bytes_max() < (header_size + size + 1)) {
-    return false;
+  // Advance the start pointer to the end of the record.
+  __atomic_store_n(start_offset_,
+    (*start_offset_ + header_size + size) % bytes_max(),
+    __ATOMIC_RELEASE);
+  if (cursor_table_) {
+    __atomic_store_n(&cursor_table_->start_position,
+      cursor_table_->start_position + header_size + size, __ATOMIC_RELEASE);
   }
 
-  // Pop records until there is enough space available
-  while (bytes_available() < (header_size + size)) {
-    size_t bytes_available_start = bytes_available();
-    if (!PopRecord()) {
-      return false;
-    }
-    assert(bytes_available() > bytes_available_start);
-  }
+  // Reset an empty list (optional)
+  //if (*start_offset_ == *end_offset_) {
+  //  *start_offset_ = 0;
+  //  *end_offset_ = 0;
+  //}
 
+  return true;
+}
 
-  if (!WrappingWrite(header_->end_offset, header_buffer, header_size)) {
+bool Ringfile::PopBlock(int * error) {
+  if (!error) {
+    error = &error_;
+  }
+  uint64_t start_offset = *start_offset_;
+  uint64_t end_offset = *end_offset_;
+  if (start_offset == end_offset) {
+    // Empty
     return false;
   }
-  if (!WrappingWrite(header_->end_offset + header_size, ptr, size)) {
+  if (end_offset - end_offset % block_size_ == start_offset) {
+    *error = ENOSPC;  // the block being written cannot be evicted
     return false;
   }
 
-  header_->end_offset += header_size + size;
-  header_->end_offset %= bytes_max();
+  // In a queue every consumer has to have read the last record of the
+  // block.
+  if (header_->flags & kFlagQueue) {
+    BlockHeader block;
+    if (!WrappingRead(start_offset, &block, sizeof(block)) ||
+        !WaitForConsumers(cursor_table_->start_position +
+          sizeof(BlockHeader) + block.size - 1)) {
+      return false;
+    }
+  }
 
+  __atomic_store_n(start_offset_,
+    (start_offset + block_size_) % bytes_max(), __ATOMIC_RELEASE);
+  if (cursor_table_) {
+    __atomic_store_n(&cursor_table_->start_position,
+      cursor_table_->start_position + block_size_, __ATOMIC_RELEASE);
+  }
   return true;
 }
 
-bool Ringfile::Close() {
-  if (header_) {
-    munmap(header_, sizeof(*header_));
-    header_ = NULL;
-  }
+bool Ringfile::SkipBlockPadding() {
+  uint64_t end_offset = __atomic_load_n(end_offset_,
+    __ATOMIC_ACQUIRE);
+  while (read_offset_ != end_offset) {
+    uint64_t block_offset = read_offset_ - read_offset_ % block_size_;
+    if (read_offset_ == block_offset) {
+      AdvanceReadOffset(read_offset_ + sizeof(BlockHeader));
+    }
+    if (end_offset - end_offset % block_size_ == block_offset) {
+      return true;  // the block being written holds the next record
+    }
 
-  if (fd_ != -1 && fd_is_owned_) {
-    close(fd_);
-    fd_ = -1;
+    // Any other block is full, and its header says where its records end.
+    if (read_block_offset_ != block_offset) {
+      BlockHeader block;
+      if (!WrappingRead(block_offset, &block, sizeof(block))) {
+        return false;
+      }
+      read_block_offset_ = block_offset;
+      read_block_end_ = block_offset + sizeof(BlockHeader) +
+        std::min<uint64_t>(block.size, block_size_ - sizeof(BlockHeader));
+    }
+    if (read_offset_ < read_block_end_) {
+      return true;
+    }
+    AdvanceReadOffset((block_offset + block_size_) % bytes_max());
   }
   return true;
 }
 
-size_t Ringfile::bytes_max() const {
-  return size_ - sizeof(Header);
+void Ringfile::AdvanceReadOffset(uint64_t offset) {
+  offset %= bytes_max();
+  read_position_ += (offset + bytes_max() - read_offset_) % bytes_max();
+  read_offset_ = offset;
 }
 
-size_t Ringfile::bytes_used() const {
-  if (header_->start_offset <= header_->end_offset) {
-    return header_->end_offset - header_->start_offset;
-  } else {
-    return bytes_max() - (header_->start_offset - header_->end_offset);
-  }
+void Ringfile::ResetReadPosition() {
+  uint64_t start_offset = *start_offset_;
+  uint64_t start_position = cursor_table_ ?
+    __atomic_load_n(&cursor_table_->start_position, __ATOMIC_ACQUIRE) :
+    start_offset;
+  read_position_ = start_position +
+    (read_offset_ + bytes_max() - start_offset) % bytes_max();
 }
 
-size_t Ringfile::bytes_available() const {
-  return bytes_max() - bytes_used();
+bool Ringfile::EndOfFile() {
+  CheckResize();
+  uint64_t end_offset = *end_offset_;
+
+  // A writer publishes a skip marker on its own before the record that
+  // follows it, so the unread data can be just the marker.
+  if (contiguous_ && end_offset == 0 && read_offset_ != 0) {
+    uint8_t prefix;
+    if (WrappingRead(read_offset_, &prefix, 1) && prefix == 0 && !Resized()) {
+      AdvanceReadOffset(0);
+    }
+  }
+  return read_offset_ == end_offset;
 }
 
-bool Ringfile::StreamingWriteStart(size_t size) {
-  assert(streaming_write_offset_ == 0);
-
-  // Build the header
-  uint8_t header_buffer[Varint::kMaxSize];
-  Varint size_varint(size);
-  int header_size = size_varint.ByteSize();
-  size_varint.Write(&header_buffer);
+bool Ringfile::Resized() const {
+  return (__atomic_load_n(&header_->flags, __ATOMIC_ACQUIRE) & kResizeMask) !=
+    resize_flags_;
+}
 
-  // Refuse a record that is too big for the buffer
-  if (bytes_max() < (header_size + size + 1)) {
+bool Ringfile::NextRecordSize(size_t * size) {
+  if (!header_ || fd_ == -1) {
     return false;
   }
-
-  // Pop records until there is enough space available
-  while (bytes_available() < (header_size + size)) {
-    size_t bytes_available_start = bytes_available();
+  if (record_size_) {
+    return NextRecordSize(FixedFraming(record_size_), size);
+  }
+  if (contiguous_) {
+    return NextRecordSize(ContiguousFraming(alignment_), size);
+  }
+  return NextRecordSize(VarintFraming(), size);
+}
+
+template<class Framing>
+bool Ringfile::NextRecordSize(const Framing & framing, size_t * size) {
+  while (true) {
+    if (!CheckResize()) {
+      return false;
+    }
+    if (read_offset_ == *end_offset_) {
+      return false;
+    }
+    if (block_size_ && !SkipBlockPadding()) {
+      return false;
+    }
+
+    int header_size;
+    if (!ReadPrefix(framing, read_offset_, &header_size, size)) {
+      return false;
+    }
+    if (Resized()) {
+      continue;  // the data moved while we were reading it
+    }
+    if (Framing::kContiguous && *size == kSkipMarker) {
+      AdvanceReadOffset(0);
+      continue;
+    }
+    return true;
+  }
+}
+
+bool Ringfile::Read(void * buffer, size_t buffer_size) {
+  if (!header_ || fd_ == -1) {
+    return false;
+  }
+  if (record_size_) {
+    return Read(FixedFraming(record_size_), buffer, buffer_size);
+  }
+  if (contiguous_) {
+    return Read(ContiguousFraming(alignment_), buffer, buffer_size);
+  }
+  return Read(VarintFraming(), buffer, buffer_size);
+}
+
+template<class Framing>
+bool Ringfile::Read(const Framing & framing, void * buffer,
+    size_t buffer_size) {
+  while (true) {
+    if (!CheckResize()) {
+      return false;
+    }
+    if (block_size_ && !SkipBlockPadding()) {
+      return false;
+    }
+
+    int header_size;
+    size_t size;
+    if (!ReadPrefix(framing, read_offset_, &header_size, &size)) {
+      return false;
+    }
+    if (Framing::kContiguous && size == kSkipMarker) {
+      if (Resized()) {
+        continue;
+      }
+      AdvanceReadOffset(0);
+      continue;
+    }
+
+    if (size > buffer_size) {
+      if (Resized()) {
+        continue;
+      }
+      return false;
+    }
+
+    if (!WrappingRead(read_offset_ + header_size, buffer, size)) {
+      return false;
+    }
+    if (Resized()) {
+      continue;  // the data moved while we were reading it
+    }
+
+    AdvanceReadOffset(read_offset_ + header_size + size);
+    return true;
+  }
+}
+
+bool Ringfile::VisitRecords(size_t max_records, RecordVisitor visitor,
+    void * context) {
+  if (!header_ || fd_ == -1) {
+    return false;
+  }
+  if (record_size_) {
+    return VisitRecords(FixedFraming(record_size_), max_records, visitor,
+      context);
+  }
+  if (contiguous_) {
+    return VisitRecords(ContiguousFraming(alignment_), max_records, visitor,
+      context);
+  }
+  return VisitRecords(VarintFraming(), max_records, visitor, context);
+}
+
+template<class Framing>
+bool Ringfile::VisitRecords(const Framing & framing, size_t max_records,
+    RecordVisitor visitor, void * context) {
+  std::string chunk;
+  size_t count = 0;
+  bool stopped = false;
+  while (!stopped && (max_records == 0 || count < max_records)) {
+    if (!CheckResize()) {
+      return false;
+    }
+    uint64_t end_offset = *end_offset_;
+    if (read_offset_ == end_offset) {
+      break;
+    }
+    if (block_size_ && !SkipBlockPadding()) {
+      return false;
+    }
+
+    // Read as much of the unread data as fits in one chunk, padded so that a
+    // record header at the very end can be decoded safely. A chunk of a
+    // block framed file stops at the end of the records of the block.
+    uint64_t unread = (end_offset + bytes_max() - read_offset_) % bytes_max();
+    if (block_size_ && read_offset_ - read_offset_ % block_size_ ==
+        read_block_offset_) {
+      unread = read_block_end_ - read_offset_;
+    }
+    size_t chunk_size = unread < kReadBatchChunkSize ? unread :
+      kReadBatchChunkSize;
+    chunk.assign(chunk_size + Varint::kMaxSize, '\0');
+    if (!WrappingRead(read_offset_, &chunk[0], chunk_size)) {
+      return false;
+    }
+    if (Resized()) {
+      continue;  // the data moved while we were reading it
+    }
+
+    size_t position = 0;
+    while (position < chunk_size &&
+        (max_records == 0 || count < max_records)) {
+      size_t size;
+      int header_size = framing.Decode((read_offset_ + position) % bytes_max(),
+        &chunk[position], &size);
+      if (Framing::kContiguous && size == kSkipMarker) {
+        // Carry on from the start of the data area.
+        position = bytes_max() - read_offset_;
+        if (position >= chunk_size) {
+          break;
+        }
+        continue;
+      }
+      if (position + header_size + size > chunk_size) {
+        break;
+      }
+      if (!visitor(context, &chunk[position + header_size], size)) {
+        stopped = true;
+        break;
+      }
+      position += header_size + size;
+      ++count;
+    }
+
+    if (position == 0 && !stopped) {
+      // The next record does not fit in a chunk, so read it by itself.
+      size_t size;
+      int header_size = framing.Decode(read_offset_, &chunk[0], &size);
+      std::string record(size, '\0');
+      if (!WrappingRead(read_offset_ + header_size, &record[0],
+          record.size())) {
+        return false;
+      }
+      if (Resized()) {
+        continue;
+      }
+      if (!visitor(context, record.data(), record.size())) {
+        break;
+      }
+      position = header_size + record.size();
+      ++count;
+    }
+    AdvanceReadOffset(read_offset_ + position);
+  }
+  return true;
+}
+
+namespace {
+
+struct AppendContext {
+  std::string * data;
+  std::vector<size_t> * offsets;
+};
+
+bool AppendRecord(void * context, const char * data, size_t size) {
+  AppendContext * append = static_cast<AppendContext *>(context);
+  append->offsets->push_back(append->data->size());
+  append->data->append(data, size);
+  return true;
+}
+
+struct CopyContext {
+  char * buffer;
+  size_t capacity;
+  size_t used;
+  size_t * offsets;
+  size_t count;
+};
+
+bool CopyRecord(void * context, const char * data, size_t size) {
+  CopyContext * copy = static_cast<CopyContext *>(context);
+  if (copy->capacity - copy->used < size) {
+    return false;
+  }
+  memcpy(copy->buffer + copy->used, data, size);
+  copy->offsets[copy->count++] = copy->used;
+  copy->used += size;
+  return true;
+}
+
+struct CallbackContext {
+  Ringfile::RecordCallback callback;
+  void * context;
+  size_t count;
+  bool stopped;
+};
+
+bool CallRecordCallback(void * context, const char * data, size_t size) {
+  CallbackContext * call = static_cast<CallbackContext *>(context);
+  if (call->stopped) {
+    return false;
+  }
+  ++call->count;
+  call->stopped = call->callback(data, size, call->context) != 0;
+  return true;
+}
+
+}  // anonymous namespace
+
+bool Ringfile::ReadBatch(size_t max_records, std::string * data,
+    std::vector<size_t> * offsets) {
+  AppendContext context;
+  context.data = data;
+  context.offsets = offsets;
+  return VisitRecords(max_records, &AppendRecord, &context);
+}
+
+bool Ringfile::ReadBatch(size_t max_records, void * buffer, size_t capacity,
+    size_t * offsets, size_t * count) {
+  *count = 0;
+  offsets[0] = 0;
+  if (max_records == 0) {
+    return true;
+  }
+
+  CopyContext context;
+  context.buffer = static_cast<char *>(buffer);
+  context.capacity = capacity;
+  context.used = 0;
+  context.offsets = offsets;
+  context.count = 0;
+  if (!VisitRecords(max_records, &CopyRecord, &context)) {
+    return false;
+  }
+  if (context.count == 0 && !EndOfFile()) {
+    error_ = EMSGSIZE;  // the next record is bigger than the buffer
+    return false;
+  }
+  offsets[context.count] = context.used;
+  *count = context.count;
+  return true;
+}
+
+bool Ringfile::ForEach(RecordCallback callback, void * context,
+    size_t * count) {
+  CallbackContext call;
+  call.callback = callback;
+  call.context = context;
+  call.count = 0;
+  call.stopped = false;
+  bool ok = VisitRecords(0, &CallRecordCallback, &call);
+  *count = call.count;
+  return ok;
+}
+
+bool Ringfile::SkipRecord(uint64_t * offset, size_t * size) {
+  if (!header_ || fd_ == -1) {
+    return false;
+  }
+  if (record_size_) {
+    return SkipRecord(FixedFraming(record_size_), offset, size);
+  }
+  if (contiguous_) {
+    return SkipRecord(ContiguousFraming(alignment_), offset, size);
+  }
+  return SkipRecord(VarintFraming(), offset, size);
+}
+
+template<class Framing>
+bool Ringfile::SkipRecord(const Framing & framing, uint64_t * offset,
+    size_t * size) {
+  while (true) {
+    if (!CheckResize()) {
+      return false;
+    }
+    if (read_offset_ == *end_offset_) {
+      return false;
+    }
+    if (block_size_ && !SkipBlockPadding()) {
+      return false;
+    }
+
+    int header_size;
+    if (!ReadPrefix(framing, read_offset_, &header_size, size)) {
+      return false;
+    }
+    if (Resized()) {
+      continue;
+    }
+    if (Framing::kContiguous && *size == kSkipMarker) {
+      AdvanceReadOffset(0);
+      continue;
+    }
+
+    *offset = data_offset_ + (read_offset_ + header_size) % bytes_max();
+    AdvanceReadOffset(read_offset_ + header_size + *size);
+    return true;
+  }
+}
+
+bool Ringfile::WatchForData() {
+  if (notify_fd_ != -1) {
+    return true;
+  }
+  if (fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+#ifdef __linux__
+  int notify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (notify_fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  // Watch whatever file our descriptor refers to, however it was opened.
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd_);
+  if (inotify_add_watch(notify_fd, path, IN_MODIFY|IN_ATTRIB) == -1) {
+    error_ = errno;
+    close(notify_fd);
+    return false;
+  }
+  notify_fd_ = notify_fd;
+  return true;
+#else
+  error_ = ENOSYS;
+  return false;
+#endif
+}
+
+bool Ringfile::HandleNotification() {
+  bool notified = false;
+  if (notify_fd_ != -1) {
+    char buffer[4096];
+    while (read(notify_fd_, buffer, sizeof(buffer)) > 0) {
+      notified = true;
+    }
+  }
+  if (!EndOfFile()) {
+    return true;
+  }
+  if (!notified) {
+    return false;
+  }
+
+  // We may have been woken by the write of a record's data before the
+  // writer got to publish it.
+  for (int i = 0; i < kPublishPolls; ++i) {
+    usleep(kPublishPollInterval);
+    if (!EndOfFile()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Ringfile::WaitForData(int timeout_ms) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+
+  bool watching = WatchForData();
+  uint64_t deadline = MonotonicMilliseconds() + timeout_ms;
+  while (true) {
+    if (HandleNotification()) {
+      return true;
+    }
+
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      uint64_t now = MonotonicMilliseconds();
+      if (now >= deadline) {
+        error_ = ETIMEDOUT;
+        return false;
+      }
+      wait_ms = deadline - now;
+    }
+
+    if (wait_ms == -1 || wait_ms > kWaitPollInterval) {
+      wait_ms = kWaitPollInterval;
+    }
+    if (watching) {
+      struct pollfd pfd;
+      pfd.fd = notify_fd_;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, wait_ms) == -1 && errno != EINTR) {
+        error_ = errno;
+        return false;
+      }
+    } else {
+      usleep(wait_ms * 1000);
+    }
+  }
+}
+
+bool Ringfile::EnableUring(unsigned queue_depth, unsigned batch_size) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (uring_) {
+    return true;
+  }
+  if (direct_ || block_size_ || contiguous_) {
+    error_ = EINVAL;  // direct I/O does its own batching
+    return false;
+  }
+
+  UringWriter * uring = new UringWriter();
+  if (!uring->Init(fd_, queue_depth, 1024 * 1024, batch_size)) {
+    error_ = uring->error();
+    delete uring;
+    return false;
+  }
+  uring_ = uring;
+  uring_write_offset_ = *end_offset_;
+  return true;
+}
+
+bool Ringfile::Prefault(bool lock) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+
+  // Replace any earlier mapping, which may be for a different size.
+  if (prefault_map_) {
+    munmap(prefault_map_, prefault_size_);
+    prefault_map_ = NULL;
+  }
+
+  void * map = mmap(0, size_, mode_ == kRead ? PROT_READ : PROT_READ|PROT_WRITE,
+    MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    error_ = errno;
+    return false;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(map, size_, MADV_HUGEPAGE);  // a hint only, so errors do not matter
+#endif
+
+  // mlock() faults every page in itself. Otherwise the kernel is asked to
+  // with MADV_POPULATE_READ, or by touching one byte of each page.
+  if (lock) {
+    if (mlock(map, size_) == -1) {
+      error_ = errno;
+      munmap(map, size_);
+      return false;
+    }
+  } else {
+#ifdef MADV_POPULATE_READ
+    if (madvise(map, size_, MADV_POPULATE_READ) == -1)
+#endif
+    {
+      long page_size = sysconf(_SC_PAGESIZE);
+      volatile const char * bytes = static_cast<const char *>(map);
+      for (size_t i = 0; i < size_; i += page_size) {
+        (void)bytes[i];
+      }
+    }
+  }
+
+  prefault_map_ = map;
+  prefault_size_ = size_;
+  prefault_locked_ = lock;
+  return true;
+}
+
+bool Ringfile::EnableReclaimer(size_t headroom) {
+  if (!header_ || fd_ == -1 || mode_ != kAppend) {
+    error_ = EBADF;
+    return false;
+  }
+  if (reclaimer_) {
+    return true;
+  }
+  if (headroom == 0 || headroom >= bytes_max() ||
+      (header_->flags & kFlagQueue) || direct_) {
+    error_ = EINVAL;  // a queue must wait for its consumers, not evict
+    return false;
+  }
+
+  Reclaimer * reclaimer = new Reclaimer();
+  reclaimer->headroom = headroom;
+  reclaimer->requested = true;  // top up the headroom straight away
+  reclaimer->stopping = false;
+  reclaimer->error = 0;
+  pthread_mutex_init(&reclaimer->mutex, NULL);
+  pthread_cond_init(&reclaimer->condition, NULL);
+  reclaimer_ = reclaimer;
+  int result = pthread_create(&reclaimer->thread, NULL, ReclaimerMain, this);
+  if (result != 0) {
+    reclaimer_ = NULL;
+    pthread_mutex_destroy(&reclaimer->mutex);
+    pthread_cond_destroy(&reclaimer->condition);
+    delete reclaimer;
+    error_ = result;
+    return false;
+  }
+  return true;
+}
+
+void * Ringfile::ReclaimerMain(void * context) {
+  static_cast<Ringfile *>(context)->RunReclaimer();
+  return NULL;
+}
+
+void Ringfile::RunReclaimer() {
+  Reclaimer * reclaimer = reclaimer_;
+  pthread_mutex_lock(&reclaimer->mutex);
+  while (true) {
+    while (!reclaimer->stopping &&
+        !__atomic_load_n(&reclaimer->requested, __ATOMIC_SEQ_CST)) {
+      pthread_cond_wait(&reclaimer->condition, &reclaimer->mutex);
+    }
+    if (reclaimer->stopping) {
+      break;
+    }
+    __atomic_store_n(&reclaimer->requested, false, __ATOMIC_SEQ_CST);
+
+    // Evict one record at a time, letting the writer in between, until the
+    // headroom is free.
+    while (!reclaimer->stopping && bytes_used() != 0 &&
+        bytes_available() < reclaimer->headroom) {
+      int error = 0;
+      if (!PopRecord(&error)) {
+        // The block being written is no error, just all there is to evict.
+        if (error != 0 && error != ENOSPC) {
+          __atomic_store_n(&reclaimer->error, error, __ATOMIC_RELEASE);
+        }
+        break;
+      }
+      pthread_mutex_unlock(&reclaimer->mutex);
+      pthread_mutex_lock(&reclaimer->mutex);
+    }
+  }
+  pthread_mutex_unlock(&reclaimer->mutex);
+}
+
+bool Ringfile::TakeReclaimerError() {
+  if (!reclaimer_ || !__atomic_load_n(&reclaimer_->error, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  error_ = __atomic_exchange_n(&reclaimer_->error, 0, __ATOMIC_ACQ_REL);
+  return true;
+}
+
+bool Ringfile::EnableDirectIO(size_t block_size) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (direct_) {
+    return true;
+  }
+  if (uring_ || reclaimer_ ||
+      ((block_size_ || contiguous_) && mode_ == kAppend)) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  DirectIO * direct = new DirectIO();
+  if (!direct->Init(fd_, mode_ == kAppend, block_size)) {
+    error_ = direct->error();
+    delete direct;
+    return false;
+  }
+  direct_ = direct;
+  return true;
+}
+
+bool Ringfile::StageDirect(const void * ptr, size_t size) {
+  const char * bytes = reinterpret_cast<const char *>(ptr);
+  while (size) {
+    // The block holds a contiguous part of the file, so it is written out
+    // when the data wraps around as well as when it is full.
+    size_t staged = direct_->Stage(data_offset_ + direct_write_offset_, bytes,
+      std::min<uint64_t>(size, bytes_max() - direct_write_offset_));
+    bytes += staged;
+    size -= staged;
+    direct_write_offset_ = (direct_write_offset_ + staged) % bytes_max();
+    if ((direct_->full() || direct_write_offset_ == 0) && !FlushDirect()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Ringfile::FlushDirect() {
+  if (!direct_->Flush()) {
+    error_ = direct_->error();
+    return false;
+  }
+  __atomic_store_n(end_offset_, direct_record_end_,
+    __ATOMIC_RELEASE);
+
+  // Records evicted since the last flush may have been read into the block.
+  direct_->Invalidate();
+  return true;
+}
+
+bool Ringfile::ReapUring(bool wait) {
+  uint64_t end_offset = *end_offset_;
+  if (!uring_->Reap(wait, &end_offset)) {
+    error_ = uring_->error();
+    return false;
+  }
+  __atomic_store_n(end_offset_, end_offset, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Ringfile::Flush() {
+  if (block_started_ && !WriteBlockHeader()) {
+    return false;
+  }
+  if (direct_ && direct_->staged()) {
+    return FlushDirect();
+  }
+  if (!uring_) {
+    return true;
+  }
+  if (!uring_->Submit()) {
+    error_ = uring_->error();
+    return false;
+  }
+  while (uring_->busy()) {
+    if (!ReapUring(true)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<class Framing>
+bool Ringfile::MakeRoom(const Framing & framing, size_t size) {
+  if (TakeReclaimerError()) {
+    return false;
+  }
+
+  // Pop records until there is enough space available. One byte always stays
+  // free, otherwise a full file would look empty.
+  // Space freed by the reclaimer never goes away again, so there is only
+  // something to lock when there is not enough of it.
+  if (bytes_available() <= size) {
+    ReclaimerLock lock(reclaimer_);
+    while (bytes_available() <= size) {
+#ifndef NDEBUG
+      size_t bytes_available_start = bytes_available();
+#endif
+      if (!PopRecord(framing)) {
+        return false;
+      }
+#ifndef NDEBUG
+      assert(bytes_available() > bytes_available_start);
+#endif
+    }
+  }
+
+  // Have the reclaimer top the headroom up again before the next write
+  // needs it.
+  if (reclaimer_ && bytes_available() - size < reclaimer_->headroom &&
+      !__atomic_exchange_n(&reclaimer_->requested, true, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&reclaimer_->mutex);
+    pthread_cond_signal(&reclaimer_->condition);
+    pthread_mutex_unlock(&reclaimer_->mutex);
+  }
+  return true;
+}
+
+template<class Framing>
+bool Ringfile::SkipToStart(const Framing & framing, size_t size,
+    uint8_t * header_buffer, int * header_size) {
+  uint64_t end_offset = *end_offset_;
+  if (!Framing::kContiguous ||
+      end_offset + *header_size + size <= bytes_max()) {
+    return true;
+  }
+
+  // The marker and the padding after it are evicted like a record.
+  if (!MakeRoom(framing, bytes_max() - end_offset)) {
+    return false;
+  }
+  uint8_t marker = 0;
+  if (!WrappingWrite(end_offset, &marker, 1)) {
+    return false;
+  }
+  __atomic_store_n(end_offset_, 0, __ATOMIC_RELEASE);
+
+  // The padding of an aligned record depends on where it starts.
+  framing.Encode(0, size, header_buffer, header_size);
+  return bytes_max() >= *header_size + size + 1;
+}
+
+// Write() for files with EnableUring().
+template<class Framing>
+bool Ringfile::UringWrite(const Framing & framing, const void * ptr,
+    size_t size) {
+  if (!uring_->busy()) {
+    uring_write_offset_ = *end_offset_;
+  }
+
+  uint8_t header_buffer[kMaxPrefixSize];
+  int header_size;
+  if (!framing.Encode(uring_write_offset_, size, header_buffer,
+      &header_size)) {
+    error_ = EINVAL;
+    return false;
+  }
+  uint64_t record_size = header_size + size;
+
+  // Refuse a record that is too big for the buffer
+  if (bytes_max() < (record_size + 1)) {
+    return false;
+  }
+
+  // Pop records until there is enough space available, counting the records
+  // that are still in flight as used.
+  ReclaimerLock lock(reclaimer_);
+  while (true) {
+    uint64_t used = (uring_write_offset_ + bytes_max() -
+      *start_offset_) % bytes_max();
+    if (bytes_max() - used > record_size) {
+      break;
+    }
+
+    // The header of the oldest record can only be read once it has been
+    // written.
+    while (*start_offset_ == *end_offset_ && uring_->busy()) {
+      if (!ReapUring(true)) {
+        return false;
+      }
+    }
+    if (!PopRecord(framing)) {
+      return false;
+    }
+  }
+
+  UringWriter::Piece pieces[2];
+  int piece_count = 1;
+  pieces[0].offset = data_offset_ + uring_write_offset_;
+  pieces[0].size = record_size;
+  if (uring_write_offset_ + record_size > bytes_max()) {
+    pieces[0].size = bytes_max() - uring_write_offset_;
+    pieces[1].offset = data_offset_;
+    pieces[1].size = record_size - pieces[0].size;
+    piece_count = 2;
+  }
+
+  struct iovec data[2];
+  data[0].iov_base = header_buffer;
+  data[0].iov_len = header_size;
+  data[1].iov_base = const_cast<void *>(ptr);
+  data[1].iov_len = size;
+
+  uint64_t end_offset = (uring_write_offset_ + record_size) % bytes_max();
+  while (!uring_->Queue(data, 2, pieces, piece_count, end_offset)) {
+    if (uring_->error() != EAGAIN) {
+      error_ = uring_->error();
+      return false;
+    }
+    if (!ReapUring(true)) {
+      return false;
+    }
+  }
+  uring_write_offset_ = end_offset;
+
+  // Publish whatever has finished without waiting for anything.
+  return ReapUring(false);
+}
+
+// Write() for files with EnableDirectIO().
+template<class Framing>
+bool Ringfile::DirectWrite(const Framing & framing, const void * ptr,
+    size_t size) {
+  if (!direct_->staged()) {
+    direct_write_offset_ = direct_record_end_ = *end_offset_;
+  }
+
+  uint8_t header_buffer[kMaxPrefixSize];
+  int header_size;
+  if (!framing.Encode(direct_write_offset_, size, header_buffer,
+      &header_size)) {
+    error_ = EINVAL;
+    return false;
+  }
+  uint64_t record_size = header_size + size;
+
+  // Refuse a record that is too big for the buffer
+  if (bytes_max() < (record_size + 1)) {
+    return false;
+  }
+
+  // Pop records until there is enough space available, counting the staged
+  // records as used.
+  while (true) {
+    uint64_t used = (direct_write_offset_ + bytes_max() -
+      *start_offset_) % bytes_max();
+    if (bytes_max() - used > record_size) {
+      break;
+    }
+
+    // Staged records can only be evicted once they have been written.
+    if (*start_offset_ == *end_offset_) {
+      if (!FlushDirect()) {
+        return false;
+      }
+      continue;
+    }
+    if (!PopRecord(framing)) {
+      return false;
+    }
+  }
+
+  if (!StageDirect(header_buffer, header_size) || !StageDirect(ptr, size)) {
+    return false;
+  }
+  direct_record_end_ = direct_write_offset_;
+
+  // The block may have been written just as the record was finished.
+  if (!direct_->staged()) {
+    __atomic_store_n(end_offset_, direct_record_end_,
+      __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+bool Ringfile::Write(const void * ptr, size_t size) {
+  if (record_size_) {
+    return Write(FixedFraming(record_size_), ptr, size);
+  }
+  if (contiguous_) {
+    return Write(ContiguousFraming(alignment_), ptr, size);
+  }
+  return Write(VarintFraming(), ptr, size);
+}
+
+template<class Framing>
+bool Ringfile::Write(const Framing & framing, const void * ptr, size_t size) {
+  if (block_size_) {
+    return BlockWrite(ptr, size);
+  }
+  if (uring_) {
+    if (Varint::kMaxSize + size <= uring_->staging_size()) {
+      return UringWrite(framing, ptr, size);
+    }
+    // Records too big to stage are written directly.
+    if (!Flush()) {
+      return false;
+    }
+  }
+  if (direct_) {
+    return DirectWrite(framing, ptr, size);
+  }
+
+  // Build the header
+  uint8_t header_buffer[kMaxPrefixSize];
+  int header_size;
+  if (!framing.Encode(*end_offset_, size, header_buffer,
+      &header_size)) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  // Refuse a record that is too big for the buffer
+  if (bytes_max() < (header_size + size + 1)) {
+    return false;
+  }
+
+  if (!SkipToStart(framing, size, header_buffer, &header_size) ||
+      !MakeRoom(framing, header_size + size)) {
+    return false;
+  }
+
+
+  if (!WrappingWrite(*end_offset_, header_buffer, header_size)) {
+    return false;
+  }
+  if (!WrappingWrite(*end_offset_ + header_size, ptr, size)) {
+    return false;
+  }
+
+  __atomic_store_n(end_offset_,
+    (*end_offset_ + header_size + size) % bytes_max(),
+    __ATOMIC_RELEASE);
+
+  return true;
+}
+
+bool Ringfile::BlockWrite(const void * ptr, size_t size) {
+  uint8_t header_buffer[kMaxPrefixSize];
+  int header_size;
+  VarintFraming().Encode(0, size, header_buffer, &header_size);
+  uint64_t record_size = header_size + size;
+
+  // The last byte of a block stays free, so that the end offset never
+  // points at the start of the next block.
+  if (sizeof(BlockHeader) + record_size >= block_size_) {
+    error_ = EMSGSIZE;
+    return false;
+  }
+  if (!block_started_ ||
+      sizeof(BlockHeader) + block_.size + record_size >= block_size_) {
+    if (!StartBlock()) {
+      return false;
+    }
+  }
+
+  uint64_t offset = block_offset_ + sizeof(BlockHeader) + block_.size;
+  if (!WrappingWrite(offset, header_buffer, header_size) ||
+      !WrappingWrite(offset + header_size, ptr, size)) {
+    return false;
+  }
+  block_.size += record_size;
+  block_.record_count += 1;
+  block_.last_timestamp = TimestampMicroseconds();
+  block_.checksum = Crc32(Crc32(block_.checksum, header_buffer, header_size),
+    ptr, size);
+
+  __atomic_store_n(end_offset_, offset + record_size,
+    __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Ringfile::WriteBlockHeader() {
+  return WrappingWrite(block_offset_, &block_, sizeof(block_));
+}
+
+bool Ringfile::StartBlock() {
+  // An empty file starts with its oldest block.
+  uint64_t offset = *start_offset_ -
+    *start_offset_ % block_size_;
+  uint64_t sequence = 0;
+  if (block_started_) {
+    if (!WriteBlockHeader()) {
+      return false;
+    }
+    offset = (block_offset_ + block_size_) % bytes_max();
+    sequence = block_.first_sequence + block_.record_count;
+  }
+
+  // Evicting is per block, so at most one eviction makes room.
+  {
+    ReclaimerLock lock(reclaimer_);
+    while (*start_offset_ == offset &&
+        *start_offset_ != *end_offset_) {
+      if (!PopBlock()) {
+        return false;
+      }
+    }
+  }
+
+  memset(&block_, 0, sizeof(block_));
+  block_.first_sequence = sequence;
+  block_.first_timestamp = TimestampMicroseconds();
+  block_.last_timestamp = block_.first_timestamp;
+  block_offset_ = offset;
+  block_started_ = true;
+  return WriteBlockHeader();
+}
+
+bool Ringfile::LoadBlock() {
+  block_started_ = false;
+  uint64_t end_offset = *end_offset_;
+  if (*start_offset_ == end_offset) {
+    return true;  // the next write starts a block
+  }
+  block_offset_ = end_offset - end_offset % block_size_;
+  if (!WrappingRead(block_offset_, &block_, sizeof(block_))) {
+    return false;
+  }
+
+  // The writer may not have got to write the header since the last record,
+  // in which case the records are counted again. Their timestamps are lost.
+  uint64_t size = end_offset - block_offset_ - sizeof(BlockHeader);
+  if (block_.size != size) {
+    std::string records(size + Varint::kMaxSize, '\0');
+    if (!WrappingRead(block_offset_ + sizeof(BlockHeader), &records[0],
+        size)) {
+      return false;
+    }
+    block_.record_count = 0;
+    for (size_t position = 0; position < size; ++block_.record_count) {
+      size_t record_size;
+      position += VarintFraming().Decode(0, &records[position],
+        &record_size) + record_size;
+    }
+    block_.size = size;
+    block_.last_timestamp = TimestampMicroseconds();
+    block_.checksum = Crc32(0, records.data(), size);
+  }
+  block_started_ = true;
+  return true;
+}
+
+bool Ringfile::WriteBatch(const struct iovec * records, size_t count,
+    size_t * written) {
+  size_t ignored;
+  if (!written) {
+    written = &ignored;
+  }
+  *written = 0;
+  if (record_size_) {
+    return WriteBatch(FixedFraming(record_size_), records, count, written);
+  }
+  if (contiguous_) {
+    return WriteBatch(ContiguousFraming(alignment_), records, count,
+      written);
+  }
+  return WriteBatch(VarintFraming(), records, count, written);
+}
+
+template<class Framing>
+bool Ringfile::WriteBatch(const Framing & framing,
+    const struct iovec * records, size_t count, size_t * written) {
+  if (uring_ || direct_ || block_size_) {
+    // Writes through io_uring or direct I/O are already batched, and blocks
+    // are filled one record at a time.
+    for (size_t i = 0; i < count; ++i) {
+      if (!Write(framing, records[i].iov_base, records[i].iov_len)) {
+        return false;
+      }
+      ++*written;
+    }
+    return true;
+  }
+
+  // Lay the records out exactly as they will appear in the file.
+  std::string batch;
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t header_buffer[kMaxPrefixSize];
+    int header_size;
+    if (!framing.Encode((*end_offset_ + batch.size()) % bytes_max(),
+        records[i].iov_len, header_buffer, &header_size)) {
+      error_ = EINVAL;
+      return false;
+    }
+    if (bytes_max() < (header_size + records[i].iov_len + 1)) {
+      error_ = EMSGSIZE;
+      return false;
+    }
+    batch.append(reinterpret_cast<char *>(header_buffer), header_size);
+    batch.append(reinterpret_cast<const char *>(records[i].iov_base),
+      records[i].iov_len);
+  }
+
+  // A batch bigger than the file would overwrite its own first records, and
+  // in a contiguous file one that wraps needs a skip marker in the middle,
+  // so write those one at a time.
+  if (bytes_max() < batch.size() + 1 || (Framing::kContiguous &&
+      *end_offset_ + batch.size() > bytes_max())) {
+    for (size_t i = 0; i < count; ++i) {
+      if (!Write(framing, records[i].iov_base, records[i].iov_len)) {
+        return false;
+      }
+      ++*written;
+    }
+    return true;
+  }
+
+  if (!MakeRoom(framing, batch.size())) {
+    return false;
+  }
+  if (!WrappingWrite(*end_offset_, batch.data(), batch.size())) {
+    return false;
+  }
+  __atomic_store_n(end_offset_,
+    (*end_offset_ + batch.size()) % bytes_max(), __ATOMIC_RELEASE);
+  *written = count;
+  return true;
+}
+
+bool Ringfile::MoveData(uint64_t from, uint64_t to, uint64_t size) {
+  char buffer[64 * 1024];
+  for (uint64_t done = 0; done < size; ) {
+    uint64_t chunk = size - done;
+    if (chunk > sizeof(buffer)) {
+      chunk = sizeof(buffer);
+    }
+    // Moving up, copy from the end so that nothing is overwritten before it
+    // has been copied.
+    uint64_t position = to > from ? size - done - chunk : done;
+    if (!WrappingRead(from + position, buffer, chunk) ||
+        !WrappingWrite(to + position, buffer, chunk)) {
+      if (error_ == 0) {
+        error_ = EIO;
+      }
+      return false;
+    }
+    done += chunk;
+  }
+  return true;
+}
+
+bool Ringfile::Resize(size_t size) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (size <= data_offset_ + record_size_ + 1) {
+    error_ = EINVAL;
+    return false;
+  }
+  if (size % alignment_ != 0) {
+    error_ = EINVAL;  // records would not stay aligned
+    return false;
+  }
+  // Eviction works on whole blocks.
+  if (block_size_ && ((size - data_offset_) % block_size_ != 0 ||
+      size - data_offset_ < 2 * block_size_)) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  if (!Flush()) {
+    return false;
+  }
+
+  // Our own shared lock is converted to an exclusive one, which only succeeds
+  // if no other appender has the file open. flock() may drop the shared lock
+  // before failing, so take it again before carrying on as an appender.
+  if (flock(fd_, LOCK_EX|LOCK_NB) == -1) {
+    error_ = errno;
+    if (flock(fd_, LOCK_SH) == -1) {
+      error_ = errno;
+    }
+    return false;
+  }
+  // Moving data reads what it has just written, so bypass the block of
+  // direct_, which holds what was there before.
+  DirectIO * direct = direct_;
+  direct_ = NULL;
+  ReclaimerLock lock(reclaimer_);
+  bool ok = ResizeLocked(size);
+  if (flock(fd_, LOCK_SH) == -1 && ok) {
+    error_ = errno;
+    ok = false;
+  }
+  direct_ = direct;
+  if (direct_) {
+    direct_->Invalidate();
+  }
+  if (ok && block_size_) {
+    read_block_offset_ = UINT64_MAX;
+    ok = LoadBlock();
+  }
+  if (ok && prefault_map_) {
+    ok = Prefault(prefault_locked_);
+  }
+  return ok;
+}
+
+bool Ringfile::ResizeLocked(size_t size) {
+  uint64_t old_bytes_max = bytes_max();
+  uint64_t new_bytes_max = size - data_offset_;
+  if (new_bytes_max == old_bytes_max) {
+    return true;
+  }
+
+  // Make room by dropping the oldest records. One byte always stays free to
+  // tell a full file from an empty one, and records that move keep their
+  // alignment.
+  while (new_bytes_max < old_bytes_max &&
+      bytes_used() + alignment_ - 1 >= new_bytes_max) {
     if (!PopRecord()) {
       return false;
     }
-    assert(bytes_available() > bytes_available_start);
   }
 
-  if (!WrappingWrite(header_->end_offset, header_buffer, header_size)) {
+  uint32_t flags = __atomic_fetch_or(&header_->flags, kFlagResizing,
+    __ATOMIC_SEQ_CST);
+
+  uint64_t start_offset = *start_offset_;
+  uint64_t end_offset = *end_offset_;
+  bool ok = true;
+  error_ = 0;
+  if (new_bytes_max > old_bytes_max) {
+    if (ftruncate(fd_, size) == -1) {
+      error_ = errno;
+      ok = false;
+    } else {
+      size_ = size;
+      if (end_offset < start_offset && contiguous_) {
+        // The skip marker has to stay at the end of the data area, so the
+        // records from the start offset up move to the new end instead.
+        uint64_t shift = new_bytes_max - old_bytes_max;
+        ok = MoveData(start_offset, start_offset + shift,
+          old_bytes_max - start_offset);
+        start_offset += shift;
+      } else if (end_offset < start_offset) {
+        // The records that wrapped around to the start of the file move up to
+        // follow the old end of the file. If there is not enough new space
+        // for all of them the rest wrap again, moving down to the start of
+        // the file once the part that fits is out of the way.
+        uint64_t shift = new_bytes_max - old_bytes_max;
+        ok = MoveData(0, old_bytes_max, std::min(end_offset, shift));
+        if (ok && end_offset > shift) {
+          ok = MoveData(shift, 0, end_offset - shift);
+        }
+        end_offset = (old_bytes_max + end_offset) % new_bytes_max;
+      }
+    }
+  } else {
+    if (end_offset < start_offset) {
+      // The records at the end of the file move down to the new end.
+      uint64_t shift = old_bytes_max - new_bytes_max;
+      ok = MoveData(start_offset, start_offset - shift,
+        old_bytes_max - start_offset);
+      start_offset -= shift;
+    } else if (end_offset >= new_bytes_max) {
+      // The records are beyond the new end of the file, move them to the
+      // start.
+      uint64_t to = start_offset % alignment_;
+      ok = MoveData(start_offset, to, end_offset - start_offset);
+      end_offset -= start_offset - to;
+      start_offset = to;
+    }
+    if (ok) {
+      if (ftruncate(fd_, size) == -1) {
+        error_ = errno;
+        ok = false;
+      } else {
+        size_ = size;
+      }
+    }
+  }
+
+  // Publish the new generation, which also tells readers that it is safe to
+  // look at the file again.
+  uint32_t generation = ((flags & kResizeGenerationMask) +
+    kResizeGenerationUnit) & kResizeGenerationMask;
+
+  if (ok) {
+    *start_offset_ = start_offset;
+    *end_offset_ = end_offset;
+    if (cursor_table_) {
+      RebaseCursors(new_bytes_max, start_offset,
+        generation / kResizeGenerationUnit);
+    }
+  }
+  flags = (flags & ~kResizeMask) | generation;
+  __atomic_store_n(&header_->flags, flags, __ATOMIC_SEQ_CST);
+  resize_flags_ = flags & kResizeMask;
+  read_offset_ = *start_offset_;
+  ResetReadPosition();
+  return ok;
+}
+
+uint32_t Ringfile::cursor_generation() const {
+  return (resize_flags_ & kResizeGenerationMask) / kResizeGenerationUnit;
+}
+
+bool Ringfile::LockCursors(int * fd, CursorTable ** table) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (!cursor_table_) {
+    error_ = ENOTSUP;
+    return false;
+  }
+
+  // Cursors are written through a writable mapping of the header. A file
+  // open for reading gets one from a second, writable descriptor.
+  *fd = fd_;
+  *table = cursor_table_;
+  if (mode_ == kRead) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd_);
+    *fd = open(path, O_RDWR);
+    if (*fd == -1) {
+      error_ = errno;
+      return false;
+    }
+    if (!cursor_map_) {
+      void * map = mmap(0, data_offset_, PROT_READ|PROT_WRITE, MAP_SHARED,
+        *fd, 0);
+      if (map == MAP_FAILED) {
+        error_ = errno;
+        close(*fd);
+        return false;
+      }
+      cursor_map_ = map;
+    }
+    *table = reinterpret_cast<CursorTable *>(
+      reinterpret_cast<char *>(cursor_map_) +
+      (reinterpret_cast<char *>(cursor_table_) -
+       reinterpret_cast<char *>(header_)));
+  }
+
+  // Changes to the set of cursors are serialized between processes with a
+  // record lock on the table, so that two consumers never create the same
+  // name twice.
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = extension_offset_ + sizeof(HeaderExtension);
+  lock.l_len = data_offset_ - lock.l_start;
+  while (fcntl(*fd, F_SETLKW, &lock) == -1) {
+    if (errno != EINTR) {
+      error_ = errno;
+      if (*fd != fd_) {
+        close(*fd);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+void Ringfile::UnlockCursors(int fd) {
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_UNLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = extension_offset_ + sizeof(HeaderExtension);
+  lock.l_len = data_offset_ - lock.l_start;
+  fcntl(fd, F_SETLK, &lock);
+  if (fd != fd_) {
+    close(fd);
+  }
+}
+
+bool Ringfile::OpenCursor(const std::string & name) {
+  if (name.empty() || name.size() >= sizeof(cursor_->name)) {
+    error_ = EINVAL;
+    return false;
+  }
+  if (!CheckResize()) {
+    return false;
+  }
+
+  int fd;
+  CursorTable * table;
+  if (!LockCursors(&fd, &table)) {
+    return false;
+  }
+  Cursor * cursors = reinterpret_cast<Cursor *>(table + 1);
+  Cursor * cursor = NULL;
+  Cursor * free_cursor = NULL;
+  for (uint32_t i = 0; i < table->cursor_count; ++i) {
+    if (strncmp(cursors[i].name, name.c_str(), sizeof(cursors[i].name)) ==
+        0) {
+      cursor = &cursors[i];
+      break;
+    }
+    if (!free_cursor && cursors[i].name[0] == '\0') {
+      free_cursor = &cursors[i];
+    }
+  }
+  if (!cursor && free_cursor) {
+    // A new cursor starts at the oldest record.
+    memcpy(free_cursor->name, name.c_str(), name.size() + 1);
+    uint64_t start_position = __atomic_load_n(&table->start_position,
+      __ATOMIC_ACQUIRE);
+    __atomic_store_n(&free_cursor->state,
+      (static_cast<uint64_t>(cursor_generation()) << kCursorGenerationShift) |
+      (start_position & kCursorPositionMask), __ATOMIC_RELEASE);
+    cursor = free_cursor;
+  }
+  UnlockCursors(fd);
+  if (!cursor) {
+    error_ = ENOSPC;
+    return false;
+  }
+  cursor_ = cursor;
+  ack_table_ = table;
+
+  uint64_t state = __atomic_load_n(&cursor_->state, __ATOMIC_ACQUIRE);
+  uint64_t position = state & kCursorPositionMask;
+  uint64_t start_position = __atomic_load_n(&table->start_position,
+    __ATOMIC_ACQUIRE);
+  bytes_lost_ = 0;
+  if ((state >> kCursorGenerationShift) != cursor_generation()) {
+    // The position was acknowledged in the middle of a resize, so it cannot
+    // be trusted. Start over rather than risk skipping records.
+    read_offset_ = start_position % bytes_max();
+    read_position_ = start_position;
+  } else if (position < start_position) {
+    bytes_lost_ = start_position - position;
+    read_offset_ = start_position % bytes_max();
+    read_position_ = start_position;
+  } else if (position - start_position > bytes_used()) {
+    error_ = EINVAL;  // the cursor is past the newest record
+    cursor_ = NULL;
+    return false;
+  } else {
+    read_offset_ = position % bytes_max();
+    read_position_ = position;
+  }
+  return true;
+}
+
+bool Ringfile::RemoveCursor(const std::string & name) {
+  int fd;
+  CursorTable * table;
+  if (!LockCursors(&fd, &table)) {
+    return false;
+  }
+  Cursor * cursors = reinterpret_cast<Cursor *>(table + 1);
+  bool found = false;
+  for (uint32_t i = 0; i < table->cursor_count; ++i) {
+    if (strncmp(cursors[i].name, name.c_str(), sizeof(cursors[i].name)) ==
+        0) {
+      if (cursor_ == &cursors[i]) {
+        cursor_ = NULL;
+      }
+      memset(cursors[i].name, 0, sizeof(cursors[i].name));
+      found = true;
+      break;
+    }
+  }
+  if (found) {
+    WakeWriters(table);
+  }
+  UnlockCursors(fd);
+  if (!found) {
+    error_ = ENOENT;
+    return false;
+  }
+  return true;
+}
+
+bool Ringfile::Ack() {
+  if (!cursor_) {
+    error_ = EINVAL;
+    return false;
+  }
+  if (!CheckResize()) {
+    return false;
+  }
+  __atomic_store_n(&cursor_->state,
+    (static_cast<uint64_t>(cursor_generation()) << kCursorGenerationShift) |
+    (read_position_ & kCursorPositionMask), __ATOMIC_RELEASE);
+  if (header_->flags & kFlagQueue) {
+    WakeWriters(ack_table_);
+  }
+  return true;
+}
+
+void Ringfile::WakeWriters(CursorTable * table) {
+  // Bump the sequence so that a writer about to sleep notices, and only make
+  // the system call if one said it was sleeping.
+  uint32_t sequence = __atomic_load_n(&table->ack_sequence, __ATOMIC_RELAXED);
+  uint32_t next;
+  do {
+    next = ((sequence & ~kAckWaiting) + 1) & ~kAckWaiting;
+  } while (!__atomic_compare_exchange_n(&table->ack_sequence, &sequence, next,
+      false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+  if (sequence & kAckWaiting) {
+    FutexWake(&table->ack_sequence);
+  }
+}
+
+uint64_t Ringfile::SlowestCursor() const {
+  uint64_t slowest = kCursorPositionMask;
+  const Cursor * cursors = reinterpret_cast<const Cursor *>(
+    cursor_table_ + 1);
+  uint32_t generation = cursor_generation();
+  for (uint32_t i = 0; i < cursor_table_->cursor_count; ++i) {
+    if (cursors[i].name[0] == '\0') {
+      continue;
+    }
+    // Cursors from before a resize restart from the oldest record anyway.
+    uint64_t state = __atomic_load_n(&cursors[i].state, __ATOMIC_ACQUIRE);
+    if ((state >> kCursorGenerationShift) == generation &&
+        (state & kCursorPositionMask) < slowest) {
+      slowest = state & kCursorPositionMask;
+    }
+  }
+  return slowest;
+}
+
+bool Ringfile::WaitForConsumers(uint64_t position) {
+  uint64_t deadline = MonotonicMilliseconds() + write_timeout_ms_;
+  while (true) {
+    if (SlowestCursor() > position) {
+      return true;
+    }
+
+    int wait_ms = -1;
+    if (write_timeout_ms_ >= 0) {
+      uint64_t now = MonotonicMilliseconds();
+      if (now >= deadline) {
+        error_ = EAGAIN;
+        return false;
+      }
+      wait_ms = deadline - now;
+    }
+
+    // Say that we are about to sleep, then look again in case a consumer
+    // acknowledged in between.
+    uint32_t sequence = __atomic_or_fetch(&cursor_table_->ack_sequence,
+      kAckWaiting, __ATOMIC_SEQ_CST);
+    if (SlowestCursor() > position) {
+      return true;
+    }
+    FutexWait(&cursor_table_->ack_sequence, sequence, wait_ms);
+  }
+}
+
+void Ringfile::RebaseCursors(uint64_t new_bytes_max, uint64_t start_offset,
+    uint32_t generation) {
+  // Carry on numbering from the old start position, at the next position
+  // that lands on the new start offset.
+  uint64_t old_start = cursor_table_->start_position;
+  uint64_t new_start = old_start + (start_offset + new_bytes_max -
+    old_start % new_bytes_max) % new_bytes_max;
+
+  uint32_t old_generation = cursor_generation();
+  Cursor * cursors = reinterpret_cast<Cursor *>(cursor_table_ + 1);
+  for (uint32_t i = 0; i < cursor_table_->cursor_count; ++i) {
+    if (cursors[i].name[0] == '\0') {
+      continue;
+    }
+    uint64_t state = __atomic_load_n(&cursors[i].state, __ATOMIC_ACQUIRE);
+    if ((state >> kCursorGenerationShift) != old_generation) {
+      continue;
+    }
+    uint64_t position = state & kCursorPositionMask;
+    if (position >= old_start) {
+      position = new_start + (position - old_start);
+    }
+    __atomic_store_n(&cursors[i].state,
+      (static_cast<uint64_t>(generation) << kCursorGenerationShift) |
+      (position & kCursorPositionMask), __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&cursor_table_->start_position, new_start,
+    __ATOMIC_RELEASE);
+}
+
+bool Ringfile::Close() {
+  bool ok = true;
+  if (reclaimer_) {
+    pthread_mutex_lock(&reclaimer_->mutex);
+    reclaimer_->stopping = true;
+    pthread_cond_signal(&reclaimer_->condition);
+    pthread_mutex_unlock(&reclaimer_->mutex);
+    pthread_join(reclaimer_->thread, NULL);
+    if (TakeReclaimerError()) {
+      ok = false;
+    }
+    pthread_mutex_destroy(&reclaimer_->mutex);
+    pthread_cond_destroy(&reclaimer_->condition);
+    delete reclaimer_;
+    reclaimer_ = NULL;
+  }
+
+  if (uring_) {
+    Flush();
+    delete uring_;
+    uring_ = NULL;
+  }
+  if (direct_) {
+    Flush();
+    delete direct_;
+    direct_ = NULL;
+  }
+  if (block_started_) {
+    WriteBlockHeader();
+    block_started_ = false;
+  }
+
+  if (notify_fd_ != -1) {
+    close(notify_fd_);
+    notify_fd_ = -1;
+  }
+
+  if (cursor_map_) {
+    munmap(cursor_map_, data_offset_);
+    cursor_map_ = NULL;
+  }
+  if (prefault_map_) {
+    munmap(prefault_map_, prefault_size_);
+    prefault_map_ = NULL;
+  }
+  cursor_table_ = NULL;
+  cursor_ = NULL;
+  ack_table_ = NULL;
+  bytes_lost_ = 0;
+
+  if (header_) {
+    munmap(header_, data_offset_);
+    header_ = NULL;
+  }
+  data_offset_ = sizeof(Header);
+  extension_offset_ = sizeof(Header);
+  start_offset_ = NULL;
+  end_offset_ = NULL;
+  record_size_ = 0;
+  block_size_ = 0;
+  contiguous_ = false;
+  alignment_ = 1;
+  read_block_offset_ = UINT64_MAX;
+
+  if (fd_ != -1) {
+    if (fd_is_owned_) {
+      close(fd_);
+    } else if (fd_locked_) {
+      // The lock belongs to the open file, which outlives us.
+      flock(fd_, LOCK_UN);
+    }
+    fd_ = -1;
+  }
+  fd_locked_ = false;
+  return ok;
+}
+
+size_t Ringfile::bytes_max() const {
+  return size_ - data_offset_;
+}
+
+size_t Ringfile::bytes_used() const {
+  // Load each offset once, as a reclaimer thread may be moving the start.
+  uint64_t start_offset = __atomic_load_n(start_offset_,
+    __ATOMIC_ACQUIRE);
+  uint64_t end_offset = __atomic_load_n(end_offset_,
+    __ATOMIC_ACQUIRE);
+  if (start_offset <= end_offset) {
+    return end_offset - start_offset;
+  } else {
+    return bytes_max() - (start_offset - end_offset);
+  }
+}
+
+size_t Ringfile::bytes_available() const {
+  return bytes_max() - bytes_used();
+}
+
+size_t Ringfile::block_count() const {
+  if (!block_size_) {
+    return 0;
+  }
+  // Only the block being written is not full.
+  return (bytes_used() + block_size_ - 1) / block_size_;
+}
+
+bool Ringfile::ReadBlock(size_t index, BlockHeader * header,
+    std::string * records) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (!block_size_) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  while (true) {
+    if (!CheckResize()) {
+      return false;
+    }
+    uint64_t start_offset = __atomic_load_n(start_offset_,
+      __ATOMIC_ACQUIRE);
+    if (index >= block_count()) {
+      error_ = ERANGE;
+      return false;
+    }
+    uint64_t offset = (start_offset + index * block_size_) % bytes_max();
+    if (!WrappingRead(offset, header, sizeof(*header))) {
+      return false;
+    }
+    bool ok = header->size <= block_size_ - sizeof(BlockHeader);
+    if (ok && records) {
+      records->resize(header->size);
+      ok = header->size == 0 || WrappingRead(offset + sizeof(BlockHeader),
+        &(*records)[0], header->size);
+      if (!ok && error_ != 0) {
+        return false;
+      }
+    }
+
+    // A writer evicts blocks before it overwrites them, so if the oldest
+    // block is still the same one then so is the block we read.
+    if (Resized() || __atomic_load_n(start_offset_,
+        __ATOMIC_ACQUIRE) != start_offset) {
+      continue;
+    }
+    if (!ok || (records &&
+        Crc32(0, records->data(), records->size()) != header->checksum)) {
+      error_ = EBADMSG;
+      return false;
+    }
+    return true;
+  }
+}
+
+bool Ringfile::SeekBlock(size_t index) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (!block_size_) {
+    error_ = EINVAL;
+    return false;
+  }
+  if (!CheckResize()) {
+    return false;
+  }
+  if (index >= block_count()) {
+    error_ = ERANGE;
+    return false;
+  }
+  read_offset_ = (*start_offset_ + index * block_size_) % bytes_max();
+  ResetReadPosition();
+  return true;
+}
+
+size_t Ringfile::record_count() const {
+  return record_size_ ? bytes_used() / record_size_ : 0;
+}
+
+bool Ringfile::ReadAt(size_t index, void * ptr) {
+  return ReadRange(index, 1, ptr);
+}
+
+bool Ringfile::ReadRange(size_t first, size_t count, void * ptr) {
+  if (!header_ || fd_ == -1) {
+    error_ = EBADF;
+    return false;
+  }
+  if (!record_size_) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  while (true) {
+    if (!CheckResize()) {
+      return false;
+    }
+    uint64_t start_offset = __atomic_load_n(start_offset_,
+      __ATOMIC_ACQUIRE);
+    uint64_t end_offset = __atomic_load_n(end_offset_,
+      __ATOMIC_ACQUIRE);
+    size_t records = (end_offset + bytes_max() - start_offset) % bytes_max() /
+      record_size_;
+    if (first > records || count > records - first) {
+      error_ = ERANGE;
+      return false;
+    }
+    if (!WrappingRead(start_offset + first * record_size_, ptr,
+        count * record_size_)) {
+      return false;
+    }
+
+    // A writer evicts records before it overwrites them, so if the oldest
+    // record is still the same one then so are the records we read.
+    if (Resized() || __atomic_load_n(start_offset_,
+        __ATOMIC_ACQUIRE) != start_offset) {
+      continue;
+    }
+    return true;
+  }
+}
+
+bool Ringfile::StreamingWriteStart(size_t size) {
+  if (block_size_) {
+    error_ = EINVAL;  // a record has to be known to fit in the block
+    return false;
+  }
+  if (record_size_) {
+    return StreamingWriteStart(FixedFraming(record_size_), size);
+  }
+  if (contiguous_) {
+    return StreamingWriteStart(ContiguousFraming(alignment_), size);
+  }
+  return StreamingWriteStart(VarintFraming(), size);
+}
+
+template<class Framing>
+bool Ringfile::StreamingWriteStart(const Framing & framing, size_t size) {
+  assert(streaming_write_offset_ == 0);
+  if (!Flush()) {
+    return false;
+  }
+
+  // Build the header
+  uint8_t header_buffer[kMaxPrefixSize];
+  int header_size;
+  if (!framing.Encode(*end_offset_, size, header_buffer,
+      &header_size)) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  // Refuse a record that is too big for the buffer
+  if (bytes_max() < (header_size + size + 1)) {
+    return false;
+  }
+
+  if (!SkipToStart(framing, size, header_buffer, &header_size) ||
+      !MakeRoom(framing, header_size + size)) {
     return false;
   }
 
-  streaming_write_offset_ = header_->end_offset + header_size;
+  if (!WrappingWrite(*end_offset_, header_buffer, header_size)) {
+    return false;
+  }
+
+  streaming_write_offset_ = *end_offset_ + header_size;
   streaming_write_bytes_remaining_ = size;
 
   return true;
@@ -366,36 +2724,63 @@ bool Ringfile::StreamingWrite(const void * ptr, size_t size) {
 
 bool Ringfile::StreamingWriteFinish() {
   assert(streaming_write_bytes_remaining_ == 0);
-  header_->end_offset = streaming_write_offset_;
-  header_->end_offset %= bytes_max();
+  __atomic_store_n(end_offset_,
+    streaming_write_offset_ % bytes_max(), __ATOMIC_RELEASE);
   streaming_write_offset_ = 0;
+  if (direct_) {
+    direct_->Invalidate();
+  }
   return true;
 }
 
 size_t Ringfile::StreamingReadStart() {
+  if (record_size_) {
+    return StreamingReadStart(FixedFraming(record_size_));
+  }
+  if (contiguous_) {
+    return StreamingReadStart(ContiguousFraming(alignment_));
+  }
+  return StreamingReadStart(VarintFraming());
+}
+
+template<class Framing>
+size_t Ringfile::StreamingReadStart(const Framing & framing) {
   assert(header_ != NULL);
   assert(fd_ != -1);
   assert(streaming_read_offset_ == 0);
 
-  if (read_offset_ == header_->end_offset) {
-    return -1;
-  }
+  int header_size;
+  size_t size;
+  while (true) {
+    if (!CheckResize()) {
+      return -1;
+    }
+    if (read_offset_ == *end_offset_) {
+      return -1;
+    }
+    if (block_size_ && !SkipBlockPadding()) {
+      return -1;
+    }
 
-  uint8_t header_buffer[Varint::kMaxSize];
-  if (!WrappingRead(read_offset_, header_buffer, Varint::kMaxSize)) {
-    return -1;
+    if (!ReadPrefix(framing, read_offset_, &header_size, &size)) {
+      return -1;
+    }
+    if (Resized()) {
+      continue;
+    }
+    if (Framing::kContiguous && size == kSkipMarker) {
+      AdvanceReadOffset(0);
+      continue;
+    }
+    break;
   }
 
-  Varint size_varint;
-  int header_size = size_varint.Read(header_buffer);
-
   streaming_read_offset_ = read_offset_ + header_size;
-  streaming_read_bytes_remaining_ = size_varint.value();
+  streaming_read_bytes_remaining_ = size;
 
-  read_offset_ += header_size + size_varint.value();
-  read_offset_ %= bytes_max();
+  AdvanceReadOffset(read_offset_ + header_size + size);
 
-  return size_varint.value();
+  return size;
 }
 
 size_t Ringfile::StreamingRead(void * ptr, size_t size) {
@@ -0,0 +1,136 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Compares writing and reading a ring through the page cache with doing it
+// through EnableDirectIO(), reporting the throughput of each and how much of
+// the file was left in the page cache afterwards.
+//
+// usage: ringfile_benchmark [directory [ring size in MB [record size]]]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "ringfile_internal.h"
+
+namespace {
+
+double Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// The percentage of the pages of `path` that are in the page cache.
+double Resident(const std::string & path, size_t size) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  void * map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  long page_size = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> pages((size + page_size - 1) / page_size);
+  size_t resident = 0;
+  if (mincore(map, size, &pages[0]) == 0) {
+    for (size_t i = 0; i < pages.size(); ++i) {
+      resident += pages[i] & 1;
+    }
+  }
+  munmap(map, size);
+  return 100.0 * resident / pages.size();
+}
+
+// Evict `path` from the page cache, so that each run starts cold.
+void DropCache(const std::string & path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd != -1) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+bool Run(const std::string & path, size_t ring_size, size_t record_size,
+    bool direct) {
+  const char * name = direct ? "direct" : "buffered";
+  unlink(path.c_str());
+
+  // Write the ring twice over, so that the second lap evicts records.
+  std::string record(record_size, 'x');
+  Ringfile writer;
+  if (!writer.Create(path, ring_size) ||
+      (direct && !writer.EnableDirectIO())) {
+    fprintf(stderr, "%s: %s: %s\n", path.c_str(), name,
+      strerror(writer.error()));
+    return false;
+  }
+  size_t count = 2 * ring_size / (record_size + 2);
+  double start = Now();
+  for (size_t i = 0; i < count; ++i) {
+    if (!writer.Write(record.data(), record.size())) {
+      fprintf(stderr, "%s: write: %s\n", path.c_str(),
+        strerror(writer.error()));
+      return false;
+    }
+  }
+  writer.Flush();
+  double write_seconds = Now() - start;
+  double write_resident = Resident(path, ring_size);
+  writer.Close();
+  DropCache(path);
+
+  Ringfile reader;
+  if (!reader.Open(path, Ringfile::kRead) ||
+      (direct && !reader.EnableDirectIO())) {
+    fprintf(stderr, "%s: %s: %s\n", path.c_str(), name,
+      strerror(reader.error()));
+    return false;
+  }
+  size_t bytes_read = 0;
+  start = Now();
+  while (!reader.EndOfFile()) {
+    if (!reader.Read(&record[0], record.size())) {
+      fprintf(stderr, "%s: read: %s\n", path.c_str(),
+        strerror(reader.error()));
+      return false;
+    }
+    bytes_read += record.size();
+  }
+  double read_seconds = Now() - start;
+  double read_resident = Resident(path, ring_size);
+  reader.Close();
+
+  double mb = 1024.0 * 1024.0;
+  printf("%-8s  write %8.1f MB/s, %5.1f%% cached  "
+    "read %8.1f MB/s, %5.1f%% cached\n", name,
+    count * record_size / mb / write_seconds, write_resident,
+    bytes_read / mb / read_seconds, read_resident);
+  return true;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char ** argv) {
+  std::string directory = argc > 1 ? argv[1] : ".";
+  size_t ring_size = (argc > 2 ? atol(argv[2]) : 256) * 1024 * 1024;
+  size_t record_size = argc > 3 ? atol(argv[3]) : 100;
+
+  std::string path = directory + "/ringfile_benchmark.ring";
+  bool ok = Run(path, ring_size, record_size, false) &&
+    Run(path, ring_size, record_size, true);
+  unlink(path.c_str());
+  return ok ? 0 : 1;
+}
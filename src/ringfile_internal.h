@@ -7,13 +7,19 @@
 #include <ringfile.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <string>
+#include <vector>
 
 #if !defined(__cplusplus)
 #error C++ only
 #endif
 
+class DirectIO;
+class UringWriter;
+struct Reclaimer;
+
 #pragma pack(push, 1)
 struct Header {
   uint32_t magic;
@@ -21,6 +27,77 @@ struct Header {
   uint64_t start_offset;
   uint64_t end_offset;
 };
+
+// The header of files created with Options::header_version 2, which starts
+// like a Header but keeps the offsets on cache lines of their own: the end
+// offset is written by the writer for every record, the start offset when
+// records are evicted, and both are polled by readers. The header and its
+// extension areas fill whole pages (Ringfile::kHeaderV2Size bytes).
+struct HeaderV2 {
+  // Written when the file is created or resized.
+  uint32_t magic;             // Ringfile::kMagicV2
+  uint32_t flags;             // as Header::flags
+  uint32_t version;           // 2
+  uint32_t extension_offset;  // where the HeaderExtension starts
+  uint64_t features;          // optional features, readers ignore unknown bits
+  uint8_t reserved0[40];
+
+  // Written by the writer.
+  uint64_t end_offset;
+  uint8_t reserved1[56];
+
+  // Written by whoever evicts records.
+  uint64_t start_offset;
+  uint8_t reserved2[56];
+
+  // For readers and statistics.
+  uint8_t reserved3[64];
+};
+
+// Follows the Header in files with Ringfile::kFlagExtended set, or starts at
+// HeaderV2::extension_offset.
+struct HeaderExtension {
+  uint32_t data_offset;  // where the data area starts in the file
+  // The size of every record with kFlagFixedRecords, of every block with
+  // kFlagBlocks, or the alignment of records with kFlagAligned.
+  uint32_t record_size;
+};
+
+// Follows the HeaderExtension in files with Ringfile::kFlagCursors set.
+//
+// Cursors record positions as logical positions: the number of bytes that
+// came before a byte in the data area, counting evicted records. The offset
+// of a logical position is always the position modulo the data size, and
+// records before start_position have been evicted.
+struct CursorTable {
+  uint64_t start_position;  // the logical position of start_offset
+  uint32_t cursor_count;    // the number of Cursors that follow
+  uint32_t ack_sequence;    // changes on every Ack() in a queue
+};
+
+// A named consumer position. `state` holds the resize generation the
+// position was taken in in its top eight bits and the logical position of
+// the next unread record below them, so that it changes with a single store.
+// An unused cursor has an empty name.
+struct Cursor {
+  char name[40];
+  uint64_t state;
+};
+
+// Starts every block of files with Ringfile::kFlagBlocks set. The records of
+// the block, each prefixed with its length, follow it. The writer keeps the
+// header of the block it is appending to in memory and writes it when the
+// block is full, on Flush() and on Close(), so the last block may hold more
+// records than its header describes.
+struct BlockHeader {
+  uint32_t size;              // the bytes of records that follow
+  uint32_t record_count;
+  uint64_t first_sequence;    // of the first record, counting from 0
+  uint64_t first_timestamp;   // microseconds since the epoch
+  uint64_t last_timestamp;
+  uint32_t checksum;          // the CRC-32 of the records
+  uint32_t reserved;
+};
 #pragma pack(pop)
 
 class Ringfile {
@@ -30,14 +107,280 @@ class Ringfile {
 
   enum Mode { kRead, kAppend };
   static const uint32_t kMagic = 'GNIR';
+  static const uint32_t kMagicV2 = '2GNR';
+  static const size_t kHeaderV2Size = 4096;
+
+  // Bits of Header::flags used to coordinate Resize() with readers. The top
+  // bit is set while data is being moved, and the seven bits below it count
+  // completed resizes.
+  static const uint32_t kFlagResizing = 0x80000000;
+  static const uint32_t kResizeGenerationMask = 0x7f000000;
+  static const uint32_t kResizeGenerationUnit = 0x01000000;
+  static const uint32_t kResizeMask = kFlagResizing | kResizeGenerationMask;
+
+  // The low bits of Header::flags describe the layout of the file.
+  // kFlagExtended means a HeaderExtension follows the header, and
+  // kFlagFixedRecords that every record is HeaderExtension::record_size bytes
+  // long and stored without a length prefix.
+  // kFlagCursors means a CursorTable follows the extension, and kFlagQueue
+  // that writers wait for the cursors instead of evicting unread records.
+  // kFlagBlocks means the data area is divided into blocks of
+  // HeaderExtension::record_size bytes, each starting with a BlockHeader.
+  // kFlagContiguous means records never wrap around the end of the data
+  // area (see ContiguousFraming), and kFlagAligned that records start at
+  // multiples of HeaderExtension::record_size bytes into the data area.
+  static const uint32_t kFlagExtended = 0x00000001;
+  static const uint32_t kFlagFixedRecords = 0x00000002;
+  static const uint32_t kFlagCursors = 0x00000004;
+  static const uint32_t kFlagQueue = 0x00000008;
+  static const uint32_t kFlagBlocks = 0x00000010;
+  static const uint32_t kFlagContiguous = 0x00000020;
+  static const uint32_t kFlagAligned = 0x00000040;
+
+  struct Options {
+    Options()
+      : record_size(0), block_size(0), cursor_count(0), queue(false),
+        prealloc(false), contiguous(false), alignment(0),
+        header_version(1) { }
+
+    // If non-zero, every record is exactly this many bytes. Lengths are not
+    // stored, evicting a record is a single addition and records can be read
+    // by index with ReadAt() and ReadRange().
+    size_t record_size;
+
+    // If non-zero, group records into blocks of this many bytes (64k is a
+    // good size), each with a BlockHeader that counts, timestamps and
+    // checksums its records. Records must fit in a block. Blocks are read
+    // and checked with ReadBlock() and evicted whole. The header grows so
+    // that the data area is a whole number of blocks, at least two.
+    size_t block_size;
+
+    // Reserve room in the header for this many named cursors.
+    size_t cursor_count;
+
+    // Make the ring a bounded queue: a writer that needs room waits until
+    // every cursor has acknowledged the oldest record rather than evicting
+    // it. Requires cursor_count.
+    bool queue;
+
+    // Allocate every block of the file up front with posix_fallocate()
+    // rather than leaving it sparse, so that the first lap neither pays for
+    // block allocation nor fails with ENOSPC halfway through.
+    bool prealloc;
+
+    // Never split a record across the end of the data area. A record that
+    // would wrap starts at offset 0 instead, after a marker that pads out
+    // the end, so every record can be read with a single read or pointed
+    // to in a mapping of the file. Costs up to one record's worth of space
+    // per lap. Cannot be combined with record_size or block_size.
+    bool contiguous;
 
-  bool Create(const std::string & path, size_t size);
+    // If non-zero, store every record at a multiple of this many bytes (a
+    // power of two up to 64) from the start of the data area, which itself
+    // starts at such a multiple, so that records mapped from the file can
+    // be used in place as structs or by vector code. Implies contiguous.
+    // The padding counts towards bytes_used(), and the size of the file
+    // must be a multiple of the alignment.
+    size_t alignment;
+
+    // 1 for the compact 24-byte header that every version can read, or 2
+    // for a HeaderV2 page that keeps the start and end offsets on separate
+    // cache lines, for rings that many processes use at once.
+    int header_version;
+  };
+
+  bool Create(const std::string & path, size_t size,
+    const Options & options = Options());
   bool Open(const std::string & path, Mode mode);
+
+  // Create a new ring in, or open an existing ring from, a file descriptor
+  // that is already open. On success the descriptor is closed by Close() if
+  // `take_ownership` is true; on failure it is left open. All I/O uses
+  // positioned reads and writes, so the descriptor's file offset is never
+  // used and it can be shared, for example with a child process after fork().
+  bool CreateFd(int fd, size_t size, bool take_ownership,
+    const Options & options = Options());
+  bool OpenFd(int fd, Mode mode, bool take_ownership);
+
+  // Create a ring in shared memory rather than on disk. With a `name` the
+  // ring is a POSIX shared memory object (under /dev/shm on Linux) that other
+  // processes can open with OpenShm() and that outlives this process until
+  // it is removed with shm_unlink(). With no name it is an anonymous memfd,
+  // shared by passing fd() to another process or across fork().
+  bool CreateShm(const char * name, size_t size,
+    const Options & options = Options());
+  bool OpenShm(const char * name, Mode mode);
+
+  // Fails with EINVAL if the file has fixed size records and `size` is not
+  // record_size().
   bool Write(const void * ptr, size_t size);
+
+  // Append `count` records at once. Room is made for all of them first and
+  // they are written with a single write where possible, so readers see the
+  // whole batch appear together. If `written` is given it is set to how many
+  // records were appended, so that after a failure the caller can carry on
+  // from records[*written] without writing any record twice.
+  bool WriteBatch(const struct iovec * records, size_t count,
+    size_t * written = NULL);
+
   bool Read(void * ptr, size_t size);
   bool NextRecordSize(size_t * size);
   bool EndOfFile();
 
+  // Read up to `max_records` records (every remaining record if zero) with as
+  // few system calls as possible. The records are appended back to back to
+  // `data`, and the offset in `data` where each one starts is appended to
+  // `offsets`. Returns true with nothing added at the end of the file.
+  bool ReadBatch(size_t max_records, std::string * data,
+    std::vector<size_t> * offsets);
+
+  // Like ReadBatch() but copy as many of the next `max_records` records as
+  // fit into the `capacity` byte `buffer`. `offsets[i]` is set to where
+  // record i starts and `offsets[*count]` to where the last one ends, so
+  // `offsets` must have room for `max_records + 1` entries, and nothing is
+  // read if `max_records` is zero. Fails with
+  // EMSGSIZE if the next record does not fit at all.
+  bool ReadBatch(size_t max_records, void * buffer, size_t capacity,
+    size_t * offsets, size_t * count);
+
+  // Call `callback` for each remaining record, stopping early after a record
+  // for which it returns non-zero. `data` is only valid during the call.
+  // Sets `*count` to the number of records visited.
+  typedef int (*RecordCallback)(const void * data, size_t size,
+    void * context);
+  bool ForEach(RecordCallback callback, void * context, size_t * count);
+
+  // Copy record `index` into `ptr`, where record 0 is the oldest record
+  // still in the file, or `count` consecutive records starting at `first`.
+  // Only for files with fixed size records; each record takes record_size()
+  // bytes of `ptr`. Neither moves the position Read() reads from. Fails with
+  // ERANGE if the records are not all in the file.
+  bool ReadAt(size_t index, void * ptr);
+  bool ReadRange(size_t first, size_t count, void * ptr);
+
+  // The size of every record, or zero if records can be any size.
+  size_t record_size() const { return record_size_; }
+
+  // True if records never wrap around the end of the data area.
+  bool contiguous() const { return contiguous_; }
+
+  // The alignment of records in the data area, 1 if they are not aligned.
+  size_t alignment() const { return alignment_; }
+
+  // The version of the header, 1 or 2 (see Options::header_version).
+  int header_version() const;
+
+  // The number of records in a file with fixed size records.
+  size_t record_count() const;
+
+  // The size of every block, or zero if records are not grouped into blocks.
+  size_t block_size() const { return block_size_; }
+
+  // The number of blocks in the file, including the one being written.
+  size_t block_count() const;
+
+  // Read the header of block `index`, where block 0 is the oldest, and if
+  // `records` is not NULL the records it describes, each prefixed with its
+  // length as a varint. Blocks can be read and decoded independently, say
+  // by one thread each with its own Ringfile. Fails with ERANGE if there is
+  // no such block and EBADMSG if the records do not match the checksum.
+  // The block being written is described as of the writer's last Flush().
+  bool ReadBlock(size_t index, BlockHeader * header, std::string * records);
+
+  // Make Read() continue from the first record of block `index`, skipping
+  // whole blocks without reading them.
+  bool SeekBlock(size_t index);
+
+  // Resume reading from the named cursor, which is created at the oldest
+  // record if it does not exist yet. Fails with ENOTSUP if the file has no
+  // cursor table and ENOSPC if it is full. The file need not be open for
+  // append, but must be writable by the caller. If records were evicted
+  // since the cursor was last acknowledged, reading starts at the oldest
+  // record and bytes_lost() says how many bytes were missed.
+  bool OpenCursor(const std::string & name);
+
+  // Store the current read position in the open cursor, so that the next
+  // OpenCursor() resumes after every record read so far.
+  bool Ack();
+
+  // Bytes of records that were evicted before the cursor reached them.
+  uint64_t bytes_lost() const { return bytes_lost_; }
+
+  // Delete a cursor, so that a queue no longer waits for it.
+  bool RemoveCursor(const std::string & name);
+
+  // How long a write to a full queue waits for consumers before failing with
+  // EAGAIN: forever if negative (the default), not at all if zero.
+  void set_write_timeout(int timeout_ms) { write_timeout_ms_ = timeout_ms; }
+
+  // Move past the next record without reading it, and set `*offset` to the
+  // position of its body in the file (not the data area) and `*size` to its
+  // length. A body that runs past file_size() continues at data_offset().
+  bool SkipRecord(uint64_t * offset, size_t * size);
+
+  // Block until there is a record to read or `timeout_ms` milliseconds have
+  // passed (forever if negative). Fails with ETIMEDOUT if no record arrived.
+  // Uses inotify where it is available and polls the header otherwise.
+  bool WaitForData(int timeout_ms);
+
+  // Start watching the file for writes. notify_fd() then becomes readable
+  // when new records may have arrived, so that it can be added to a poll()
+  // or event loop. Call HandleNotification() when it is readable.
+  bool WatchForData();
+  int notify_fd() const { return notify_fd_; }
+
+  // Clear pending notifications and return true if a record is available.
+  bool HandleNotification();
+
+  int fd() const { return fd_; }
+  size_t file_size() const { return size_; }
+  size_t data_offset() const { return data_offset_; }
+
+  // Change the size of the file to `size` bytes in place. Growing moves at
+  // most the part of the data that has wrapped around to the start of the
+  // file; shrinking first evicts the oldest records until the rest fit and
+  // then moves at most one contiguous range. The file must be open for
+  // append, and fails with EWOULDBLOCK if another process has it open for
+  // append. Readers attached to the file notice the resize and carry on;
+  // after a shrink they continue from the oldest remaining record.
+  bool Resize(size_t size);
+
+  // Send record writes through io_uring instead of blocking in write(). Write()
+  // then copies each record into a staging buffer and queues it, submitting
+  // `batch_size` records at a time, and the end offset in the header only
+  // moves past a record once it and every record before it have been
+  // written. Returns false (and leaves the file using write()) if io_uring is
+  // not available.
+  bool EnableUring(unsigned queue_depth = 64, unsigned batch_size = 16);
+
+  // Bypass the page cache for record data, so that a ring much bigger than
+  // memory does not evict everything else from it. Writers stage records in
+  // a `block_size` byte block and write it with O_DIRECT once it is full,
+  // moving the end offset past the records in it only then; readers read
+  // the file a block at a time with O_DIRECT, which doubles as readahead.
+  // Fails with EINVAL if the file system does not support O_DIRECT, and
+  // cannot be combined with EnableUring() or EnableReclaimer().
+  bool EnableDirectIO(size_t block_size = 1024 * 1024);
+
+  // Wait until every queued record has been written and published.
+  bool Flush();
+
+  // Fault the whole file into memory through a mapping that is kept until
+  // Close(), so that no read or write takes a page fault, and if `lock` is
+  // true pin it there with mlock(). Transparent huge pages are requested
+  // for the mapping, which the kernel honours for shared memory rings.
+  // Fails with the error from mlock() if the pages cannot be locked, for
+  // example ENOMEM when RLIMIT_MEMLOCK is too small.
+  bool Prefault(bool lock);
+
+  // Start a background thread that evicts the oldest records ahead of time
+  // so that at least `headroom` bytes stay free, and Write() only has to copy
+  // and publish the record instead of evicting first. The file must be open
+  // for append and must not be a queue. The thread stops in Close(). If it
+  // fails to evict a record, the next Write() or Close() fails with its
+  // error.
+  bool EnableReclaimer(size_t headroom);
+
   bool Close();
 
   int error() { return error_; }
@@ -57,25 +400,232 @@ class Ringfile {
   bool StreamingReadFinish();
 
  private:
-  // Set the file pointer to `offset`.
+  // Remove the first record in the file by advancing the start offset to the
+  // next record. Returns true on success. An error goes to `*error` if it is
+  // set, and to error_ otherwise; the reclaimer thread passes its own so
+  // that it never touches error_, which belongs to the writer.
+  bool PopRecord(int * error = NULL);
+
+  // Write `size` bytes at `offset`, wrapping around the end of the file.
   // Note: whenever we refer to a file offset it is relative to beginning of the
   // data area of the file, not relative to the beginning of the file. Also,
   // all offsets are interpreted modulo the data size (bytes_max()).
-  bool SeekToOffset(uint64_t offset);
+  bool WrappingWrite(uint64_t offset, const void * data, size_t size);
 
-  // Remove the first record in the file by advancing the start offset to the
-  // next record. Returns true on success.
-  bool PopRecord();
+  // Publish the end offsets of records that the kernel has finished writing.
+  // If `wait` is true, block until at least one more record is written.
+  bool ReapUring(bool wait);
+  bool WrappingRead(uint64_t offset, void * ptr, size_t size,
+    int * error = NULL);
 
-  bool WrappingWrite(uint64_t offset, const void * data, size_t size);
-  bool WrappingRead(uint64_t offset, void * ptr, size_t size);
+  // Read `size` bytes at `offset` that do not wrap, through direct_ if it is
+  // set.
+  bool ReadData(uint64_t offset, void * ptr, size_t size, int * error = NULL);
+
+  // Copy `size` bytes to the block of direct_ at direct_write_offset_,
+  // writing the block whenever it fills up.
+  bool StageDirect(const void * ptr, size_t size);
+
+  // Write the block of direct_ and publish the records in it.
+  bool FlushDirect();
+
+  // Copy `size` bytes from offset `from` to offset `to`. The ranges may
+  // overlap as long as neither wraps around the end of the file.
+  bool MoveData(uint64_t from, uint64_t to, uint64_t size);
+
+  // The block framed counterparts of PopRecord() and Write().
+  bool PopBlock(int * error = NULL);
+  bool BlockWrite(const void * ptr, size_t size);
+
+  // Write the header of the block being written, close it and start the
+  // next one, and pick up the block being written when a file is opened or
+  // resized.
+  bool WriteBlockHeader();
+  bool StartBlock();
+  bool LoadBlock();
+
+  // Move read_offset_ past block headers and the unused ends of full blocks
+  // to the next record.
+  bool SkipBlockPadding();
+
+  // Move read_offset_ forward to `offset`, and read_position_ with it.
+  void AdvanceReadOffset(uint64_t offset);
+  // Set read_position_ from where read_offset_ is in the data, after
+  // read_offset_ moves anywhere other than forward.
+  void ResetReadPosition();
+
+  // Called by VisitRecords() for each record. Returning false stops the
+  // visit and leaves the record unread.
+  typedef bool (*RecordVisitor)(void * context, const char * data,
+    size_t size);
+
+  // Read records in large chunks and pass each one to `visitor`, up to
+  // `max_records` of them (all of them if zero).
+  bool VisitRecords(size_t max_records, RecordVisitor visitor,
+    void * context);
+
+  // The record paths, as templates over how records are framed (see
+  // record_framing.h). The methods above pick the framing of the file once
+  // and call these.
+  template<class Framing>
+  bool ReadPrefix(const Framing & framing, uint64_t offset, int * prefix_size,
+    size_t * size, int * error = NULL);
+  template<class Framing>
+  bool PopRecord(const Framing & framing, int * error = NULL);
+  template<class Framing>
+  bool Write(const Framing & framing, const void * ptr, size_t size);
+  template<class Framing>
+  bool UringWrite(const Framing & framing, const void * ptr, size_t size);
+  template<class Framing>
+  bool DirectWrite(const Framing & framing, const void * ptr, size_t size);
+  template<class Framing>
+  bool WriteBatch(const Framing & framing, const struct iovec * records,
+    size_t count, size_t * written);
+  template<class Framing>
+  bool Read(const Framing & framing, void * ptr, size_t size);
+  template<class Framing>
+  bool NextRecordSize(const Framing & framing, size_t * size);
+  template<class Framing>
+  bool SkipRecord(const Framing & framing, uint64_t * offset, size_t * size);
+  template<class Framing>
+  bool VisitRecords(const Framing & framing, size_t max_records,
+    RecordVisitor visitor, void * context);
+  template<class Framing>
+  bool StreamingWriteStart(const Framing & framing, size_t size);
+  template<class Framing>
+  size_t StreamingReadStart(const Framing & framing);
+
+  // Returns true if the file was resized since CheckResize() last ran.
+  bool Resized() const;
+
+  // Make sure that more than `size` bytes are free, evicting records if
+  // needed, and ask the reclaimer for more if the headroom is running low.
+  template<class Framing>
+  bool MakeRoom(const Framing & framing, size_t size);
+
+  // With a contiguous framing, if a `size` byte record with the
+  // `header_size` byte prefix in `header_buffer` does not fit between the end
+  // offset and the end of the data area, write a skip marker there, publish
+  // an end offset of 0 and encode the prefix again for offset 0.
+  template<class Framing>
+  bool SkipToStart(const Framing & framing, size_t size,
+    uint8_t * header_buffer, int * header_size);
+
+  // The reclaimer thread.
+  static void * ReclaimerMain(void * context);
+  void RunReclaimer();
+  // If the reclaimer thread has failed since the last call, move its error
+  // to error_ and return true.
+  bool TakeReclaimerError();
+
+  // Wait for a resize in progress to finish.
+  void WaitForResize();
+
+  // Point start_offset_ and end_offset_ at the offsets in header_.
+  void MapOffsets();
+
+  // The body of Resize(), called with the file locked exclusively.
+  bool ResizeLocked(size_t size);
+
+  // Renumber the logical positions in the cursor table to match a data area
+  // of `new_bytes_max` bytes that starts at `start_offset`, and move every
+  // current cursor to resize generation `generation`.
+  void RebaseCursors(uint64_t new_bytes_max, uint64_t start_offset,
+    uint32_t generation);
+
+  // The resize generation that Ack() records.
+  uint32_t cursor_generation() const;
+
+  // Get a writable view of the cursor table, locked against changes to the
+  // set of cursors by other processes, and release it again.
+  bool LockCursors(int * fd, CursorTable ** table);
+  void UnlockCursors(int fd);
+
+  // The logical position of the cursor furthest behind, which in a queue is
+  // as far as records may be evicted.
+  uint64_t SlowestCursor() const;
+
+  // Wait until every cursor has read past `position`, or the write timeout.
+  bool WaitForConsumers(uint64_t position);
+
+  // Tell writers waiting in WaitForConsumers() to look at the cursors again.
+  void WakeWriters(CursorTable * table);
+
+  // Check whether the file has been resized since we last looked, and if so
+  // pick up the new size and translate read_offset_ to match. Returns false
+  // if a resize is in progress.
+  bool CheckResize();
 
   int fd_;
   bool fd_is_owned_;
+  // Whether fd_ holds the appenders' shared lock, which Close() has to drop
+  // itself when the descriptor is not ours to close.
+  bool fd_locked_;
   int error_;
   size_t size_;
   Header * header_;
+  // The header is mapped from the start of the file up to data_offset_.
+  size_t data_offset_;
+  // Where the HeaderExtension is, and the start and end offsets in header_,
+  // which are in different places in a HeaderV2.
+  size_t extension_offset_;
+  uint64_t * start_offset_;
+  uint64_t * end_offset_;
+  size_t record_size_;
+  size_t block_size_;
+  bool contiguous_;
+  size_t alignment_;
+
+  // The header of the block being written, which starts at block_offset_,
+  // if block_started_.
+  BlockHeader block_;
+  uint64_t block_offset_;
+  bool block_started_;
+
+  // The end of the records of the full block at read_block_offset_, which
+  // SkipBlockPadding() read from its header.
+  uint64_t read_block_offset_;
+  uint64_t read_block_end_;
+  Mode mode_;
+
+  // The cursor table in header_, and the cursor opened by OpenCursor(). For
+  // files open for reading the cursor lives in a separate writable mapping
+  // of the header, cursor_map_.
+  CursorTable * cursor_table_;
+  Cursor * cursor_;
+  void * cursor_map_;
+  // The writable cursor table that cursor_ is in.
+  CursorTable * ack_table_;
+  uint64_t bytes_lost_;
+  int write_timeout_ms_;
   uint64_t read_offset_;
+  // The logical position of read_offset_, which Ack() stores. It keeps
+  // counting when a writer laps the reader, so it never ends up ahead of
+  // the data.
+  uint64_t read_position_;
+  uint32_t resize_flags_;
+  int notify_fd_;
+
+  UringWriter * uring_;
+  // The offset after the last record queued to uring_, which is ahead of
+  // header_->end_offset while writes are in flight.
+  uint64_t uring_write_offset_;
+
+  DirectIO * direct_;
+  // The offset after the last byte staged in direct_, and after the last
+  // whole record staged there, which header_->end_offset catches up with
+  // when the block is written.
+  uint64_t direct_write_offset_;
+  uint64_t direct_record_end_;
+
+  // The mapping of the whole file made by Prefault().
+  void * prefault_map_;
+  size_t prefault_size_;
+  bool prefault_locked_;
+
+  // Set by EnableReclaimer(). Its mutex serializes evicting records between
+  // the reclaimer thread and the writer.
+  Reclaimer * reclaimer_;
 
   uint64_t streaming_write_offset_;
   uint64_t streaming_write_bytes_remaining_;
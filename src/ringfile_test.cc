@@ -2,10 +2,25 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include <errno.h>
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <poll.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
 
 #include "ringfile_internal.h"
 #include "test_util.h"
+#include "typed_ringfile.h"
+#include "uring_writer.h"
 
 TEST(RingfileTest, CannotOpenBogusPath) {
   std::string path = TempDir() + "/does not exist/ring";
@@ -213,7 +228,8 @@ TEST(RingfileTest, CircularWriteStreaming) {
 
     EXPECT_EQ(16, ringfile.StreamingReadStart());
 
-    char buffer[5];
+    char buffer[6];
+    buffer[5] = 0;
     EXPECT_EQ(5, ringfile.StreamingRead(&buffer, 5));
     EXPECT_STREQ("defGo", buffer);
 
@@ -555,3 +571,1289 @@ TEST(RingfileTest, CanAppendEdgeStreaming) {
     EXPECT_EQ(-1, next_record_size);
   }
 }
+
+namespace {
+
+std::string ReadRecord(Ringfile * ringfile) {
+  size_t size;
+  if (!ringfile->NextRecordSize(&size)) {
+    return "<eof>";
+  }
+  std::string buffer;
+  buffer.resize(size);
+  if (!ringfile->Read(const_cast<char *>(buffer.c_str()), size)) {
+    return "<error>";
+  }
+  return buffer;
+}
+
+}  // anonymous namespace
+
+// This test checks that growing a file whose records wrap around moves only
+// the wrapped part, and that a reader that is attached at the time carries on
+// from where it was.
+TEST(RingfileTest, CanGrowWrappedFile) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 50));
+  ASSERT_TRUE(writer.Write("abcHello, World!", 16));
+  ASSERT_TRUE(writer.Write("defGoodbye, Bob!", 16));
+  ASSERT_TRUE(writer.Write("ghi", 3));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ("defGoodbye, Bob!", ReadRecord(&reader));
+
+  ASSERT_TRUE(writer.Resize(74));
+  EXPECT_EQ(50, writer.bytes_max());
+  EXPECT_EQ(21, writer.bytes_used());
+
+  EXPECT_EQ(std::string(
+    "RING"  // magic number
+    "\x00\x00\x00\x01"  // flags (one resize)
+    "\x11\x00\x00\x00\x00\x00\x00\x00"  // start offset
+    "\x26\x00\x00\x00\x00\x00\x00\x00"  // end offset
+    "ye, Bob!" "\x03" "ghi"  // old wrapped data
+    "orld!"  // leftover from hello world
+    "\x10" "defGoodb"  // beginning of message
+    "ye, Bob!" "\x03" "ghi"  // moved wrapped data
+    , 62), GetFileContents(path).substr(0, 62));
+
+  EXPECT_EQ("ghi", ReadRecord(&reader));
+  ASSERT_TRUE(writer.Write("0123456789", 10));
+  EXPECT_EQ("0123456789", ReadRecord(&reader));
+  EXPECT_EQ("<eof>", ReadRecord(&reader));
+
+  Ringfile fresh;
+  ASSERT_TRUE(fresh.Open(path, Ringfile::kRead));
+  EXPECT_EQ("defGoodbye, Bob!", ReadRecord(&fresh));
+  EXPECT_EQ("ghi", ReadRecord(&fresh));
+  EXPECT_EQ("0123456789", ReadRecord(&fresh));
+  EXPECT_EQ("<eof>", ReadRecord(&fresh));
+}
+
+TEST(RingfileTest, CanGrowFileWrappedPastTheGrowth) {
+  std::string path = TempDir() + "/ring";
+
+  // More wraps around than the ring grows by, and more than MoveData()
+  // copies at once.
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 1000000));
+  std::string record(998, 0);
+  for (int i = 0; i < 1700; ++i) {
+    snprintf(&record[0], record.size(), "%d", i);
+    ASSERT_TRUE(writer.Write(record.data(), record.size()));
+  }
+  ASSERT_TRUE(writer.Resize(1100000));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  int first = -1;
+  int count = 0;
+  size_t size;
+  while (reader.NextRecordSize(&size)) {
+    ASSERT_EQ(record.size(), size);
+    std::string data(size, 0);
+    ASSERT_TRUE(reader.Read(&data[0], size));
+    int i = atoi(data.c_str());
+    if (first == -1) {
+      first = i;
+    }
+    snprintf(&record[0], record.size(), "%d", i);
+    ASSERT_EQ(first + count, i);
+    ASSERT_EQ(record, data);
+    ++count;
+  }
+  EXPECT_EQ(1700, first + count);
+  EXPECT_LT(700, count);
+}
+
+// This test checks that shrinking a file drops the oldest records that no
+// longer fit and keeps the rest.
+TEST(RingfileTest, CanShrinkFile) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 124));
+  for (char c = 'a'; c <= 'j'; ++c) {
+    std::string message(11, c);
+    ASSERT_TRUE(writer.Write(message.c_str(), message.size()));
+  }
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ(std::string(11, 'c'), ReadRecord(&reader));
+
+  ASSERT_TRUE(writer.Resize(64));
+  EXPECT_EQ(40, writer.bytes_max());
+  EXPECT_EQ(36, writer.bytes_used());
+  EXPECT_EQ(64, GetFileContents(path).size());
+
+  // The reader lost its place and starts again at the oldest record.
+  for (char c = 'h'; c <= 'j'; ++c) {
+    EXPECT_EQ(std::string(11, c), ReadRecord(&reader));
+  }
+  EXPECT_EQ("<eof>", ReadRecord(&reader));
+
+  ASSERT_TRUE(writer.Write("ijk", 3));
+  Ringfile fresh;
+  ASSERT_TRUE(fresh.Open(path, Ringfile::kRead));
+  EXPECT_EQ(std::string(11, 'i'), ReadRecord(&fresh));
+  EXPECT_EQ(std::string(11, 'j'), ReadRecord(&fresh));
+  EXPECT_EQ("ijk", ReadRecord(&fresh));
+  EXPECT_EQ("<eof>", ReadRecord(&fresh));
+}
+
+TEST(RingfileTest, CannotResizeWhileAnotherAppenderIsOpen) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 50));
+
+  {
+    Ringfile other;
+    ASSERT_TRUE(other.Open(path, Ringfile::kAppend));
+    EXPECT_FALSE(writer.Resize(100));
+    EXPECT_EQ(EWOULDBLOCK, writer.error());
+  }
+
+  // The failed resize kept the writer's shared lock.
+  int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_NE(-1, fd);
+  EXPECT_EQ(-1, flock(fd, LOCK_EX|LOCK_NB));
+  close(fd);
+
+  EXPECT_TRUE(writer.Resize(100));
+  EXPECT_FALSE(writer.Resize(10));
+  EXPECT_EQ(EINVAL, writer.error());
+}
+
+// This test checks that records written through io_uring end up exactly where
+// the synchronous path puts them, including while evicting records that are
+// still in flight.
+TEST(RingfileTest, UringWritesMatchSynchronousWrites) {
+  std::string sync_path = TempDir() + "/sync";
+  std::string uring_path = TempDir() + "/uring";
+
+  Ringfile sync_ringfile;
+  ASSERT_TRUE(sync_ringfile.Create(sync_path, 4096));
+
+  Ringfile uring_ringfile;
+  ASSERT_TRUE(uring_ringfile.Create(uring_path, 4096));
+  if (!uring_ringfile.EnableUring(8, 4)) {
+    // Writes keep working without io_uring
+    EXPECT_NE(0, uring_ringfile.error());
+  }
+
+  for (int i = 0; i < 2000; ++i) {
+    std::string message(i % 97, 'a' + i % 26);
+    message += "record";
+    ASSERT_TRUE(sync_ringfile.Write(message.c_str(), message.size()));
+    ASSERT_TRUE(uring_ringfile.Write(message.c_str(), message.size()))
+      << strerror(uring_ringfile.error());
+  }
+  ASSERT_TRUE(uring_ringfile.Flush());
+
+  EXPECT_EQ(sync_ringfile.bytes_used(), uring_ringfile.bytes_used());
+  EXPECT_TRUE(GetFileContents(sync_path) == GetFileContents(uring_path));
+
+  // A record too big for a small ring is still refused
+  std::string big(5000, 'x');
+  EXPECT_FALSE(uring_ringfile.Write(big.c_str(), big.size()));
+
+  uring_ringfile.Close();
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(uring_path, Ringfile::kRead));
+  std::string last;
+  while (!reader.EndOfFile()) {
+    last = ReadRecord(&reader);
+  }
+  EXPECT_EQ(std::string(1999 % 97, 'a' + 1999 % 26) + "record", last);
+}
+
+TEST(RingfileTest, UringWriterDropsWritesAfterAFailure) {
+  std::string path = TempDir() + "/file";
+  int fd = open(path.c_str(), O_RDONLY|O_CREAT, 0644);
+  ASSERT_NE(-1, fd);
+
+  UringWriter writer;
+  if (!writer.Init(fd, 8, 4096, 1)) {
+    EXPECT_NE(0, writer.error());
+    close(fd);
+    return;
+  }
+
+  // Writes to a read-only descriptor fail.
+  struct iovec data;
+  data.iov_base = const_cast<char *>("abc");
+  data.iov_len = 3;
+  UringWriter::Piece piece;
+  piece.offset = 0;
+  piece.size = 3;
+  ASSERT_TRUE(writer.Queue(&data, 1, &piece, 1, 1));
+  piece.offset = 3;
+  ASSERT_TRUE(writer.Queue(&data, 1, &piece, 1, 2));
+
+  uint64_t tag = 0;
+  EXPECT_FALSE(writer.Drain(&tag));
+  EXPECT_EQ(EBADF, writer.error());
+  EXPECT_EQ(0U, tag);
+
+  // The error is reported once and nothing is left waiting behind it.
+  EXPECT_FALSE(writer.busy());
+  EXPECT_TRUE(writer.Drain(&tag));
+  EXPECT_EQ(0U, tag);
+  close(fd);
+}
+
+// This test checks that ReadBatch() returns the same records as reading them
+// one at a time, across the wrap point and for records bigger than the chunk
+// it reads the file in.
+TEST(RingfileTest, CanReadBatch) {
+  std::string path = TempDir() + "/ring";
+  std::vector<std::string> expected;
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.Create(path, 4096));
+    for (int i = 0; i < 500; ++i) {
+      std::string message(1 + i % 31, 'a' + i % 26);
+      ASSERT_TRUE(ringfile.Write(message.c_str(), message.size()));
+    }
+  }
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.Open(path, Ringfile::kRead));
+    while (!ringfile.EndOfFile()) {
+      expected.push_back(ReadRecord(&ringfile));
+    }
+  }
+
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Open(path, Ringfile::kRead));
+  std::string data;
+  std::vector<size_t> offsets;
+  ASSERT_TRUE(ringfile.ReadBatch(10, &data, &offsets));
+  ASSERT_EQ(10U, offsets.size());
+  ASSERT_TRUE(ringfile.ReadBatch(0, &data, &offsets));
+  ASSERT_EQ(expected.size(), offsets.size());
+  offsets.push_back(data.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], data.substr(offsets[i], offsets[i + 1] -
+      offsets[i]));
+  }
+  EXPECT_TRUE(ringfile.EndOfFile());
+  ASSERT_TRUE(ringfile.ReadBatch(0, &data, &offsets));
+  EXPECT_EQ(expected.size() + 1, offsets.size());
+
+  std::string big_path = TempDir() + "/big";
+  std::string big(300 * 1024, 'x');
+  {
+    Ringfile writer;
+    ASSERT_TRUE(writer.Create(big_path, 1024 * 1024));
+    ASSERT_TRUE(writer.Write("small", 5));
+    ASSERT_TRUE(writer.Write(big.c_str(), big.size()));
+    ASSERT_TRUE(writer.Write("small", 5));
+  }
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(big_path, Ringfile::kRead));
+  data.clear();
+  offsets.clear();
+  ASSERT_TRUE(reader.ReadBatch(0, &data, &offsets));
+  ASSERT_EQ(3U, offsets.size());
+  EXPECT_EQ("small" + big + "small", data);
+}
+
+TEST(RingfileTest, CanSkipRecords) {
+  std::string path = TempDir() + "/ring";
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 64));
+  ASSERT_TRUE(ringfile.Write("0123456789", 10));
+  ASSERT_TRUE(ringfile.Write("abcdefghijklmnopqrst", 20));
+  // This evicts the first record and wraps around the end of the file.
+  ASSERT_TRUE(ringfile.Write("ABCDEFGHIJKLMNO", 15));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  std::string contents = GetFileContents(path);
+  uint64_t offset;
+  size_t size;
+  ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+  EXPECT_EQ(36U, offset);
+  EXPECT_EQ(20U, size);
+  EXPECT_EQ("abcdefghijklmnopqrst", contents.substr(offset, size));
+  ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+  EXPECT_EQ(57U, offset);
+  EXPECT_EQ(15U, size);
+  size_t tail = reader.file_size() - offset;
+  EXPECT_EQ("ABCDEFGHIJKLMNO",
+    contents.substr(offset, tail) +
+    contents.substr(reader.data_offset(), size - tail));
+  EXPECT_FALSE(reader.SkipRecord(&offset, &size));
+  EXPECT_TRUE(reader.EndOfFile());
+}
+
+TEST(RingfileTest, ContiguousRecordsNeverWrap) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.contiguous = true;
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 64, options));
+  EXPECT_FALSE(ringfile.EnableUring());
+  ASSERT_TRUE(ringfile.Write("0123456789", 10));
+  ASSERT_TRUE(ringfile.Write("abcdefghijklmnopqrst", 20));
+  // This does not fit before the end of the file, so it goes at the start,
+  // evicting both records.
+  ASSERT_TRUE(ringfile.Write("ABCDEFGHIJKLMNO", 15));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_TRUE(reader.contiguous());
+  std::string contents = GetFileContents(path);
+  uint64_t offset;
+  size_t size;
+  ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+  EXPECT_EQ(reader.data_offset() + 1, offset);
+  EXPECT_EQ("ABCDEFGHIJKLMNO", contents.substr(offset, size));
+  EXPECT_FALSE(reader.SkipRecord(&offset, &size));
+  EXPECT_TRUE(reader.EndOfFile());
+  ASSERT_TRUE(ringfile.Close());
+  ASSERT_TRUE(reader.Close());
+
+  // Go around a bigger file a few times with records of different sizes.
+  std::string big_path = TempDir() + "/big";
+  ASSERT_TRUE(ringfile.Create(big_path, 1000, options));
+  for (int i = 0; i < 500; ++i) {
+    std::string record(i % 37, 'x');
+    char number[16];
+    snprintf(number, sizeof(number), "%d:", i);
+    record.insert(0, number);
+    ASSERT_TRUE(ringfile.Write(record.data(), record.size()));
+  }
+  ASSERT_TRUE(ringfile.Resize(1500));
+
+  // Every record is in one piece, and the records are in order whether
+  // they are read one at a time or in batches.
+  ASSERT_TRUE(reader.Open(big_path, Ringfile::kRead));
+  std::vector<std::string> records;
+  while (!reader.EndOfFile()) {
+    ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+    EXPECT_LE(offset + size, reader.file_size());
+  }
+  ASSERT_TRUE(reader.Close());
+  ASSERT_TRUE(reader.Open(big_path, Ringfile::kRead));
+  while (!reader.EndOfFile()) {
+    records.push_back(ReadRecord(&reader));
+  }
+  ASSERT_FALSE(records.empty());
+  EXPECT_EQ(0u, records.back().find("499:"));
+  for (size_t i = 1; i < records.size(); ++i) {
+    EXPECT_EQ(atoi(records[i - 1].c_str()) + 1, atoi(records[i].c_str()));
+  }
+
+  ASSERT_TRUE(reader.Close());
+  ASSERT_TRUE(reader.Open(big_path, Ringfile::kRead));
+  std::string data;
+  std::vector<size_t> offsets;
+  ASSERT_TRUE(reader.ReadBatch(0, &data, &offsets));
+  ASSERT_EQ(records.size(), offsets.size());
+  offsets.push_back(data.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(records[i], data.substr(offsets[i], offsets[i + 1] - offsets[i]));
+  }
+}
+
+// This test checks that WriteBatch() leaves the file exactly as writing the
+// same records one at a time would, including empty records and batches
+// bigger than the file.
+TEST(RingfileTest, WriteBatchMatchesWrites) {
+  std::string path = TempDir() + "/ring";
+  std::string batch_path = TempDir() + "/batch";
+
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 1024));
+  Ringfile batch_ringfile;
+  ASSERT_TRUE(batch_ringfile.Create(batch_path, 1024));
+
+  std::vector<std::string> messages;
+  for (int i = 0; i < 500; ++i) {
+    messages.push_back(std::string(i % 43, 'a' + i % 26));
+    ASSERT_TRUE(ringfile.Write(messages.back().c_str(),
+      messages.back().size()));
+  }
+
+  size_t batch_sizes[] = {1, 7, 0, 60, 2, 430};
+  size_t written = 0;
+  for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++i) {
+    std::vector<struct iovec> records(batch_sizes[i] + 1);
+    for (size_t j = 0; j < batch_sizes[i]; ++j) {
+      records[j].iov_base = const_cast<char *>(messages[written + j].c_str());
+      records[j].iov_len = messages[written + j].size();
+    }
+    ASSERT_TRUE(batch_ringfile.WriteBatch(&records[0], batch_sizes[i]));
+    written += batch_sizes[i];
+  }
+  ASSERT_EQ(messages.size(), written);
+  EXPECT_TRUE(GetFileContents(path) == GetFileContents(batch_path));
+
+  struct iovec big;
+  std::string big_message(2000, 'x');
+  big.iov_base = const_cast<char *>(big_message.c_str());
+  big.iov_len = big_message.size();
+  size_t batch_written = 1;
+  EXPECT_FALSE(batch_ringfile.WriteBatch(&big, 1, &batch_written));
+  EXPECT_EQ(EMSGSIZE, batch_ringfile.error());
+  EXPECT_EQ(0u, batch_written);
+}
+
+namespace {
+
+void * WriteAfterDelay(void * context) {
+  Ringfile * ringfile = static_cast<Ringfile *>(context);
+  usleep(50 * 1000);
+  ringfile->Write("late", 4);
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST(RingfileTest, CanWaitForData) {
+  std::string path = TempDir() + "/ring";
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 1024));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_FALSE(reader.WaitForData(20));
+  EXPECT_EQ(ETIMEDOUT, reader.error());
+
+  ASSERT_TRUE(writer.Write("early", 5));
+  ASSERT_TRUE(reader.WaitForData(-1));
+  EXPECT_EQ("early", ReadRecord(&reader));
+
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, &WriteAfterDelay, &writer));
+  EXPECT_TRUE(reader.WaitForData(5000)) << strerror(reader.error());
+  EXPECT_EQ("late", ReadRecord(&reader));
+  pthread_join(thread, NULL);
+
+  // The notification descriptor can be polled directly.
+  if (reader.WatchForData()) {
+    EXPECT_FALSE(reader.HandleNotification());
+    ASSERT_TRUE(writer.Write("polled", 6));
+    struct pollfd pfd;
+    pfd.fd = reader.notify_fd();
+    pfd.events = POLLIN;
+    EXPECT_EQ(1, poll(&pfd, 1, 5000));
+    EXPECT_TRUE(reader.HandleNotification());
+    EXPECT_EQ("polled", ReadRecord(&reader));
+    EXPECT_FALSE(reader.HandleNotification());
+  }
+}
+
+TEST(RingfileTest, CanAdoptFileDescriptor) {
+  std::string path = TempDir() + "/ring";
+  int fd = open(path.c_str(), O_RDWR|O_CREAT|O_EXCL, 0644);
+  ASSERT_NE(-1, fd);
+
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.CreateFd(fd, 1024, false));
+    ASSERT_TRUE(ringfile.Write("Hello, World!", 13));
+    ASSERT_TRUE(ringfile.Close());
+  }
+  // We kept ownership, so the descriptor is still open, and its file offset
+  // was never used.
+  EXPECT_EQ(0, lseek(fd, 0, SEEK_CUR));
+
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.OpenFd(fd, Ringfile::kRead, true));
+  EXPECT_EQ(fd, ringfile.fd());
+  EXPECT_EQ("Hello, World!", ReadRecord(&ringfile));
+  ASSERT_TRUE(ringfile.Close());
+  EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+}
+
+TEST(RingfileTest, AdoptedDescriptorDoesNotKeepTheLock) {
+  std::string path = TempDir() + "/ring";
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.Create(path, 1024));
+  }
+  int fd = open(path.c_str(), O_RDWR);
+  ASSERT_NE(-1, fd);
+
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.OpenFd(fd, Ringfile::kAppend, false));
+    ASSERT_TRUE(ringfile.Write("Hello, World!", 13));
+    ASSERT_TRUE(ringfile.Close());
+  }
+  {
+    Ringfile ringfile;
+    ASSERT_TRUE(ringfile.Open(path, Ringfile::kAppend));
+    EXPECT_TRUE(ringfile.Resize(2048));
+  }
+
+  // Nor does a descriptor that fails to open as a ring.
+  std::string bogus_path = TempDir() + "/bogus";
+  int bogus_fd = open(bogus_path.c_str(), O_RDWR|O_CREAT|O_EXCL, 0644);
+  ASSERT_NE(-1, bogus_fd);
+  ASSERT_EQ(4096, write(bogus_fd, std::string(4096, 'x').data(), 4096));
+  {
+    Ringfile ringfile;
+    EXPECT_FALSE(ringfile.OpenFd(bogus_fd, Ringfile::kAppend, false));
+  }
+  int other_fd = open(bogus_path.c_str(), O_RDONLY);
+  ASSERT_NE(-1, other_fd);
+  EXPECT_EQ(0, flock(other_fd, LOCK_EX|LOCK_NB));
+  close(other_fd);
+  close(bogus_fd);
+  close(fd);
+}
+
+// This test checks that an anonymous shared memory ring can be written by a
+// forked child through the inherited descriptor and read by the parent.
+TEST(RingfileTest, CanShareAnonymousRingWithChild) {
+  Ringfile ringfile;
+  if (!ringfile.CreateShm(NULL, 64 * 1024)) {
+    EXPECT_EQ(ENOSYS, ringfile.error());
+    return;
+  }
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    for (int i = 0; i < 100; ++i) {
+      char message[16];
+      snprintf(message, sizeof(message), "message %d", i);
+      if (!ringfile.Write(message, strlen(message))) {
+        _exit(1);
+      }
+    }
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_EQ(0, status);
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.OpenFd(ringfile.fd(), Ringfile::kRead, false));
+  for (int i = 0; i < 100; ++i) {
+    char message[16];
+    snprintf(message, sizeof(message), "message %d", i);
+    EXPECT_EQ(message, ReadRecord(&reader));
+  }
+  EXPECT_TRUE(reader.EndOfFile());
+}
+
+TEST(RingfileTest, CanOpenNamedSharedMemoryRing) {
+  char name[64];
+  snprintf(name, sizeof(name), "/ringfile-test-%d", getpid());
+
+  Ringfile writer;
+  ASSERT_TRUE(writer.CreateShm(name, 4096)) << strerror(writer.error());
+  ASSERT_TRUE(writer.Write("shared", 6));
+
+  Ringfile other_writer;
+  EXPECT_FALSE(other_writer.CreateShm(name, 4096));
+  EXPECT_EQ(EEXIST, other_writer.error());
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.OpenShm(name, Ringfile::kRead));
+  EXPECT_EQ("shared", ReadRecord(&reader));
+  EXPECT_EQ(0, shm_unlink(name));
+
+  // The ring lives on while it is open.
+  ASSERT_TRUE(writer.Write("still there", 11));
+  EXPECT_EQ("still there", ReadRecord(&reader));
+}
+
+TEST(RingfileTest, FixedSizeRecordsHaveNoLengthPrefix) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.record_size = 4;
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 64, options));
+  EXPECT_EQ(32U, ringfile.data_offset());
+  EXPECT_EQ(4U, ringfile.record_size());
+  ASSERT_TRUE(ringfile.Write("abcd", 4));
+  EXPECT_FALSE(ringfile.Write("abc", 3));
+  EXPECT_EQ(EINVAL, ringfile.error());
+  ASSERT_TRUE(ringfile.Close());
+
+  EXPECT_EQ(std::string(
+    "RING"  // magic number
+    "\x03\x00\x00\x00"  // flags
+    "\x00\x00\x00\x00\x00\x00\x00\x00"  // start offset
+    "\x04\x00\x00\x00\x00\x00\x00\x00"  // end offset
+    "\x20\x00\x00\x00"  // data offset
+    "\x04\x00\x00\x00"  // record size
+    "abcd", 36), GetFileContents(path).substr(0, 36));
+
+  ASSERT_TRUE(ringfile.Open(path, Ringfile::kRead));
+  EXPECT_EQ(4U, ringfile.record_size());
+  EXPECT_EQ(1U, ringfile.record_count());
+  EXPECT_EQ("abcd", ReadRecord(&ringfile));
+}
+
+TEST(RingfileTest, CanReadFixedSizeRecordsByIndex) {
+  std::string path = TempDir() + "/ring";
+
+  // 32 bytes of data hold seven 4 byte records, since one byte stays free.
+  Ringfile::Options options;
+  options.record_size = 4;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 64, options));
+  for (int i = 0; i < 20; ++i) {
+    char record[5];
+    snprintf(record, sizeof(record), "r%03d", i);
+    ASSERT_TRUE(writer.Write(record, 4));
+  }
+  EXPECT_EQ(7U, writer.record_count());
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  char record[4];
+  ASSERT_TRUE(reader.ReadAt(0, record));
+  EXPECT_EQ("r013", std::string(record, 4));
+  ASSERT_TRUE(reader.ReadAt(6, record));
+  EXPECT_EQ("r019", std::string(record, 4));
+  EXPECT_FALSE(reader.ReadAt(7, record));
+  EXPECT_EQ(ERANGE, reader.error());
+
+  // The range wraps around the end of the data area.
+  char range[7 * 4];
+  ASSERT_TRUE(reader.ReadRange(0, 7, range));
+  EXPECT_EQ("r013r014r015r016r017r018r019", std::string(range, sizeof(range)));
+  EXPECT_FALSE(reader.ReadRange(5, 3, range));
+
+  // Random access leaves sequential reads alone.
+  for (int i = 13; i < 20; ++i) {
+    char expected[5];
+    snprintf(expected, sizeof(expected), "r%03d", i);
+    EXPECT_EQ(expected, ReadRecord(&reader));
+  }
+  EXPECT_TRUE(reader.EndOfFile());
+}
+
+TEST(RingfileTest, CannotReadVariableSizeRecordsByIndex) {
+  std::string path = TempDir() + "/ring";
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 64));
+  ASSERT_TRUE(ringfile.Write("abcd", 4));
+  char record[4];
+  EXPECT_FALSE(ringfile.ReadAt(0, record));
+  EXPECT_EQ(EINVAL, ringfile.error());
+}
+
+namespace {
+
+struct Sample {
+  uint32_t sensor;
+  double value;
+};
+
+}  // anonymous namespace
+
+TEST(RingfileTest, TypedRingfileChecksRecordSize) {
+  std::string path = TempDir() + "/ring";
+  {
+    TypedRingfile<Sample> ring;
+    ASSERT_TRUE(ring.Create(path, 4096));
+    for (uint32_t i = 0; i < 10; ++i) {
+      Sample sample = { i, i * 0.5 };
+      ASSERT_TRUE(ring.Write(sample));
+    }
+    EXPECT_EQ(10U, ring.size());
+  }
+
+  TypedRingfile<Sample> ring;
+  ASSERT_TRUE(ring.Open(path, Ringfile::kRead));
+  Sample sample;
+  ASSERT_TRUE(ring.ReadAt(9, &sample));
+  EXPECT_EQ(9U, sample.sensor);
+  EXPECT_EQ(4.5, sample.value);
+  Sample samples[3];
+  ASSERT_TRUE(ring.ReadRange(2, 3, samples));
+  EXPECT_EQ(4U, samples[2].sensor);
+  ASSERT_TRUE(ring.Read(&sample));
+  EXPECT_EQ(0U, sample.sensor);
+
+  TypedRingfile<uint64_t> wrong;
+  EXPECT_FALSE(wrong.Open(path, Ringfile::kRead));
+  EXPECT_EQ(EINVAL, wrong.error());
+}
+
+TEST(RingfileTest, CanResumeFromCursor) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 2;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 1024, options));
+  ASSERT_TRUE(writer.Write("one", 3));
+  ASSERT_TRUE(writer.Write("two", 3));
+  ASSERT_TRUE(writer.Write("three", 5));
+
+  {
+    Ringfile reader;
+    ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+    ASSERT_TRUE(reader.OpenCursor("shipper"));
+    EXPECT_EQ("one", ReadRecord(&reader));
+    ASSERT_TRUE(reader.Ack());
+    EXPECT_EQ("two", ReadRecord(&reader));
+  }
+
+  // Only the acknowledged record is skipped.
+  {
+    Ringfile reader;
+    ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+    ASSERT_TRUE(reader.OpenCursor("shipper"));
+    EXPECT_EQ(0U, reader.bytes_lost());
+    EXPECT_EQ("two", ReadRecord(&reader));
+    EXPECT_EQ("three", ReadRecord(&reader));
+    ASSERT_TRUE(reader.Ack());
+  }
+
+  // A new cursor starts at the oldest record.
+  {
+    Ringfile reader;
+    ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+    ASSERT_TRUE(reader.OpenCursor("indexer"));
+    EXPECT_EQ("one", ReadRecord(&reader));
+    EXPECT_FALSE(reader.OpenCursor("archiver"));
+    EXPECT_EQ(ENOSPC, reader.error());
+  }
+
+  ASSERT_TRUE(writer.Write("four", 4));
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("shipper"));
+  EXPECT_EQ("four", ReadRecord(&reader));
+  EXPECT_TRUE(reader.EndOfFile());
+}
+
+TEST(RingfileTest, CursorDetectsLostRecords) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 1;
+  Ringfile writer;
+  // A 96 byte header with one cursor, and 32 bytes of data.
+  ASSERT_TRUE(writer.Create(path, 96 + 32, options));
+  ASSERT_TRUE(writer.OpenCursor("shipper"));
+  ASSERT_TRUE(writer.Write("aaa", 3));
+  EXPECT_EQ("aaa", ReadRecord(&writer));
+  ASSERT_TRUE(writer.Ack());
+
+  // Lap the cursor: 20 records of 4 bytes each go through 31 bytes of data.
+  for (int i = 0; i < 20; ++i) {
+    char record[4];
+    snprintf(record, sizeof(record), "%03d", i);
+    ASSERT_TRUE(writer.Write(record, 3));
+  }
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("shipper"));
+  EXPECT_EQ(13U * 4, reader.bytes_lost());
+  EXPECT_EQ("013", ReadRecord(&reader));
+}
+
+TEST(RingfileTest, LappedReaderAcksWhereItWas) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 1;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 96 + 32, options));
+  ASSERT_TRUE(writer.Write("aaa", 3));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("shipper"));
+  EXPECT_EQ("aaa", ReadRecord(&reader));
+
+  for (int i = 0; i < 20; ++i) {
+    char record[4];
+    snprintf(record, sizeof(record), "%03d", i);
+    ASSERT_TRUE(writer.Write(record, 3));
+  }
+
+  // The acknowledged position is behind the oldest record, not somewhere in
+  // the ring that happens to be at the same offset.
+  ASSERT_TRUE(reader.Ack());
+  Ringfile resumed;
+  ASSERT_TRUE(resumed.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(resumed.OpenCursor("shipper"));
+  EXPECT_EQ(13U * 4, resumed.bytes_lost());
+  EXPECT_EQ("013", ReadRecord(&resumed));
+}
+
+TEST(RingfileTest, CursorsSurviveResize) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 1;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 96 + 32, options));
+  for (int i = 0; i < 10; ++i) {
+    char record[4];
+    snprintf(record, sizeof(record), "%03d", i);
+    ASSERT_TRUE(writer.Write(record, 3));
+  }
+
+  {
+    Ringfile reader;
+    ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+    ASSERT_TRUE(reader.OpenCursor("shipper"));
+    EXPECT_EQ("003", ReadRecord(&reader));
+    EXPECT_EQ("004", ReadRecord(&reader));
+    ASSERT_TRUE(reader.Ack());
+  }
+
+  // Growing the wrapped ring moves the oldest records.
+  ASSERT_TRUE(writer.Resize(1024));
+  ASSERT_TRUE(writer.Write("010", 3));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("shipper"));
+  EXPECT_EQ(0U, reader.bytes_lost());
+  for (int i = 5; i <= 10; ++i) {
+    char record[4];
+    snprintf(record, sizeof(record), "%03d", i);
+    EXPECT_EQ(record, ReadRecord(&reader));
+  }
+  EXPECT_TRUE(reader.EndOfFile());
+}
+
+TEST(RingfileTest, CannotOpenCursorWithoutCursorTable) {
+  std::string path = TempDir() + "/ring";
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 1024));
+  EXPECT_FALSE(ringfile.OpenCursor("shipper"));
+  EXPECT_EQ(ENOTSUP, ringfile.error());
+  EXPECT_FALSE(ringfile.Ack());
+}
+
+TEST(RingfileTest, QueueWaitsForConsumers) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 1;
+  options.queue = true;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 96 + 32, options));
+  writer.set_write_timeout(0);
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("consumer"));
+
+  // Seven 4 byte records fill the 32 bytes of data.
+  for (int i = 0; i < 7; ++i) {
+    char record[4];
+    snprintf(record, sizeof(record), "%03d", i);
+    ASSERT_TRUE(writer.Write(record, 3));
+  }
+  EXPECT_FALSE(writer.Write("007", 3));
+  EXPECT_EQ(EAGAIN, writer.error());
+
+  EXPECT_EQ("000", ReadRecord(&reader));
+  EXPECT_EQ("001", ReadRecord(&reader));
+  EXPECT_FALSE(writer.Write("007", 3));
+  ASSERT_TRUE(reader.Ack());
+  ASSERT_TRUE(writer.Write("007", 3));
+  ASSERT_TRUE(writer.Write("008", 3));
+  EXPECT_FALSE(writer.Write("009", 3));
+
+  // Without consumers the ring overwrites again.
+  ASSERT_TRUE(writer.RemoveCursor("consumer"));
+  ASSERT_TRUE(writer.Write("009", 3));
+}
+
+namespace {
+
+void * WriteToQueue(void * context) {
+  Ringfile * writer = static_cast<Ringfile *>(context);
+  bool ok = writer->Write("last", 4);
+  return reinterpret_cast<void *>(ok);
+}
+
+}  // anonymous namespace
+
+TEST(RingfileTest, QueueWriterSleepsUntilAck) {
+  std::string path = TempDir() + "/ring";
+
+  Ringfile::Options options;
+  options.cursor_count = 1;
+  options.queue = true;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 96 + 32, options));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.OpenCursor("consumer"));
+  for (int i = 0; i < 7; ++i) {
+    ASSERT_TRUE(writer.Write("abc", 3));
+  }
+
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, &WriteToQueue, &writer));
+  usleep(50 * 1000);
+  EXPECT_EQ(28U, writer.bytes_used());
+
+  // Consuming two records makes room for the five byte record.
+  EXPECT_EQ("abc", ReadRecord(&reader));
+  EXPECT_EQ("abc", ReadRecord(&reader));
+  ASSERT_TRUE(reader.Ack());
+
+  void * result;
+  ASSERT_EQ(0, pthread_join(thread, &result));
+  EXPECT_TRUE(result != NULL);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ("abc", ReadRecord(&reader));
+  }
+  EXPECT_EQ("last", ReadRecord(&reader));
+}
+
+TEST(RingfileTest, QueueNeedsCursors) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.queue = true;
+  Ringfile ringfile;
+  EXPECT_FALSE(ringfile.Create(path, 1024, options));
+  EXPECT_EQ(EINVAL, ringfile.error());
+}
+
+TEST(RingfileTest, ReclaimerKeepsHeadroomFree) {
+  std::string path = TempDir() + "/ring";
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 24 + 100));
+  ASSERT_TRUE(writer.EnableReclaimer(20));
+
+  // Fill the ring well past its size with 5 byte records.
+  for (int i = 0; i < 60; ++i) {
+    char record[5];
+    snprintf(record, sizeof(record), "%04d", i);
+    ASSERT_TRUE(writer.Write(record, 4));
+  }
+
+  // The reclaimer catches up in the background.
+  for (int i = 0; i < 1000 && writer.bytes_available() < 20; ++i) {
+    usleep(1000);
+  }
+  EXPECT_LE(20U, writer.bytes_available());
+
+  // What is left is the newest records, in order.
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  int count = 0;
+  std::string last;
+  while (!reader.EndOfFile()) {
+    std::string record = ReadRecord(&reader);
+    if (!last.empty()) {
+      EXPECT_EQ(atoi(last.c_str()) + 1, atoi(record.c_str()));
+    }
+    last = record;
+    ++count;
+  }
+  EXPECT_EQ("0059", last);
+  EXPECT_LE(16, count);
+  ASSERT_TRUE(writer.Close());
+
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Open(path, Ringfile::kRead));
+  EXPECT_FALSE(ringfile.EnableReclaimer(20));
+  EXPECT_EQ(EBADF, ringfile.error());
+}
+
+TEST(RingfileTest, WriterReportsReclaimerErrors) {
+  std::string path = TempDir() + "/ring";
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 1024));
+  for (int i = 0; i < 60; ++i) {
+    ASSERT_TRUE(writer.Write("0123456789", 10));
+  }
+  size_t used = writer.bytes_used();
+
+  // Take the oldest records out from under the ring, so the reclaimer
+  // cannot read their lengths.
+  ASSERT_EQ(0, truncate(path.c_str(), 1024 - writer.bytes_max()));
+  ASSERT_TRUE(writer.EnableReclaimer(writer.bytes_max() - used + 100));
+
+  // Short writes fit without evicting, so only the reclaimer's error can
+  // fail one.
+  bool failed = false;
+  for (int i = 0; i < 50 && !failed; ++i) {
+    usleep(10000);
+    failed = !writer.Write("x", 1);
+  }
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(EIO, writer.error());
+}
+
+TEST(RingfileTest, CanPreallocateAndPrefault) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.prealloc = true;
+  Ringfile ringfile;
+  ASSERT_TRUE(ringfile.Create(path, 64 * 1024, options));
+
+  struct stat stat_buffer;
+  ASSERT_EQ(0, stat(path.c_str(), &stat_buffer));
+  EXPECT_LE(64 * 1024, stat_buffer.st_blocks * 512);
+
+  ASSERT_TRUE(ringfile.Prefault(false));
+  if (!ringfile.Prefault(true)) {
+    // Not allowed to lock memory here.
+    EXPECT_TRUE(ringfile.error() == EPERM || ringfile.error() == ENOMEM ||
+      ringfile.error() == EAGAIN);
+    ASSERT_TRUE(ringfile.Prefault(false));
+  }
+  ASSERT_TRUE(ringfile.Write("Hello, World!", 13));
+
+  // The mapping follows the file when it is resized.
+  ASSERT_TRUE(ringfile.Resize(128 * 1024));
+  ASSERT_TRUE(ringfile.Write("Goodbye", 7));
+  ASSERT_TRUE(ringfile.Close());
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(reader.Prefault(false));
+  EXPECT_EQ("Hello, World!", ReadRecord(&reader));
+  EXPECT_EQ("Goodbye", ReadRecord(&reader));
+}
+
+TEST(RingfileTest, CanUseVersion2Headers) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.header_version = 2;
+  options.cursor_count = 4;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 4096 + 1000, options));
+  EXPECT_EQ(2, writer.header_version());
+  EXPECT_EQ(4096u, writer.data_offset());
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_TRUE(writer.Write("Hello, World!", 13));
+  }
+
+  // The offsets are on cache lines of their own.
+  std::string contents = GetFileContents(path);
+  HeaderV2 header;
+  memcpy(&header, contents.data(), sizeof(header));
+  EXPECT_TRUE(header.magic == Ringfile::kMagicV2);
+  EXPECT_EQ(0u, offsetof(HeaderV2, end_offset) % 64);
+  EXPECT_EQ(0u, offsetof(HeaderV2, start_offset) % 64);
+  EXPECT_NE(offsetof(HeaderV2, end_offset) / 64,
+    offsetof(HeaderV2, start_offset) / 64);
+  EXPECT_EQ(writer.bytes_used(), header.end_offset - header.start_offset);
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ(2, reader.header_version());
+  ASSERT_TRUE(reader.OpenCursor("reader"));
+  EXPECT_EQ("Hello, World!", ReadRecord(&reader));
+  ASSERT_TRUE(reader.Ack());
+
+  ASSERT_TRUE(writer.Resize(4096 + 2000));
+  ASSERT_TRUE(writer.Write("Goodbye", 7));
+  std::string last;
+  while (!reader.EndOfFile()) {
+    last = ReadRecord(&reader);
+  }
+  EXPECT_EQ("Goodbye", last);
+
+  options.header_version = 3;
+  EXPECT_FALSE(writer.Create(TempDir() + "/ring3", 8192, options));
+  EXPECT_EQ(EINVAL, writer.error());
+}
+
+TEST(RingfileTest, AlignedRecordsStartAtMultiplesOfTheAlignment) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.alignment = 24;
+  Ringfile writer;
+  EXPECT_FALSE(writer.Create(path, 4096, options));
+  EXPECT_EQ(EINVAL, writer.error());
+  unlink(path.c_str());
+
+  options.alignment = 64;
+  ASSERT_TRUE(writer.Create(path, 4096, options));
+  EXPECT_EQ(64u, writer.alignment());
+  EXPECT_TRUE(writer.contiguous());
+  EXPECT_EQ(0u, writer.data_offset() % 64);
+
+  // The padding before a record counts as used.
+  ASSERT_TRUE(writer.Write("x", 1));
+  EXPECT_EQ(65u, writer.bytes_used());
+
+  for (int i = 0; i < 300; ++i) {
+    std::string record(i % 100, 'x');
+    char number[16];
+    snprintf(number, sizeof(number), "%d:", i);
+    record.insert(0, number);
+    ASSERT_TRUE(writer.Write(record.data(), record.size()));
+  }
+  EXPECT_FALSE(writer.Resize(5000));
+  ASSERT_TRUE(writer.Resize(8192));
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ(64u, reader.alignment());
+  std::string contents = GetFileContents(path);
+  int previous = -1;
+  while (!reader.EndOfFile()) {
+    uint64_t offset;
+    size_t size;
+    ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+    EXPECT_EQ(0u, offset % 64);
+    EXPECT_LE(offset + size, reader.file_size());
+    int i = atoi(contents.c_str() + offset);
+    if (previous != -1) {
+      EXPECT_EQ(previous + 1, i);
+    }
+    previous = i;
+  }
+  EXPECT_EQ(299, previous);
+
+  // Shrinking keeps records aligned too.
+  ASSERT_TRUE(writer.Resize(2048));
+  ASSERT_TRUE(reader.Close());
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  contents = GetFileContents(path);
+  while (!reader.EndOfFile()) {
+    uint64_t offset;
+    size_t size;
+    ASSERT_TRUE(reader.SkipRecord(&offset, &size));
+    EXPECT_EQ(0u, offset % 64);
+    previous = atoi(contents.c_str() + offset);
+  }
+  EXPECT_EQ(299, previous);
+}
+
+TEST(RingfileTest, BlockFramedRecordsCanBeReadByBlock) {
+  std::string path = TempDir() + "/ring";
+  Ringfile::Options options;
+  options.block_size = 256;
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 2000, options));
+  EXPECT_EQ(256u, writer.block_size());
+  EXPECT_FALSE(writer.EnableUring());
+  EXPECT_FALSE(writer.StreamingWriteStart(10));
+  std::string too_big(256 - sizeof(BlockHeader) - 2, 'x');
+  EXPECT_FALSE(writer.Write(too_big.data(), too_big.size()));
+  EXPECT_EQ(EMSGSIZE, writer.error());
+
+  // Go around the ring a few times, so that the oldest blocks are evicted.
+  for (int i = 0; i < 1000; ++i) {
+    char record[16];
+    int size = snprintf(record, sizeof(record), "%d", i);
+    ASSERT_TRUE(writer.Write(record, size));
+  }
+  ASSERT_TRUE(writer.Flush());
+
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ(256u, reader.block_size());
+  size_t blocks = reader.block_count();
+  ASSERT_GT(blocks, 2u);
+
+  // Blocks follow on from each other and hold the records they describe.
+  BlockHeader first;
+  std::string records;
+  ASSERT_TRUE(reader.ReadBlock(0, &first, &records));
+  EXPECT_EQ(first.size, records.size());
+  uint64_t sequence = first.first_sequence;
+  for (size_t i = 0; i < blocks; ++i) {
+    BlockHeader block;
+    ASSERT_TRUE(reader.ReadBlock(i, &block, &records));
+    EXPECT_EQ(sequence, block.first_sequence);
+    EXPECT_LE(block.first_timestamp, block.last_timestamp);
+    sequence += block.record_count;
+  }
+  EXPECT_EQ(1000u, sequence);
+  BlockHeader block;
+  EXPECT_FALSE(reader.ReadBlock(blocks, &block, NULL));
+  EXPECT_EQ(ERANGE, reader.error());
+
+  // Reading skips block headers and padding.
+  for (uint64_t i = first.first_sequence; i < 1000; ++i) {
+    char record[16];
+    snprintf(record, sizeof(record), "%d", static_cast<int>(i));
+    ASSERT_EQ(record, ReadRecord(&reader));
+  }
+  EXPECT_TRUE(reader.EndOfFile());
+
+  ASSERT_TRUE(reader.SeekBlock(blocks - 1));
+  ASSERT_TRUE(reader.ReadBlock(blocks - 1, &block, NULL));
+  char record[16];
+  snprintf(record, sizeof(record), "%d",
+    static_cast<int>(block.first_sequence));
+  EXPECT_EQ(record, ReadRecord(&reader));
+
+  // A writer that opens the file carries on numbering where the last one
+  // stopped, even though the last records were not in the header yet.
+  ASSERT_TRUE(writer.Write("x", 1));
+  ASSERT_TRUE(writer.Write("y", 1));
+  Ringfile appender;
+  ASSERT_TRUE(appender.Open(path, Ringfile::kAppend));
+  ASSERT_TRUE(appender.Write("z", 1));
+  ASSERT_TRUE(appender.Close());
+  ASSERT_TRUE(reader.ReadBlock(reader.block_count() - 1, &block, &records));
+  EXPECT_EQ(1003u, block.first_sequence + block.record_count);
+}
+
+TEST(RingfileTest, CanWriteAndReadWithDirectIO) {
+  std::string path = TempDir() + "/ring";
+  Ringfile writer;
+  ASSERT_TRUE(writer.Create(path, 24 + 50000));
+  if (!writer.EnableDirectIO(8192)) {
+    EXPECT_EQ(EINVAL, writer.error());  // no O_DIRECT on this file system
+    return;
+  }
+  EXPECT_FALSE(writer.EnableUring());
+  EXPECT_FALSE(writer.EnableReclaimer(100));
+
+  // Records are only published once the block they are staged in is
+  // written.
+  Ringfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(writer.Write("Hello, World!", 13));
+  EXPECT_TRUE(reader.EndOfFile());
+  ASSERT_TRUE(writer.Flush());
+  EXPECT_EQ("Hello, World!", ReadRecord(&reader));
+
+  // Go around the ring a few times with records of different sizes, some of
+  // which span blocks and the end of the data area.
+  int last = 0;
+  for (int i = 0; i < 5000; ++i) {
+    std::string record(i % 97, 'x');
+    char number[16];
+    snprintf(number, sizeof(number), "%d:", i);
+    record.insert(0, number);
+    ASSERT_TRUE(writer.Write(record.c_str(), record.size()));
+    last = i;
+  }
+  ASSERT_TRUE(writer.Close());
+
+  Ringfile direct_reader;
+  ASSERT_TRUE(direct_reader.Open(path, Ringfile::kRead));
+  ASSERT_TRUE(direct_reader.EnableDirectIO(8192));
+  int previous = -1;
+  while (!direct_reader.EndOfFile()) {
+    std::string record = ReadRecord(&direct_reader);
+    int i = atoi(record.c_str());
+    if (previous != -1) {
+      EXPECT_EQ(previous + 1, i);
+    }
+    char number[16];
+    snprintf(number, sizeof(number), "%d:", i);
+    EXPECT_EQ(std::string(number) + std::string(i % 97, 'x'), record);
+    previous = i;
+  }
+  EXPECT_EQ(last, previous);
+}
@@ -0,0 +1,504 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "segmented_ringfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "varint.h"
+
+SegmentedRingfile::SegmentedRingfile()
+  : error_(0),
+    index_fd_(-1),
+    index_(NULL),
+    head_fd_(-1),
+    head_(NULL),
+    read_segment_(0),
+    read_offset_(0),
+    read_map_(NULL),
+    streaming_write_offset_(0),
+    streaming_write_bytes_remaining_(0),
+    streaming_read_offset_(0),
+    streaming_read_bytes_remaining_(0) {
+}
+
+SegmentedRingfile::~SegmentedRingfile() {
+  Close();
+}
+
+bool SegmentedRingfile::IsSegmentedRingfile(const std::string & path) {
+  struct stat stat_buffer;
+  if (stat(path.c_str(), &stat_buffer) == -1 ||
+      !S_ISDIR(stat_buffer.st_mode)) {
+    return false;
+  }
+  return stat((path + "/index").c_str(), &stat_buffer) == 0;
+}
+
+std::string SegmentedRingfile::SegmentPath(uint64_t segment) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/segment-%016" PRIx64, segment);
+  return path_ + name;
+}
+
+bool SegmentedRingfile::Create(const std::string & path, size_t size,
+    size_t segment_size) {
+  if (segment_size == 0) {
+    segment_size = size / kMinSegments;
+    if (segment_size > kDefaultSegmentSize) {
+      segment_size = kDefaultSegmentSize;
+    }
+  }
+  if (segment_size <= sizeof(SegmentHeader) + 1 || size < 2 * segment_size) {
+    error_ = EINVAL;
+    return false;
+  }
+
+  if (mkdir(path.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)
+      == -1) {
+    error_ = errno;
+    return false;
+  }
+  path_ = path;
+
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+  index_fd_ = open((path + "/index").c_str(), O_RDWR|O_CREAT|O_EXCL, mode);
+  if (index_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (ftruncate(index_fd_, sizeof(*index_)) == -1) {
+    error_ = errno;
+    Close();
+    return false;
+  }
+  index_ = reinterpret_cast<SegmentIndex *>(mmap(0, sizeof(*index_),
+    PROT_READ|PROT_WRITE, MAP_SHARED, index_fd_, 0));
+  if (index_ == MAP_FAILED) {
+    index_ = NULL;
+    error_ = errno;
+    Close();
+    return false;
+  }
+
+  index_->flags = 0;
+  index_->segment_size = segment_size;
+  index_->segment_count = size / segment_size;
+  index_->first_segment = 0;
+  index_->last_segment = 0;
+  if (!StartSegment(0)) {
+    Close();
+    return false;
+  }
+
+  // The magic number is written last so that a partially created ring is
+  // never mistaken for a valid one.
+  index_->magic = kMagic;
+  return true;
+}
+
+bool SegmentedRingfile::Open(const std::string & path,
+    Ringfile::Mode mode) {
+  path_ = path;
+  index_fd_ = open((path + "/index").c_str(),
+    mode == Ringfile::kRead ? O_RDONLY : O_RDWR);
+  if (index_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+
+  struct stat stat_buffer;
+  if (fstat(index_fd_, &stat_buffer) == -1) {
+    error_ = errno;
+    Close();
+    return false;
+  }
+  if (stat_buffer.st_size < static_cast<off_t>(sizeof(*index_))) {
+    error_ = EINVAL;
+    Close();
+    return false;
+  }
+
+  index_ = reinterpret_cast<SegmentIndex *>(mmap(0, sizeof(*index_),
+    mode == Ringfile::kRead ? PROT_READ : PROT_READ|PROT_WRITE, MAP_SHARED,
+    index_fd_, 0));
+  if (index_ == MAP_FAILED) {
+    index_ = NULL;
+    error_ = errno;
+    Close();
+    return false;
+  }
+  if (index_->magic != kMagic) {
+    error_ = EINVAL;  // invalid magic number
+    Close();
+    return false;
+  }
+
+  if (mode == Ringfile::kAppend && !OpenHeadSegment()) {
+    Close();
+    return false;
+  }
+
+  read_segment_ = __atomic_load_n(&index_->first_segment, __ATOMIC_ACQUIRE);
+  read_offset_ = 0;
+  return true;
+}
+
+bool SegmentedRingfile::OpenHeadSegment() {
+  head_fd_ = open(SegmentPath(index_->last_segment).c_str(), O_RDWR);
+  if (head_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+  head_ = reinterpret_cast<SegmentHeader *>(mmap(0, sizeof(*head_),
+    PROT_READ|PROT_WRITE, MAP_SHARED, head_fd_, 0));
+  if (head_ == MAP_FAILED) {
+    head_ = NULL;
+    error_ = errno;
+    return false;
+  }
+  if (head_->magic != kSegmentMagic) {
+    error_ = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+bool SegmentedRingfile::StartSegment(uint64_t segment) {
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+  int fd = open(SegmentPath(segment).c_str(), O_RDWR|O_CREAT|O_TRUNC, mode);
+  if (fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  if (ftruncate(fd, index_->segment_size) == -1) {
+    error_ = errno;
+    close(fd);
+    return false;
+  }
+  SegmentHeader * header = reinterpret_cast<SegmentHeader *>(mmap(0,
+    sizeof(*header), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0));
+  if (header == MAP_FAILED) {
+    error_ = errno;
+    close(fd);
+    return false;
+  }
+  header->magic = kSegmentMagic;
+  header->flags = 0;
+  header->end_offset = 0;
+
+  if (head_) {
+    munmap(head_, sizeof(*head_));
+  }
+  if (head_fd_ != -1) {
+    close(head_fd_);
+  }
+  head_ = header;
+  head_fd_ = fd;
+
+  // Publish the new head segment before evicting, so that a reader that
+  // finds its segment gone always has somewhere to go.
+  __atomic_store_n(&index_->last_segment, segment, __ATOMIC_RELEASE);
+
+  while (segment - index_->first_segment + 1 > index_->segment_count) {
+    uint64_t oldest = index_->first_segment;
+    __atomic_store_n(&index_->first_segment, oldest + 1, __ATOMIC_RELEASE);
+
+    // Readers that still have the segment mapped keep reading it; the space
+    // is released when they move on.
+    unlink(SegmentPath(oldest).c_str());
+  }
+  return true;
+}
+
+bool SegmentedRingfile::ReserveHead(size_t size) {
+  size_t data_size = index_->segment_size - sizeof(SegmentHeader);
+  if (size > data_size) {
+    error_ = EINVAL;  // the record can never fit in a segment
+    return false;
+  }
+  if (head_->end_offset + size > data_size) {
+    return StartSegment(index_->last_segment + 1);
+  }
+  return true;
+}
+
+bool SegmentedRingfile::Write(const void * ptr, size_t size) {
+  if (!head_) {
+    error_ = EBADF;
+    return false;
+  }
+
+  uint8_t header_buffer[Varint::kMaxSize];
+  Varint size_varint(size);
+  int header_size = size_varint.ByteSize();
+  size_varint.Write(&header_buffer);
+
+  if (!ReserveHead(header_size + size)) {
+    return false;
+  }
+
+  struct iovec iov[2];
+  iov[0].iov_base = header_buffer;
+  iov[0].iov_len = header_size;
+  iov[1].iov_base = const_cast<void *>(ptr);
+  iov[1].iov_len = size;
+  ssize_t rv = pwritev(head_fd_, iov, 2,
+    sizeof(SegmentHeader) + head_->end_offset);
+  if (rv != static_cast<ssize_t>(header_size + size)) {
+    error_ = rv == -1 ? errno : EIO;
+    return false;
+  }
+
+  __atomic_store_n(&head_->end_offset, head_->end_offset + header_size + size,
+    __ATOMIC_RELEASE);
+  return true;
+}
+
+bool SegmentedRingfile::MapReadSegment(uint64_t segment) {
+  int fd = open(SegmentPath(segment).c_str(), O_RDONLY);
+  if (fd == -1) {
+    error_ = errno;
+    return false;
+  }
+  void * map = mmap(0, index_->segment_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    error_ = errno;
+    return false;
+  }
+  madvise(map, index_->segment_size, MADV_SEQUENTIAL);
+  read_map_ = reinterpret_cast<const uint8_t *>(map);
+
+  // Start pulling the following segment into the page cache so that crossing
+  // into it does not stall the reader.
+  int next_fd = open(SegmentPath(segment + 1).c_str(), O_RDONLY);
+  if (next_fd != -1) {
+    posix_fadvise(next_fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(next_fd);
+  }
+  return true;
+}
+
+void SegmentedRingfile::UnmapReadSegment() {
+  if (read_map_) {
+    munmap(const_cast<uint8_t *>(read_map_), index_->segment_size);
+    read_map_ = NULL;
+  }
+}
+
+bool SegmentedRingfile::SeekNextRecord() {
+  if (!index_) {
+    return false;
+  }
+
+  while (true) {
+    uint64_t first = __atomic_load_n(&index_->first_segment,
+      __ATOMIC_ACQUIRE);
+    if (!read_map_ && read_segment_ < first) {
+      // The writer evicted the segment we were going to read next. A segment
+      // that is already mapped stays readable until we are done with it.
+      read_segment_ = first;
+      read_offset_ = 0;
+    }
+    if (!read_map_ && !MapReadSegment(read_segment_)) {
+      if (error_ == ENOENT && read_segment_ <
+          __atomic_load_n(&index_->first_segment, __ATOMIC_ACQUIRE)) {
+        continue;  // evicted between loading first_segment and opening it
+      }
+      return false;
+    }
+
+    // Load last_segment before end_offset: if the segment was already
+    // superseded, its end_offset is final.
+    uint64_t last = __atomic_load_n(&index_->last_segment, __ATOMIC_ACQUIRE);
+    const SegmentHeader * header =
+      reinterpret_cast<const SegmentHeader *>(read_map_);
+    uint64_t end_offset = __atomic_load_n(&header->end_offset,
+      __ATOMIC_ACQUIRE);
+    if (read_offset_ < end_offset) {
+      return true;
+    }
+    if (read_segment_ >= last) {
+      return false;
+    }
+
+    UnmapReadSegment();
+    read_segment_ += 1;
+    read_offset_ = 0;
+  }
+}
+
+bool SegmentedRingfile::EndOfFile() {
+  return !SeekNextRecord();
+}
+
+bool SegmentedRingfile::NextRecordSize(size_t * size) {
+  if (!SeekNextRecord()) {
+    return false;
+  }
+  Varint size_varint;
+  size_varint.Read(read_map_ + sizeof(SegmentHeader) + read_offset_);
+  *size = size_varint.value();
+  return true;
+}
+
+bool SegmentedRingfile::Read(void * ptr, size_t size) {
+  if (!SeekNextRecord()) {
+    return false;
+  }
+
+  const uint8_t * record = read_map_ + sizeof(SegmentHeader) + read_offset_;
+  Varint size_varint;
+  int header_size = size_varint.Read(record);
+  if (size_varint.value() > size) {
+    error_ = ENOBUFS;
+    return false;
+  }
+
+  memcpy(ptr, record + header_size, size_varint.value());
+  read_offset_ += header_size + size_varint.value();
+  return true;
+}
+
+bool SegmentedRingfile::Close() {
+  UnmapReadSegment();
+  if (head_) {
+    munmap(head_, sizeof(*head_));
+    head_ = NULL;
+  }
+  if (head_fd_ != -1) {
+    close(head_fd_);
+    head_fd_ = -1;
+  }
+  if (index_) {
+    munmap(index_, sizeof(*index_));
+    index_ = NULL;
+  }
+  if (index_fd_ != -1) {
+    close(index_fd_);
+    index_fd_ = -1;
+  }
+  return true;
+}
+
+size_t SegmentedRingfile::bytes_max() const {
+  return index_->segment_count *
+    (index_->segment_size - sizeof(SegmentHeader));
+}
+
+size_t SegmentedRingfile::bytes_used() const {
+  size_t total = 0;
+  uint64_t last = __atomic_load_n(&index_->last_segment, __ATOMIC_ACQUIRE);
+  for (uint64_t segment = index_->first_segment; segment <= last; ++segment) {
+    int fd = open(SegmentPath(segment).c_str(), O_RDONLY);
+    if (fd == -1) {
+      continue;
+    }
+    SegmentHeader header;
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header)) {
+      total += header.end_offset;
+    }
+    close(fd);
+  }
+  return total;
+}
+
+size_t SegmentedRingfile::bytes_available() const {
+  return bytes_max() - bytes_used();
+}
+
+bool SegmentedRingfile::StreamingWriteStart(size_t size) {
+  if (!head_) {
+    error_ = EBADF;
+    return false;
+  }
+
+  uint8_t header_buffer[Varint::kMaxSize];
+  Varint size_varint(size);
+  int header_size = size_varint.ByteSize();
+  size_varint.Write(&header_buffer);
+
+  if (!ReserveHead(header_size + size)) {
+    return false;
+  }
+  if (pwrite(head_fd_, header_buffer, header_size,
+      sizeof(SegmentHeader) + head_->end_offset) != header_size) {
+    error_ = errno;
+    return false;
+  }
+
+  streaming_write_offset_ = head_->end_offset + header_size;
+  streaming_write_bytes_remaining_ = size;
+  return true;
+}
+
+bool SegmentedRingfile::StreamingWrite(const void * ptr, size_t size) {
+  if (size > streaming_write_bytes_remaining_) {
+    error_ = EINVAL;
+    return false;
+  }
+  ssize_t rv = pwrite(head_fd_, ptr, size,
+    sizeof(SegmentHeader) + streaming_write_offset_);
+  if (rv != static_cast<ssize_t>(size)) {
+    error_ = rv == -1 ? errno : EIO;
+    return false;
+  }
+  streaming_write_offset_ += size;
+  streaming_write_bytes_remaining_ -= size;
+  return true;
+}
+
+bool SegmentedRingfile::StreamingWriteFinish() {
+  if (streaming_write_bytes_remaining_ != 0) {
+    error_ = EINVAL;
+    return false;
+  }
+  __atomic_store_n(&head_->end_offset, streaming_write_offset_,
+    __ATOMIC_RELEASE);
+  streaming_write_offset_ = 0;
+  return true;
+}
+
+size_t SegmentedRingfile::StreamingReadStart() {
+  if (!SeekNextRecord()) {
+    return -1;
+  }
+
+  Varint size_varint;
+  int header_size = size_varint.Read(
+    read_map_ + sizeof(SegmentHeader) + read_offset_);
+
+  streaming_read_offset_ = read_offset_ + header_size;
+  streaming_read_bytes_remaining_ = size_varint.value();
+  read_offset_ += header_size + size_varint.value();
+  return size_varint.value();
+}
+
+size_t SegmentedRingfile::StreamingRead(void * ptr, size_t size) {
+  if (size > streaming_read_bytes_remaining_) {
+    size = streaming_read_bytes_remaining_;
+  }
+  if (size == 0) {
+    return 0;
+  }
+  memcpy(ptr, read_map_ + sizeof(SegmentHeader) + streaming_read_offset_,
+    size);
+  streaming_read_offset_ += size;
+  streaming_read_bytes_remaining_ -= size;
+  return size;
+}
+
+bool SegmentedRingfile::StreamingReadFinish() {
+  streaming_read_offset_ = 0;
+  return true;
+}
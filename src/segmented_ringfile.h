@@ -0,0 +1,128 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef SEGMENTED_RINGFILE_H_
+#define SEGMENTED_RINGFILE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "ringfile_internal.h"
+
+#pragma pack(push, 1)
+struct SegmentIndex {
+  uint32_t magic;
+  uint32_t flags;
+  uint64_t segment_size;
+  uint64_t segment_count;
+  uint64_t first_segment;
+  uint64_t last_segment;
+};
+
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t flags;
+  uint64_t end_offset;
+};
+#pragma pack(pop)
+
+// A SegmentedRingfile stores a ring as a directory of fixed size segment files
+// rather than one large preallocated file. Records are appended to the newest
+// (head) segment and never span segments. When the head segment is full a new
+// one is started, and once there are `segment_count` segments the oldest is
+// dropped as a whole by unlinking it, so eviction costs O(1) regardless of how
+// many records it held.
+//
+// Directory layout:
+//
+//   path/index                     SegmentIndex
+//   path/segment-0000000000000000  SegmentHeader followed by records
+//   path/segment-0000000000000001  ...
+//
+// The interface mirrors Ringfile so that callers can use either.
+class SegmentedRingfile {
+ public:
+  SegmentedRingfile();
+  ~SegmentedRingfile();
+
+  static const uint32_t kMagic = 'GESR';
+  static const uint32_t kSegmentMagic = 'MGES';
+  static const size_t kDefaultSegmentSize = 64 * 1024 * 1024;
+  static const size_t kMinSegments = 4;
+
+  // Returns true if `path` looks like a segmented ring directory.
+  static bool IsSegmentedRingfile(const std::string & path);
+
+  // Create a new segmented ring holding about `size` bytes. If `segment_size`
+  // is zero a size is chosen that gives at least kMinSegments segments.
+  bool Create(const std::string & path, size_t size, size_t segment_size = 0);
+  bool Open(const std::string & path, Ringfile::Mode mode);
+  bool Write(const void * ptr, size_t size);
+  bool Read(void * ptr, size_t size);
+  bool NextRecordSize(size_t * size);
+  bool EndOfFile();
+
+  bool Close();
+
+  int error() { return error_; }
+  size_t segment_size() const { return index_->segment_size; }
+  size_t segment_count() const { return index_->segment_count; }
+  size_t bytes_max() const;
+  size_t bytes_used() const;
+  size_t bytes_available() const;
+
+  // Support for writing records piecewise without knowing exactly how big the
+  // record will be when writing starts.
+  bool StreamingWriteStart(size_t size);
+  bool StreamingWrite(const void * ptr, size_t size);
+  bool StreamingWriteFinish();
+
+  // Functions that support reading partial records
+  size_t StreamingReadStart();
+  size_t StreamingRead(void * ptr, size_t size);
+  bool StreamingReadFinish();
+
+ private:
+  std::string SegmentPath(uint64_t segment) const;
+
+  // Create segment number `segment`, make it the head segment and evict the
+  // oldest segment if the ring is now over its segment count.
+  bool StartSegment(uint64_t segment);
+
+  // Map the head segment header for writing.
+  bool OpenHeadSegment();
+
+  // Make sure there is room for `size` bytes in the head segment, starting a
+  // new segment if needed.
+  bool ReserveHead(size_t size);
+
+  // Map `segment` for reading and hint the kernel to start reading the one
+  // after it. Returns false if the segment no longer exists.
+  bool MapReadSegment(uint64_t segment);
+  void UnmapReadSegment();
+
+  // Position the reader at the next record, moving on to later segments as
+  // the current one is exhausted. Returns false at the end of the ring.
+  bool SeekNextRecord();
+
+  std::string path_;
+  int error_;
+  int index_fd_;
+  SegmentIndex * index_;
+
+  int head_fd_;
+  SegmentHeader * head_;
+
+  uint64_t read_segment_;
+  uint64_t read_offset_;
+  const uint8_t * read_map_;
+
+  uint64_t streaming_write_offset_;
+  uint64_t streaming_write_bytes_remaining_;
+  uint64_t streaming_read_offset_;
+  uint64_t streaming_read_bytes_remaining_;
+};
+
+#endif  // SEGMENTED_RINGFILE_H_
@@ -0,0 +1,130 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "segmented_ringfile.h"
+#include "test_util.h"
+
+namespace {
+
+bool PathExists(const std::string & path) {
+  struct stat stat_buffer;
+  return stat(path.c_str(), &stat_buffer) == 0;
+}
+
+std::string ReadRecord(SegmentedRingfile * ringfile) {
+  size_t size;
+  if (!ringfile->NextRecordSize(&size)) {
+    return "<eof>";
+  }
+  std::string buffer;
+  buffer.resize(size);
+  if (!ringfile->Read(const_cast<char *>(buffer.c_str()), size)) {
+    return "<error>";
+  }
+  return buffer;
+}
+
+}  // anonymous namespace
+
+TEST(SegmentedRingfileTest, CannotOpenBogusPath) {
+  std::string path = TempDir() + "/does not exist/ring";
+  SegmentedRingfile ringfile;
+  ASSERT_FALSE(ringfile.Create(path, 4096));
+  ASSERT_EQ(ENOENT, ringfile.error());
+  ASSERT_FALSE(ringfile.Open(path, Ringfile::kRead));
+  ASSERT_FALSE(SegmentedRingfile::IsSegmentedRingfile(path));
+}
+
+TEST(SegmentedRingfileTest, CanReadAndWriteBasics) {
+  std::string path = TempDir() + "/ring";
+
+  {
+    SegmentedRingfile ringfile;
+    ASSERT_TRUE(ringfile.Create(path, 4096));
+    EXPECT_TRUE(SegmentedRingfile::IsSegmentedRingfile(path));
+    EXPECT_EQ(4, ringfile.segment_count());
+    EXPECT_EQ(1024, ringfile.segment_size());
+    EXPECT_EQ(4 * (1024 - sizeof(SegmentHeader)), ringfile.bytes_max());
+
+    ASSERT_TRUE(ringfile.Write("Hello, World!", 13));
+    EXPECT_EQ(14, ringfile.bytes_used());
+  }
+
+  {
+    SegmentedRingfile ringfile;
+    ASSERT_TRUE(ringfile.Open(path, Ringfile::kAppend));
+    ASSERT_TRUE(ringfile.StreamingWriteStart(15));
+    ASSERT_TRUE(ringfile.StreamingWrite("Goodbye, ", 9));
+    ASSERT_TRUE(ringfile.StreamingWrite("World!", 6));
+    ASSERT_TRUE(ringfile.StreamingWriteFinish());
+  }
+
+  {
+    SegmentedRingfile ringfile;
+    ASSERT_TRUE(ringfile.Open(path, Ringfile::kRead));
+    EXPECT_EQ("Hello, World!", ReadRecord(&ringfile));
+
+    char buffer[16];
+    EXPECT_EQ(15, ringfile.StreamingReadStart());
+    EXPECT_EQ(15, ringfile.StreamingRead(buffer, sizeof(buffer)));
+    EXPECT_EQ(0, ringfile.StreamingRead(buffer, sizeof(buffer)));
+    EXPECT_TRUE(ringfile.StreamingReadFinish());
+    EXPECT_EQ("Goodbye, World!", std::string(buffer, 15));
+
+    EXPECT_TRUE(ringfile.EndOfFile());
+    EXPECT_EQ("<eof>", ReadRecord(&ringfile));
+  }
+}
+
+TEST(SegmentedRingfileTest, EvictsWholeSegments) {
+  std::string path = TempDir() + "/ring";
+
+  SegmentedRingfile writer;
+  ASSERT_TRUE(writer.Create(path, 256, 64));
+  EXPECT_EQ(4, writer.segment_count());
+
+  // Each segment holds 48 bytes of records, so two 20 byte records per
+  // segment.
+  std::string record(19, 'x');
+  for (int i = 0; i < 8; ++i) {
+    record[0] = 'a' + i;
+    ASSERT_TRUE(writer.Write(record.c_str(), record.size()));
+  }
+  EXPECT_TRUE(PathExists(path + "/segment-0000000000000000"));
+  EXPECT_EQ(writer.bytes_max() - 4 * 8, writer.bytes_used());
+
+  // A reader that starts now sees the first segment, even after it is
+  // evicted out from under it.
+  SegmentedRingfile reader;
+  ASSERT_TRUE(reader.Open(path, Ringfile::kRead));
+  EXPECT_EQ('a', ReadRecord(&reader)[0]);
+
+  record[0] = 'i';
+  ASSERT_TRUE(writer.Write(record.c_str(), record.size()));
+  EXPECT_FALSE(PathExists(path + "/segment-0000000000000000"));
+  EXPECT_TRUE(PathExists(path + "/segment-0000000000000004"));
+
+  EXPECT_EQ('b', ReadRecord(&reader)[0]);
+
+  // Evict two more segments. The reader skips ahead to the oldest surviving
+  // segment.
+  for (int i = 0; i < 4; ++i) {
+    record[0] = 'j' + i;
+    ASSERT_TRUE(writer.Write(record.c_str(), record.size()));
+  }
+  EXPECT_EQ('g', ReadRecord(&reader)[0]);
+  for (char c = 'h'; c <= 'm'; ++c) {
+    EXPECT_EQ(c, ReadRecord(&reader)[0]);
+  }
+  EXPECT_TRUE(reader.EndOfFile());
+
+  // Records too big for a segment are refused
+  std::string big(64, 'x');
+  EXPECT_FALSE(writer.Write(big.c_str(), big.size()));
+  EXPECT_EQ(EINVAL, writer.error());
+}
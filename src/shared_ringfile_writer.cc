@@ -0,0 +1,221 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "shared_ringfile_writer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// How long a waiting thread sleeps before checking whether it should take
+// over combining, in case the combiner stopped before reaching its request.
+const long kWaitTimeoutNs = 1000000;
+
+// The error of the last failed call on this thread.
+__thread int thread_error = 0;
+
+void WaitForChange(uint32_t * word, uint32_t value) {
+#if defined(__linux__) && defined(SYS_futex)
+  struct timespec timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_nsec = kWaitTimeoutNs;
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, &timeout, NULL, 0);
+#else
+  if (__atomic_load_n(word, __ATOMIC_ACQUIRE) == value) {
+    usleep(kWaitTimeoutNs / 1000);
+  }
+#endif
+}
+
+void WakeWaiter(uint32_t * word) {
+#if defined(__linux__) && defined(SYS_futex)
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+}  // anonymous namespace
+
+SharedRingfileWriter::SharedRingfileWriter()
+  : head_(NULL),
+    combining_(false),
+    record_count_(0),
+    batch_count_(0) {
+}
+
+SharedRingfileWriter::~SharedRingfileWriter() {
+  Close();
+}
+
+bool SharedRingfileWriter::Create(const std::string & path, size_t size,
+    const Ringfile::Options & options) {
+  if (!ring_.Create(path, size, options)) {
+    thread_error = ring_.error();
+    return false;
+  }
+  return true;
+}
+
+bool SharedRingfileWriter::Open(const std::string & path) {
+  if (!ring_.Open(path, Ringfile::kAppend)) {
+    thread_error = ring_.error();
+    return false;
+  }
+  return true;
+}
+
+bool SharedRingfileWriter::Write(const void * ptr, size_t size) {
+  Request request;
+  // An empty record still needs a pointer, as NULL means a flush.
+  request.ptr = ptr ? ptr : "";
+  request.size = size;
+  return Submit(&request);
+}
+
+bool SharedRingfileWriter::Flush() {
+  Request request;
+  request.ptr = NULL;
+  request.size = 0;
+  return Submit(&request);
+}
+
+bool SharedRingfileWriter::Submit(Request * request) {
+  request->error = 0;
+  request->state = kPending;
+
+  // Publish the request.
+  request->next = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&head_, &request->next, request, true,
+      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+  }
+
+  while (__atomic_load_n(&request->state, __ATOMIC_ACQUIRE) == kPending) {
+    if (__atomic_exchange_n(&combining_, true, __ATOMIC_SEQ_CST)) {
+      // Someone else is combining, and will most likely get to us.
+      WaitForChange(&request->state, kPending);
+      continue;
+    }
+
+    for (int pass = 0; ; ++pass) {
+      Combine();
+      __atomic_store_n(&combining_, false, __ATOMIC_SEQ_CST);
+
+      // A request published while we were combining may have seen us
+      // busy and gone to sleep, so look again now that we are not.
+      if (!__atomic_load_n(&head_, __ATOMIC_SEQ_CST) ||
+          pass + 1 == kMaxPasses ||
+          __atomic_exchange_n(&combining_, true, __ATOMIC_SEQ_CST)) {
+        break;
+      }
+    }
+  }
+
+  // The combiner may still be waking us, and the request has to stay put
+  // until it is finished with it.
+  while (__atomic_load_n(&request->state, __ATOMIC_ACQUIRE) != kReleased) {
+    sched_yield();
+  }
+
+  if (request->error) {
+    thread_error = request->error;
+    return false;
+  }
+  return true;
+}
+
+void SharedRingfileWriter::Combine() {
+  Request * list = __atomic_exchange_n(&head_, static_cast<Request *>(NULL),
+    __ATOMIC_SEQ_CST);
+  if (!list) {
+    return;
+  }
+
+  // Put the requests back in the order they were made.
+  std::vector<Request *> requests;
+  for (Request * request = list; request; request = request->next) {
+    requests.push_back(request);
+  }
+  std::reverse(requests.begin(), requests.end());
+
+  std::vector<Request *> writes;
+  std::vector<struct iovec> records;
+  bool flush = false;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    Request * request = requests[i];
+    if (!request->ptr) {
+      flush = true;
+      continue;
+    }
+    struct iovec record;
+    record.iov_base = const_cast<void *>(request->ptr);
+    record.iov_len = request->size;
+    records.push_back(record);
+    writes.push_back(request);
+  }
+
+  // When a record cannot be written, such as one too big for the ring, fail
+  // only its own caller and carry on with the records after it. WriteBatch()
+  // says how many went in first, so none is written twice.
+  size_t appended = 0;
+  for (size_t done = 0; done < records.size(); ) {
+    size_t written;
+    if (ring_.WriteBatch(&records[done], records.size() - done, &written)) {
+      appended += records.size() - done;
+      break;
+    }
+    appended += written;
+    done += written;
+    writes[done]->error = ring_.error() ? ring_.error() : EIO;
+    ++done;
+  }
+  if (flush && !ring_.Flush()) {
+    for (size_t i = 0; i < requests.size(); ++i) {
+      if (!requests[i]->ptr) {
+        requests[i]->error = ring_.error() ? ring_.error() : EIO;
+      }
+    }
+  }
+  __atomic_add_fetch(&record_count_, appended, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&batch_count_, 1, __ATOMIC_RELAXED);
+
+  // A request is gone as soon as its thread sees it is released, so it is
+  // only released once its thread has been woken.
+  for (size_t i = 0; i < requests.size(); ++i) {
+    Request * request = requests[i];
+    __atomic_store_n(&request->state, kDone, __ATOMIC_RELEASE);
+    WakeWaiter(&request->state);
+    __atomic_store_n(&request->state, kReleased, __ATOMIC_RELEASE);
+  }
+}
+
+bool SharedRingfileWriter::Close() {
+  if (!ring_.Close()) {
+    thread_error = ring_.error();
+    return false;
+  }
+  return true;
+}
+
+int SharedRingfileWriter::error() const {
+  return thread_error;
+}
+
+uint64_t SharedRingfileWriter::record_count() const {
+  return __atomic_load_n(&record_count_, __ATOMIC_RELAXED);
+}
+
+uint64_t SharedRingfileWriter::batch_count() const {
+  return __atomic_load_n(&batch_count_, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef SHARED_RINGFILE_WRITER_H_
+#define SHARED_RINGFILE_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "ringfile_internal.h"
+
+// SharedRingfileWriter lets many threads append to one ring through a single
+// handle. Rather than taking turns on a lock and each paying for its own
+// write, threads combine their writes: every caller publishes its record on
+// a lock-free list, and whichever thread finds no one else combining takes
+// the whole list and appends it with one WriteBatch(), making room for all
+// of it at once. The other callers wait until the combiner reports their
+// result, so the more threads write at once the bigger the batches get.
+//
+//   SharedRingfileWriter writer;
+//   writer.Open(path);
+//   // on any thread:
+//   writer.Write(message, size);
+//
+// Open(), Create() and Close() must not run at the same time as anything
+// else. Write() and Flush() may be called from any number of threads.
+class SharedRingfileWriter {
+ public:
+  SharedRingfileWriter();
+  ~SharedRingfileWriter();
+
+  bool Create(const std::string & path, size_t size,
+    const Ringfile::Options & options = Ringfile::Options());
+  bool Open(const std::string & path);
+
+  // Append a record, returning once it is in the file.
+  bool Write(const void * ptr, size_t size);
+
+  // Flush() the ring once everything written before it is in the file.
+  bool Flush();
+
+  bool Close();
+
+  // The error of the last call that failed on the calling thread.
+  int error() const;
+
+  // How many records were written and in how many batches.
+  uint64_t record_count() const;
+  uint64_t batch_count() const;
+
+ private:
+  SharedRingfileWriter(const SharedRingfileWriter &);
+  void operator=(const SharedRingfileWriter &);
+
+  // A pending write (or flush, if `ptr` is NULL), which lives on the stack
+  // of the thread waiting for it.
+  struct Request {
+    const void * ptr;
+    size_t size;
+    Request * next;
+    int error;
+    // kPending until the combiner sets it to kDone, then kReleased once the
+    // combiner no longer touches it.
+    uint32_t state;
+  };
+  static const uint32_t kPending = 0;
+  static const uint32_t kDone = 1;
+  static const uint32_t kReleased = 2;
+
+  // Combine at most this many lists in a row before leaving the rest to
+  // the threads waiting for them.
+  static const int kMaxPasses = 8;
+
+  bool Submit(Request * request);
+
+  // Take everything on the list and write it, while combining_ is held.
+  void Combine();
+
+  Ringfile ring_;
+
+  // The list of published requests, newest first.
+  Request * head_;
+  // Set while a thread is combining.
+  bool combining_;
+
+  uint64_t record_count_;
+  uint64_t batch_count_;
+};
+
+#endif  // SHARED_RINGFILE_WRITER_H_
@@ -0,0 +1,112 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "shared_ringfile_writer.h"
+#include "test_util.h"
+
+namespace {
+
+const int kThreadCount = 8;
+const int kRecordsPerThread = 500;
+
+struct Writer {
+  SharedRingfileWriter * shared;
+  int id;
+  int failures;
+};
+
+void * WriteRecords(void * context) {
+  Writer * writer = static_cast<Writer *>(context);
+  for (int i = 0; i < kRecordsPerThread; ++i) {
+    char message[32];
+    snprintf(message, sizeof(message), "%d %d", writer->id, i);
+    if (!writer->shared->Write(message, strlen(message))) {
+      ++writer->failures;
+    }
+  }
+  if (!writer->shared->Flush()) {
+    ++writer->failures;
+  }
+  return NULL;
+}
+
+void CombineWritesFromManyThreads(const Ringfile::Options & options) {
+  std::string path = TempDir() + "/ring";
+
+  SharedRingfileWriter shared;
+  ASSERT_TRUE(shared.Create(path, 1024 * 1024, options));
+
+  std::vector<pthread_t> threads(kThreadCount);
+  std::vector<Writer> writers(kThreadCount);
+  for (int i = 0; i < kThreadCount; ++i) {
+    writers[i].shared = &shared;
+    writers[i].id = i;
+    writers[i].failures = 0;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, &WriteRecords,
+      &writers[i]));
+  }
+  for (int i = 0; i < kThreadCount; ++i) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    EXPECT_EQ(0, writers[i].failures);
+  }
+  EXPECT_EQ(static_cast<uint64_t>(kThreadCount * kRecordsPerThread),
+    shared.record_count());
+  EXPECT_LE(shared.batch_count(), shared.record_count() + kThreadCount);
+  ASSERT_TRUE(shared.Close());
+
+  // Every record is there once, and each thread's records are in the order
+  // it wrote them.
+  Ringfile ring;
+  ASSERT_TRUE(ring.Open(path, Ringfile::kRead));
+  std::vector<int> next(kThreadCount, 0);
+  int count = 0;
+  size_t size;
+  while (ring.NextRecordSize(&size)) {
+    char record[32] = {0};
+    ASSERT_GT(sizeof(record), size);
+    ASSERT_TRUE(ring.Read(record, size));
+    int id, i;
+    ASSERT_EQ(2, sscanf(record, "%d %d", &id, &i));
+    ASSERT_LE(0, id);
+    ASSERT_GT(kThreadCount, id);
+    EXPECT_EQ(next[id], i);
+    next[id] = i + 1;
+    ++count;
+  }
+  EXPECT_EQ(kThreadCount * kRecordsPerThread, count);
+}
+
+}  // anonymous namespace
+
+TEST(SharedRingfileWriterTest, CombinesWritesFromManyThreads) {
+  CombineWritesFromManyThreads(Ringfile::Options());
+}
+
+// Block framed rings write a batch one record at a time.
+TEST(SharedRingfileWriterTest, CombinesWritesToBlockFramedRings) {
+  Ringfile::Options options;
+  options.block_size = 4096;
+  CombineWritesFromManyThreads(options);
+}
+
+TEST(SharedRingfileWriterTest, ReportsErrorsToTheWritingThread) {
+  SharedRingfileWriter shared;
+  ASSERT_TRUE(shared.Create(TempDir() + "/ring", 1024));
+
+  std::string big(2048, 'x');
+  EXPECT_FALSE(shared.Write(big.data(), big.size()));
+  EXPECT_EQ(EMSGSIZE, shared.error());
+  EXPECT_TRUE(shared.Write("ok", 2));
+  EXPECT_EQ(1U, shared.record_count());
+  ASSERT_TRUE(shared.Close());
+}
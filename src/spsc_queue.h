@@ -0,0 +1,77 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+// A bounded, lock-free queue for exactly one producer thread and exactly one
+// consumer thread. Push() and Pop() never block; they fail when the queue is
+// full or empty respectively.
+template<class T>
+class SpscQueue {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit SpscQueue(size_t capacity)
+    : head_(0),
+      tail_(0) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    slots_ = new T[size];
+    mask_ = size - 1;
+  }
+
+  ~SpscQueue() {
+    delete [] slots_;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Called only from the producer thread.
+  bool Push(const T & value) {
+    size_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) > mask_) {
+      return false;
+    }
+    slots_[tail & mask_] = value;
+    __atomic_store_n(&tail_, tail + 1, __ATOMIC_SEQ_CST);
+    return true;
+  }
+
+  // Called only from the consumer thread.
+  bool Pop(T * value) {
+    size_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&tail_, __ATOMIC_SEQ_CST)) {
+      return false;
+    }
+    *value = slots_[head & mask_];
+    __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool Empty() const {
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE) ==
+      __atomic_load_n(&tail_, __ATOMIC_SEQ_CST);
+  }
+
+ private:
+  SpscQueue(const SpscQueue &);
+  void operator=(const SpscQueue &);
+
+  T * slots_;
+  size_t mask_;
+
+  // The consumer-owned and producer-owned indexes live on separate cache
+  // lines so that the two threads do not keep stealing the line from each
+  // other.
+  char padding0_[64];
+  size_t head_;
+  char padding1_[64];
+  size_t tail_;
+  char padding2_[64];
+};
+
+#endif  // SPSC_QUEUE_H_
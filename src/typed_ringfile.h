@@ -0,0 +1,91 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef TYPED_RINGFILE_H_
+#define TYPED_RINGFILE_H_
+
+#include <errno.h>
+#include <stddef.h>
+
+#include <string>
+
+#if __cplusplus >= 201103L
+#include <type_traits>
+#endif
+
+#include "ringfile_internal.h"
+
+// TypedRingfile stores records of type T in a Ringfile with fixed size
+// records, so there is no per-record length and any record can be read by
+// index:
+//
+//   struct Sample { uint64_t time; double value; };
+//   TypedRingfile<Sample> ring;
+//   ring.Create(path, 1024 * 1024);
+//   ring.Write(sample);
+//   ring.ReadAt(ring.size() - 1, &newest);
+//
+// Records are copied byte for byte, so T must be trivially copyable and
+// should have a fixed layout.
+template<class T>
+class TypedRingfile {
+#if __cplusplus >= 201103L
+  static_assert(std::is_trivially_copyable<T>::value,
+    "records are stored as raw bytes");
+#endif
+
+ public:
+  TypedRingfile() : error_(0) { }
+
+  bool Create(const std::string & path, size_t size) {
+    error_ = 0;
+    Ringfile::Options options;
+    options.record_size = sizeof(T);
+    return ring_.Create(path, size, options);
+  }
+
+  // Fails with EINVAL if the records in the file are not sizeof(T) bytes.
+  bool Open(const std::string & path, Ringfile::Mode mode) {
+    error_ = 0;
+    if (!ring_.Open(path, mode)) {
+      return false;
+    }
+    if (ring_.record_size() != sizeof(T)) {
+      ring_.Close();
+      error_ = EINVAL;
+      return false;
+    }
+    return true;
+  }
+
+  bool Write(const T & record) {
+    return ring_.Write(&record, sizeof(T));
+  }
+
+  // Read the next record in sequence.
+  bool Read(T * record) {
+    return ring_.Read(record, sizeof(T));
+  }
+
+  // Random access, as Ringfile::ReadAt() and Ringfile::ReadRange().
+  bool ReadAt(size_t index, T * record) {
+    return ring_.ReadAt(index, record);
+  }
+  bool ReadRange(size_t first, size_t count, T * records) {
+    return ring_.ReadRange(first, count, records);
+  }
+
+  // The number of records in the file.
+  size_t size() const { return ring_.record_count(); }
+
+  bool Close() { return ring_.Close(); }
+
+  int error() { return error_ ? error_ : ring_.error(); }
+  Ringfile * ringfile() { return &ring_; }
+
+ private:
+  Ringfile ring_;
+  int error_;
+};
+
+#endif  // TYPED_RINGFILE_H_
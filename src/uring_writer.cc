@@ -0,0 +1,376 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "uring_writer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define RINGFILE_HAVE_URING 1
+#endif
+
+UringWriter::UringWriter()
+  : fd_(-1),
+    ring_fd_(-1),
+    error_(0),
+    batch_size_(1),
+    unsubmitted_(0),
+    sq_map_(NULL),
+    sq_map_size_(0),
+    cq_map_(NULL),
+    cq_map_size_(0),
+    sqes_(NULL),
+    sqes_size_(0),
+    sq_head_(NULL),
+    sq_tail_(NULL),
+    sq_mask_(0),
+    sq_entries_(0),
+    sq_array_(NULL),
+    cq_head_(NULL),
+    cq_tail_(NULL),
+    cq_mask_(0),
+    cqes_(NULL),
+    in_flight_(0),
+    staging_(NULL),
+    staging_size_(0),
+    staging_head_(0),
+    staging_used_(0),
+    first_sequence_(0) {
+}
+
+UringWriter::~UringWriter() {
+  if (ring_fd_ != -1) {
+    uint64_t tag;
+    Drain(&tag);
+  }
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_map_ && cq_map_ != sq_map_) {
+    munmap(cq_map_, cq_map_size_);
+  }
+  if (sq_map_) {
+    munmap(sq_map_, sq_map_size_);
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+  }
+  free(staging_);
+}
+
+#ifdef RINGFILE_HAVE_URING
+
+bool UringWriter::Init(int fd, unsigned queue_depth, size_t staging_size,
+    unsigned batch_size) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = syscall(__NR_io_uring_setup, queue_depth, &params);
+  if (ring_fd_ == -1) {
+    error_ = errno;
+    return false;
+  }
+
+  // Make sure the kernel knows IORING_OP_WRITE (Linux 5.6 and later).
+  {
+    size_t probe_size = sizeof(struct io_uring_probe) +
+      256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe * probe =
+      reinterpret_cast<struct io_uring_probe *>(calloc(1, probe_size));
+    int rv = syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE,
+      probe, 256);
+    bool supported = rv == 0 && probe->last_op >= IORING_OP_WRITE &&
+      (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+      error_ = ENOSYS;
+      return false;
+    }
+  }
+
+  sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_size_ = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_map_size_ > sq_map_size_) {
+      sq_map_size_ = cq_map_size_;
+    }
+    cq_map_size_ = sq_map_size_;
+  }
+
+  sq_map_ = mmap(0, sq_map_size_, PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_map_ == MAP_FAILED) {
+    sq_map_ = NULL;
+    error_ = errno;
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_map_ = sq_map_;
+  } else {
+    cq_map_ = mmap(0, cq_map_size_, PROT_READ|PROT_WRITE,
+      MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_map_ == MAP_FAILED) {
+      cq_map_ = NULL;
+      error_ = errno;
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = mmap(0, sqes_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+    ring_fd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = NULL;
+    error_ = errno;
+    return false;
+  }
+
+  char * sq = reinterpret_cast<char *>(sq_map_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+  char * cq = reinterpret_cast<char *>(cq_map_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  if (posix_memalign(reinterpret_cast<void **>(&staging_), 4096,
+      staging_size) != 0) {
+    staging_ = NULL;
+    error_ = ENOMEM;
+    return false;
+  }
+  staging_size_ = staging_size;
+  batch_size_ = batch_size ? batch_size : 1;
+  fd_ = fd;
+  return true;
+}
+
+bool UringWriter::QueueSqe(const char * data, const Piece & piece,
+    uint64_t user_data) {
+  // We are the only producer, so the tail can be read without ordering.
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & sq_mask_;
+  struct io_uring_sqe * sqe =
+    reinterpret_cast<struct io_uring_sqe *>(sqes_) + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(data);
+  sqe->len = piece.size;
+  sqe->off = piece.offset;
+  sqe->user_data = user_data;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  ++unsubmitted_;
+  ++in_flight_;
+  return true;
+}
+
+bool UringWriter::Enter(unsigned to_submit, unsigned min_complete) {
+  unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+  while (true) {
+    int rv = syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+      flags, NULL, 0);
+    if (rv == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error_ = errno;
+      return false;
+    }
+    unsubmitted_ -= rv;
+    return true;
+  }
+}
+
+void UringWriter::ProcessCompletions() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe * cqe =
+      reinterpret_cast<struct io_uring_cqe *>(cqes_) + (head & cq_mask_);
+    uint64_t sequence = cqe->user_data / kMaxPieces;
+    PendingWrite & write = pending_[sequence - first_sequence_];
+    if (cqe->res < 0) {
+      write.error = -cqe->res;
+    } else if (static_cast<size_t>(cqe->res) <
+        write.piece_sizes[cqe->user_data % kMaxPieces]) {
+      // A short write would leave a torn record in the file.
+      write.error = EIO;
+    }
+    --write.pieces_remaining;
+    --in_flight_;
+    ++head;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+#else  // RINGFILE_HAVE_URING
+
+bool UringWriter::Init(int /*fd*/, unsigned /*queue_depth*/,
+    size_t /*staging_size*/, unsigned /*batch_size*/) {
+  error_ = ENOSYS;
+  return false;
+}
+
+bool UringWriter::QueueSqe(const char * /*data*/, const Piece & /*piece*/,
+    uint64_t /*user_data*/) {
+  error_ = ENOSYS;
+  return false;
+}
+
+bool UringWriter::Enter(unsigned /*to_submit*/, unsigned /*min_complete*/) {
+  error_ = ENOSYS;
+  return false;
+}
+
+void UringWriter::ProcessCompletions() {
+}
+
+#endif  // RINGFILE_HAVE_URING
+
+bool UringWriter::ReserveStaging(size_t size, size_t * position,
+    size_t * span) {
+  if (staging_used_ == 0) {
+    staging_head_ = 0;
+  }
+
+  // Reservations are contiguous; if there is not enough room before the end
+  // of the buffer the rest of it is skipped.
+  size_t skip = 0;
+  if (staging_head_ + size > staging_size_) {
+    skip = staging_size_ - staging_head_;
+  }
+  if (staging_used_ + skip + size > staging_size_) {
+    error_ = EAGAIN;
+    return false;
+  }
+
+  *position = skip ? 0 : staging_head_;
+  *span = skip + size;
+  staging_head_ = *position + size;
+  staging_used_ += skip + size;
+  return true;
+}
+
+bool UringWriter::Queue(const struct iovec * data, int data_count,
+    const Piece * pieces, int piece_count, uint64_t tag) {
+  if (ring_fd_ == -1 || piece_count < 1 || piece_count > kMaxPieces) {
+    error_ = EINVAL;
+    return false;
+  }
+  if (in_flight_ + piece_count > sq_entries_) {
+    error_ = EAGAIN;
+    return false;
+  }
+
+  size_t size = 0;
+  for (int i = 0; i < data_count; ++i) {
+    size += data[i].iov_len;
+  }
+  size_t position, span;
+  if (!ReserveStaging(size, &position, &span)) {
+    return false;
+  }
+
+  char * staged = staging_ + position;
+  for (int i = 0; i < data_count; ++i) {
+    memcpy(staged, data[i].iov_base, data[i].iov_len);
+    staged += data[i].iov_len;
+  }
+
+  PendingWrite write;
+  write.tag = tag;
+  write.staging_bytes = span;
+  write.pieces_remaining = piece_count;
+  for (int i = 0; i < piece_count; ++i) {
+    write.piece_sizes[i] = pieces[i].size;
+  }
+  write.error = 0;
+  pending_.push_back(write);
+
+  uint64_t sequence = first_sequence_ + pending_.size() - 1;
+  staged = staging_ + position;
+  for (int i = 0; i < piece_count; ++i) {
+    if (!QueueSqe(staged, pieces[i], sequence * kMaxPieces + i)) {
+      return false;
+    }
+    staged += pieces[i].size;
+  }
+
+  if (unsubmitted_ >= batch_size_) {
+    return Submit();
+  }
+  return true;
+}
+
+bool UringWriter::Submit() {
+  if (unsubmitted_ == 0) {
+    return true;
+  }
+  return Enter(unsubmitted_, 0);
+}
+
+bool UringWriter::Reap(bool wait, uint64_t * tag) {
+  ProcessCompletions();
+  while (wait && !pending_.empty() &&
+      pending_.front().pieces_remaining > 0) {
+    if (!Enter(unsubmitted_, 1)) {
+      return false;
+    }
+    ProcessCompletions();
+  }
+
+  while (!pending_.empty() && pending_.front().pieces_remaining == 0) {
+    const PendingWrite & write = pending_.front();
+    if (write.error) {
+      // Nothing after a failed write may be reported as complete, so once
+      // the kernel is done with their staging space the failed write and
+      // everything after it are discarded, and the error is reported once.
+      int error = write.error;
+      while (in_flight_ > 0) {
+        if (!Enter(unsubmitted_, 1)) {
+          return false;
+        }
+        ProcessCompletions();
+      }
+      first_sequence_ += pending_.size();
+      pending_.clear();
+      staging_used_ = 0;
+      error_ = error;
+      return false;
+    }
+    *tag = write.tag;
+    staging_used_ -= write.staging_bytes;
+    pending_.pop_front();
+    ++first_sequence_;
+  }
+  return true;
+}
+
+bool UringWriter::Drain(uint64_t * tag) {
+  if (!Submit()) {
+    return false;
+  }
+  while (!pending_.empty()) {
+    if (!Reap(true, tag)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2014 Ross Kinder. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef URING_WRITER_H_
+#define URING_WRITER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <deque>
+
+// UringWriter queues positioned writes to a file descriptor through io_uring
+// so that the caller does not block on the write() system call. Data is copied
+// into a staging buffer when it is queued, submissions are batched, and
+// completions are reported strictly in the order the writes were queued, even
+// if the kernel finishes them out of order.
+//
+// Init() fails with ENOSYS when the kernel or the build does not support
+// io_uring, in which case callers should keep using plain write().
+class UringWriter {
+ public:
+  UringWriter();
+  ~UringWriter();
+
+  // A piece of a queued write: `size` bytes at file offset `offset`.
+  struct Piece {
+    uint64_t offset;
+    size_t size;
+  };
+
+  // Set up a ring of `queue_depth` entries writing to `fd`, with a staging
+  // buffer of `staging_size` bytes. Queued writes are submitted once
+  // `batch_size` of them are waiting.
+  bool Init(int fd, unsigned queue_depth, size_t staging_size,
+    unsigned batch_size);
+
+  // Queue a write. The bytes described by `data` are copied into the staging
+  // buffer and written to the file as `pieces`, whose sizes must add up to
+  // the same total. `tag` is reported by Reap() once every piece of this and
+  // all earlier writes has completed. Blocks for earlier completions if the
+  // ring or the staging buffer is full.
+  bool Queue(const struct iovec * data, int data_count, const Piece * pieces,
+    int piece_count, uint64_t tag);
+
+  // Submit all queued writes to the kernel.
+  bool Submit();
+
+  // Collect completions. If `wait` is true, block until at least one more
+  // write has completed. Returns true and sets `*tag` to the tag of the
+  // newest write that has completed along with everything before it; `*tag`
+  // is left alone if there is no such write. A write that fails is reported
+  // once, and it and every write queued after it are dropped, so the file
+  // is only good up to the last tag reported.
+  bool Reap(bool wait, uint64_t * tag);
+
+  // Submit everything and wait for all outstanding writes to complete.
+  bool Drain(uint64_t * tag);
+
+  // Returns true if any write has been queued but has not yet been reported
+  // by Reap().
+  bool busy() const { return !pending_.empty(); }
+  size_t staging_size() const { return staging_size_; }
+  int error() const { return error_; }
+
+ private:
+  // A write wraps around the end of the file at most once, so it never has
+  // more than two pieces.
+  static const int kMaxPieces = 2;
+
+  struct PendingWrite {
+    uint64_t tag;
+    size_t staging_bytes;
+    int pieces_remaining;
+    // How much each piece should write, to catch short writes.
+    size_t piece_sizes[kMaxPieces];
+    int error;
+  };
+
+  // Reserve `size` contiguous bytes of staging space, returning the offset of
+  // the reservation and adding any bytes skipped at the end of the buffer to
+  // `*span`.
+  bool ReserveStaging(size_t size, size_t * position, size_t * span);
+
+  bool QueueSqe(const char * data, const Piece & piece, uint64_t user_data);
+  bool Enter(unsigned to_submit, unsigned min_complete);
+
+  // Process completion queue entries without blocking.
+  void ProcessCompletions();
+
+  int fd_;
+  int ring_fd_;
+  int error_;
+  unsigned batch_size_;
+  unsigned unsubmitted_;
+
+  void * sq_map_;
+  size_t sq_map_size_;
+  void * cq_map_;
+  size_t cq_map_size_;
+  void * sqes_;
+  size_t sqes_size_;
+
+  unsigned * sq_head_;
+  unsigned * sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned * sq_array_;
+  unsigned * cq_head_;
+  unsigned * cq_tail_;
+  unsigned cq_mask_;
+  void * cqes_;
+  unsigned in_flight_;
+
+  char * staging_;
+  size_t staging_size_;
+  size_t staging_head_;
+  size_t staging_used_;
+
+  // Writes in the order they were queued. The user_data of each submission
+  // queue entry is the sequence number of its write; the front of the queue
+  // has sequence number first_sequence_.
+  std::deque<PendingWrite> pending_;
+  uint64_t first_sequence_;
+};
+
+#endif  // URING_WRITER_H_